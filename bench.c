@@ -0,0 +1,167 @@
+// The functions in this file run the benchmark scenario described in
+// bench.h. The scenario is fixed and does not depend on the controllers,
+// the timer or anything else outside the kernel, so under Qemu with
+// -icount it executes the same instructions on every run, and any change
+// in the counts comes from a change in the code.
+//
+// The phases are:
+//
+//     redraw   repaint the whole maze BENCH_REDRAWS times
+//     moves    move player 0 back and forth BENCH_MOVES times, drawing
+//              each move
+//     solve    find the shortest path from the entrance to the exit with
+//              the flow field, and walk player 0 along it
+//
+// The game is reset before and after the scenario. Only core 0 is
+// measured.
+
+#include "uart.h"
+#include "clock.h"
+#include "pmu.h"
+#include "game.h"
+#include "scale.h"
+#include "flow.h"
+#include "bench.h"
+
+
+// The counters at the start of the current phase
+static unsigned long benchCycles, benchInstructions, benchTicks;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       phaseBegin / phaseEnd
+//
+//  Description:    These functions read the counters at the start of a
+//                  phase, and print the differences at its end.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void phaseBegin()
+{
+    benchTicks = clock_now();
+    benchInstructions = pmu_instructions();
+    benchCycles = pmu_cycles();
+}
+
+static void phaseEnd(char *name)
+{
+    unsigned long cycles, instructions, ticks;
+
+
+    cycles = pmu_cycles() - benchCycles;
+    instructions = (unsigned int)(pmu_instructions() - benchInstructions);
+    ticks = clock_now() - benchTicks;
+
+    uart_puts("BENCH ");
+    uart_puts(name);
+    uart_puts(" cycles=");
+    uart_putdec(cycles);
+    uart_puts(" instructions=");
+    uart_putdec(instructions);
+    uart_puts(" us=");
+    uart_putdec(clock_to_us(ticks));
+    uart_puts("\n");
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       solveMaze
+//
+//  Arguments:      none
+//
+//  Returns:        The number of steps taken.
+//
+//  Description:    This function builds the flow field towards the exit,
+//                  and then walks player 0 downhill on it until it reaches
+//                  the exit, drawing every step.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int solveMaze()
+{
+    static const int stepX[4] = {1, -1, 0, 0};
+    static const int stepY[4] = {0, 0, 1, -1};
+    unsigned int distance;
+    int i, steps = 0;
+
+
+    // Head for the exit
+    flow_reset();
+    flow_set_target(LEVEL_EXIT_X, LEVEL_EXIT_Y);
+    while (!flow_update(FLOW_BUDGET))
+        ;
+
+    distance = flow_distance(playerX[0], playerY[0]);
+    while (distance != 0 && distance != FLOW_UNREACHABLE) {
+        for (i = 0; i < 4; i++) {
+            if (flow_distance(playerX[0] + stepX[i], playerY[0] + stepY[i]) == distance - 1) {
+                break;
+            }
+        }
+        if (i == 4) {
+            break;
+        }
+
+        movePlayer(0, stepX[i], stepY[i]);
+        renderPlayers();
+        distance--;
+        steps++;
+    }
+
+    return steps;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       bench_run
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This console command runs the benchmark scenario. It
+//                  takes over core 0 until it is done, so no frames are
+//                  drawn in the meantime.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void bench_run()
+{
+    int i, scaling;
+
+
+    // The scenario is measured at full resolution
+    scaling = scale_enabled();
+    setScaling(0);
+
+    pmu_init();
+    resetGame();
+    renderPlayers();
+
+    phaseBegin();
+    for (i = 0; i < BENCH_REDRAWS; i++) {
+        drawMaze();
+    }
+    phaseEnd("redraw");
+
+    phaseBegin();
+    for (i = 0; i < BENCH_MOVES; i++) {
+        movePlayer(0, (i & 1) ? -1 : 1, 0);
+        renderPlayers();
+    }
+    phaseEnd("moves");
+
+    phaseBegin();
+    solveMaze();
+    phaseEnd("solve");
+
+    uart_puts("BENCH done\n");
+    resetGame();
+    setScaling(scaling);
+}
@@ -0,0 +1,13 @@
+// A fixed benchmark scenario, run from the console with 'b'. Each phase
+// prints one machine-readable line, which tools/bench.py collects:
+//
+//     BENCH <phase> cycles=<n> instructions=<n> us=<n>
+//
+// followed by "BENCH done" at the end.
+
+// Number of full redraws, and of single-square moves
+#define BENCH_REDRAWS  10
+#define BENCH_MOVES    100
+
+// Function prototypes
+void bench_run();
@@ -0,0 +1,719 @@
+// The functions in this file implement the frame buffer capture described
+// in capture.h. Each captured frame is, with all integers little-endian:
+//
+//     "CAPF"                          magic
+//     u32 frame number (0 for the keyframe that starts a capture)
+//     u32 microseconds since the capture started
+//     u16 width, u16 height           in pixels
+//     u8 depth                        bits per pixel (32, 16 or 8)
+//     u8 pixel order                  frameBufferPixelOrder (0 = BGR)
+//     u8 flags                        bit 0: keyframe, every tile follows;
+//                                     bit 1: more of the frame follows
+//     u8 tile size
+//     u16 palette entries, then each as u32 0x00RRGGBB (8 bpp only)
+//     u16 tile count, then for each tile:
+//         u16 column, u16 row         in tiles
+//         u32 length, then the tile's pixels, RLE-compressed
+//
+// A frame is sent as one message per changed tile (or a single message
+// with no tiles if none changed), all with the frame's number and time.
+// Each message is put in the UART's transmit queue whole, so nothing else
+// is ever sent in the middle of one. The keyframe flag is only set on the
+// first message of a keyframe, and the palette is only sent in the first
+// message of a frame; the others have no palette entries and use it.
+//
+// A few tiles are sent per call to capture_frame(), whenever the queue has
+// room for them, so the game keeps running while a frame goes out. The
+// tiles to send are picked when the frame starts, but each is read when it
+// is sent, so one captured frame may be made of tiles from consecutive
+// rendered frames; a tile that changed in between is sent again with the
+// next captured frame.
+//
+// The hardware cursor is not in the frame buffer, so it is drawn into the
+// tiles it covers as they are sent, and its position and color are part of
+// those tiles' hashes.
+//
+// A tile's pixels are taken row by row, and compressed as a sequence of
+// packets. A header byte with the top bit set is followed by one pixel that
+// is repeated (header & 0x7F) + 1 times; otherwise it is followed by
+// header + 1 literal pixels. Pixels are depth / 8 bytes each.
+//
+// Hashing every tile reads the whole frame buffer, so it is split over
+// cores 1 - 3 by rows of tiles.
+
+#include "uart.h"
+#include "clock.h"
+#include "framebuffer.h"
+#include "smp.h"
+#include "sprite.h"
+#include "trace.h"
+#include "capture.h"
+
+
+// Longest packet, in pixels
+#define CAPTURE_PACKET  128
+
+// TRUE (non-zero) while capturing, and TRUE when the next frame must be a
+// keyframe
+static int captureActive, captureKeyframe;
+static unsigned int captureFrames;
+static unsigned long captureStart;
+
+// The size of the screen in pixels and in tiles
+static unsigned int captureWidth, captureHeight;
+static unsigned int captureTilesX, captureTilesY;
+
+// Each tile's hash in the frame being captured, and when it was last sent
+static unsigned long captureHash[CAPTURE_MAX_TILES][CAPTURE_MAX_TILES];
+static unsigned long captureSent[CAPTURE_MAX_TILES][CAPTURE_MAX_TILES];
+
+// The frame being sent: TRUE (non-zero) while it is, the next tile to look
+// at (row by row), the tiles still to send, TRUE until its first message
+// has been queued, and its time in microseconds
+static int captureSending, captureNextTile, captureRemaining, captureFirst;
+static unsigned int captureTime;
+
+// A tile compressed in captureBuffer but not yet queued for lack of room
+// (-1 for none), and its compressed length
+static int captureHeldTile = -1;
+static unsigned int captureHeldLength;
+
+// The hardware cursor as it was when the frame started (captureCursor is 0
+// when it is not shown)
+static struct sprite *captureCursor;
+static int cursorX, cursorY;
+static unsigned int cursorPixel;
+
+// A message header, with room for a whole palette
+static unsigned char captureHeader[64 + 256 * 4];
+
+// The pixels of the tile being compressed, and the compressed tile
+static unsigned int captureTile[CAPTURE_TILE_SIZE * CAPTURE_TILE_SIZE];
+static unsigned char captureBuffer[CAPTURE_TILE_SIZE * CAPTURE_TILE_SIZE * 4 +
+                                   CAPTURE_TILE_SIZE * CAPTURE_TILE_SIZE / CAPTURE_PACKET];
+
+// The palette, in 8 bpp mode
+static unsigned int capturePalette[256];
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       putWord / putShort
+//
+//  Arguments:      out:      Where to store the value
+//                  value:    The value
+//
+//  Returns:        The position after the value.
+//
+//  Description:    These functions store a 32-bit or 16-bit value, least
+//                  significant byte first.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned char *putWord(unsigned char *out, unsigned int value)
+{
+    *out++ = value;
+    *out++ = value >> 8;
+    *out++ = value >> 16;
+    *out++ = value >> 24;
+    return out;
+}
+
+static unsigned char *putShort(unsigned char *out, unsigned int value)
+{
+    *out++ = value;
+    *out++ = value >> 8;
+    return out;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       tileBounds
+//
+//  Arguments:      tx, ty:          A tile
+//                  x, y:            Receive the tile's top left pixel
+//                  width, height:   Receive the tile's size, which is less
+//                                   than CAPTURE_TILE_SIZE at the right and
+//                                   bottom edges if the screen is not a
+//                                   whole number of tiles
+//
+//  Returns:        void
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void tileBounds(int tx, int ty, int *x, int *y, int *width, int *height)
+{
+    *x = tx * CAPTURE_TILE_SIZE;
+    *y = ty * CAPTURE_TILE_SIZE;
+    *width = frameBufferWidth - *x;
+    *height = frameBufferHeight - *y;
+    if (*width > CAPTURE_TILE_SIZE) {
+        *width = CAPTURE_TILE_SIZE;
+    }
+    if (*height > CAPTURE_TILE_SIZE) {
+        *height = CAPTURE_TILE_SIZE;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       layoutTiles
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE (non-zero) if the frame buffer can be captured.
+//
+//  Description:    This function divides the frame buffer into tiles at its
+//                  current resolution, which changes with dynamic
+//                  resolution scaling.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int layoutTiles()
+{
+    captureWidth = frameBufferWidth;
+    captureHeight = frameBufferHeight;
+    captureTilesX = (captureWidth + CAPTURE_TILE_SIZE - 1) / CAPTURE_TILE_SIZE;
+    captureTilesY = (captureHeight + CAPTURE_TILE_SIZE - 1) / CAPTURE_TILE_SIZE;
+
+    return frameBuffer != 0 && captureTilesX <= CAPTURE_MAX_TILES &&
+           captureTilesY <= CAPTURE_MAX_TILES;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       hashTile
+//
+//  Arguments:      tx, ty:   A tile
+//
+//  Returns:        A 64-bit FNV-1a style hash of the tile's pixels.
+//
+//  Description:    The pixels are read as 32-bit words, so the hash costs
+//                  one read per one to four pixels.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned long hashTile(int tx, int ty)
+{
+    unsigned long hash = 14695981039346656037UL;
+    unsigned int *words;
+    unsigned char *bytes;
+    int x, y, width, height, row, i, count;
+
+
+    tileBounds(tx, ty, &x, &y, &width, &height);
+    count = width * frameBufferBytesPerPixel;
+
+    for (row = 0; row < height; row++) {
+        bytes = frameBuffer + (y + row) * frameBufferPitch +
+                x * frameBufferBytesPerPixel;
+        words = (unsigned int *)bytes;
+        for (i = 0; i < count / 4; i++) {
+            hash = (hash ^ words[i]) * 1099511628211UL;
+        }
+        for (i = count & ~3; i < count; i++) {
+            hash = (hash ^ bytes[i]) * 1099511628211UL;
+        }
+    }
+
+    return hash;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       hashRows
+//
+//  Arguments:      core:     The core running the job (1 - 3)
+//                  arg:      Unused
+//
+//  Returns:        void
+//
+//  Description:    This is the job run by smp_run_parallel(). Each core
+//                  hashes every third row of tiles.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void hashRows(int core, void *arg)
+{
+    unsigned int tx, ty;
+
+
+    for (ty = core - 1; ty < captureTilesY; ty += 3) {
+        for (tx = 0; tx < captureTilesX; tx++) {
+            captureHash[ty][tx] = hashTile(tx, ty);
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       putPixel
+//
+//  Arguments:      out:      Where to store the pixel
+//                  pixel:    The pixel value
+//
+//  Returns:        The position after the pixel.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned char *putPixel(unsigned char *out, unsigned int pixel)
+{
+    unsigned int i;
+
+    for (i = 0; i < frameBufferBytesPerPixel; i++) {
+        *out++ = pixel >> (i * 8);
+    }
+    return out;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       cursorOverlaps
+//
+//  Arguments:      x, y:            Top left pixel of a rectangle
+//                  width, height:   Its size in pixels
+//
+//  Returns:        TRUE (non-zero) if the hardware cursor, as it was when
+//                  the frame started, covers part of the rectangle.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int cursorOverlaps(int x, int y, int width, int height)
+{
+    return captureCursor &&
+           cursorX < x + width && cursorX + captureCursor->width > x &&
+           cursorY < y + height && cursorY + captureCursor->height > y;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       overlayCursor
+//
+//  Arguments:      pixels:          A tile's pixels, row by row
+//                  x, y:            The tile's top left pixel
+//                  width, height:   The tile's size in pixels
+//
+//  Returns:        void
+//
+//  Description:    This function draws the hardware cursor over the part of
+//                  the tile it covers. Pixels of a cursor image are drawn
+//                  if their alpha is at least half, and left out otherwise.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void overlayCursor(unsigned int *pixels, int x, int y, int width, int height)
+{
+    struct sprite *s = captureCursor;
+    unsigned int argb;
+    int i, j;
+
+
+    if (!cursorOverlaps(x, y, width, height)) {
+        return;
+    }
+
+    for (j = 0; j < height; j++) {
+        if (y + j < cursorY || y + j >= cursorY + s->height) {
+            continue;
+        }
+        for (i = 0; i < width; i++) {
+            if (x + i < cursorX || x + i >= cursorX + s->width) {
+                continue;
+            }
+            if (!s->image) {
+                pixels[j * width + i] = cursorPixel;
+                continue;
+            }
+            argb = s->image[(y + j - cursorY) * s->width + (x + i - cursorX)];
+            if ((argb >> 24) >= 0x80) {
+                pixels[j * width + i] = fb_color(argb & 0x00FFFFFF);
+            }
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       encodeTile
+//
+//  Arguments:      tx, ty:   A tile
+//
+//  Returns:        The length of the compressed tile in captureBuffer.
+//
+//  Description:    This function reads the tile's pixels, with the hardware
+//                  cursor drawn in, and compresses them in the format
+//                  described at the top of this file.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned int encodeTile(int tx, int ty)
+{
+    unsigned char *row, *out = captureBuffer;
+    unsigned int *pixels = captureTile;
+    int x, y, width, height, i, j, n, run;
+
+
+    tileBounds(tx, ty, &x, &y, &width, &height);
+
+    n = 0;
+    for (j = 0; j < height; j++) {
+        row = frameBuffer + (y + j) * frameBufferPitch + x * frameBufferBytesPerPixel;
+        for (i = 0; i < width; i++) {
+            switch (frameBufferBytesPerPixel) {
+            case 4:
+                pixels[n++] = ((unsigned int *)row)[i];
+                break;
+            case 2:
+                pixels[n++] = ((unsigned short *)row)[i];
+                break;
+            default:
+                pixels[n++] = row[i];
+                break;
+            }
+        }
+    }
+
+    overlayCursor(pixels, x, y, width, height);
+
+    i = 0;
+    while (i < n) {
+        // A run of two or more equal pixels
+        run = 1;
+        while (i + run < n && run < CAPTURE_PACKET && pixels[i + run] == pixels[i]) {
+            run++;
+        }
+        if (run > 1) {
+            *out++ = 0x80 | (run - 1);
+            out = putPixel(out, pixels[i]);
+            i += run;
+            continue;
+        }
+
+        // Literal pixels, up to the start of the next run
+        for (run = 1; i + run < n && run < CAPTURE_PACKET; run++) {
+            if (i + run + 1 < n && pixels[i + run] == pixels[i + run + 1]) {
+                break;
+            }
+        }
+        *out++ = run - 1;
+        for (j = 0; j < run; j++) {
+            out = putPixel(out, pixels[i + j]);
+        }
+        i += run;
+    }
+
+    return out - captureBuffer;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       capture_toggle
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This console command starts or stops capturing. A new
+//                  capture starts with a keyframe.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void capture_toggle()
+{
+    if (captureActive) {
+        captureActive = 0;
+        uart_puts("Capture stopped\n");
+        return;
+    }
+
+    if (!layoutTiles()) {
+        uart_puts("Cannot capture this frame buffer\n");
+        return;
+    }
+
+    uart_puts("Capturing\n");
+    captureActive = 1;
+    captureKeyframe = 1;
+    captureSending = 0;
+    captureHeldTile = -1;
+    captureFrames = 0;
+    captureStart = clock_now();
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       capture_active
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE (non-zero) while capturing.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int capture_active()
+{
+    return captureActive;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       startFrame
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function starts sending a frame: every tile is
+//                  hashed, with the hardware cursor mixed into the hashes
+//                  of the tiles it covers, and the tiles to send are
+//                  counted.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void startFrame()
+{
+    unsigned int tx, ty;
+
+
+    captureCursor = sprite_cursor();
+    if (captureCursor) {
+        cursorX = captureCursor->x;
+        cursorY = captureCursor->y;
+        cursorPixel = captureCursor->pixel;
+    }
+
+    smp_run_parallel(hashRows, 0);
+
+    captureRemaining = 0;
+    for (ty = 0; ty < captureTilesY; ty++) {
+        for (tx = 0; tx < captureTilesX; tx++) {
+            if (cursorOverlaps(tx * CAPTURE_TILE_SIZE, ty * CAPTURE_TILE_SIZE,
+                               CAPTURE_TILE_SIZE, CAPTURE_TILE_SIZE)) {
+                captureHash[ty][tx] ^= (((unsigned long)cursorX << 32) |
+                                        (cursorY << 16) | 1) * 1099511628211UL;
+                captureHash[ty][tx] ^= cursorPixel;
+            }
+            if (captureKeyframe || captureHash[ty][tx] != captureSent[ty][tx]) {
+                captureRemaining++;
+            }
+        }
+    }
+
+    captureTime = clock_to_us(clock_now() - captureStart);
+    captureNextTile = 0;
+    captureHeldTile = -1;
+    captureFirst = 1;
+    captureSending = 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       queueMessage
+//
+//  Arguments:      tile:     The tile to send, as ty * captureTilesX + tx,
+//                            or -1 for a message without tiles
+//                  length:   The tile's compressed length in captureBuffer
+//
+//  Returns:        TRUE (non-zero) if the message was queued, FALSE (zero)
+//                  if the transmit queue did not have room for all of it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int queueMessage(int tile, unsigned int length)
+{
+    unsigned char *out = captureHeader;
+    unsigned int i, paletteCount, flags;
+
+
+    flags = 0;
+    if (captureKeyframe && captureFirst) {
+        flags |= 1;
+    }
+    if (tile >= 0 && captureRemaining > 1) {
+        flags |= 2;
+    }
+
+    paletteCount = captureFirst ? fb_get_palette(capturePalette) : 0;
+
+    *out++ = 'C';
+    *out++ = 'A';
+    *out++ = 'P';
+    *out++ = 'F';
+    out = putWord(out, captureFrames);
+    out = putWord(out, captureTime);
+    out = putShort(out, captureWidth);
+    out = putShort(out, captureHeight);
+    *out++ = frameBufferDepth;
+    *out++ = frameBufferPixelOrder;
+    *out++ = flags;
+    *out++ = CAPTURE_TILE_SIZE;
+    out = putShort(out, paletteCount);
+    for (i = 0; i < paletteCount; i++) {
+        out = putWord(out, capturePalette[i]);
+    }
+
+    if (tile < 0) {
+        out = putShort(out, 0);
+        length = 0;
+    } else {
+        out = putShort(out, 1);
+        out = putShort(out, tile % captureTilesX);
+        out = putShort(out, tile / captureTilesX);
+        out = putWord(out, length);
+    }
+
+    if ((out - captureHeader) + length > uart_tx_space()) {
+        return 0;
+    }
+    uart_queue(captureHeader, out - captureHeader);
+    uart_queue(captureBuffer, length);
+
+    captureFirst = 0;
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       sendTile
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE (non-zero) if a message was queued, FALSE (zero) if
+//                  the transmit queue is too full for now.
+//
+//  Description:    This function queues the frame's next changed tile, or
+//                  the frame's only message if no tile changed. A tile that
+//                  does not fit is kept compressed for the next call.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int sendTile()
+{
+    unsigned int tx, ty;
+
+
+    if (captureRemaining == 0) {
+        if (!queueMessage(-1, 0)) {
+            return 0;
+        }
+        captureSending = 0;
+        return 1;
+    }
+
+    if (captureHeldTile < 0) {
+        for (;; captureNextTile++) {
+            tx = captureNextTile % captureTilesX;
+            ty = captureNextTile / captureTilesX;
+            if (captureKeyframe || captureHash[ty][tx] != captureSent[ty][tx]) {
+                break;
+            }
+        }
+        captureHeldLength = encodeTile(tx, ty);
+        captureHeldTile = captureNextTile++;
+    }
+
+    if (!queueMessage(captureHeldTile, captureHeldLength)) {
+        return 0;
+    }
+
+    tx = captureHeldTile % captureTilesX;
+    ty = captureHeldTile / captureTilesX;
+    captureSent[ty][tx] = captureHash[ty][tx];
+    captureHeldTile = -1;
+    if (--captureRemaining == 0) {
+        captureSending = 0;
+    }
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       capture_frame
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE (non-zero) once the frame has been queued whole, or
+//                  when not capturing; FALSE (zero) if more of it is left
+//                  for the next call.
+//
+//  Description:    This function sends part of the current frame, if
+//                  capturing: the whole screen for a keyframe, otherwise
+//                  only the tiles that changed since they were last sent.
+//                  A call that finds no frame in progress starts one. Each
+//                  call queues at most CAPTURE_TILES_PER_CALL tiles, and
+//                  stops early when the transmit queue is full, so it never
+//                  waits for the UART. When the resolution has changed, the
+//                  frame in progress is dropped and a keyframe at the new
+//                  size is started.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int capture_frame()
+{
+    int sent;
+
+
+    if (!captureActive) {
+        return 1;
+    }
+
+    if (frameBufferWidth != captureWidth || frameBufferHeight != captureHeight) {
+        if (!layoutTiles()) {
+            captureActive = 0;
+            uart_puts("Cannot capture this frame buffer\n");
+            return 1;
+        }
+        captureKeyframe = 1;
+        captureSending = 0;
+    }
+
+    TRACE_BEGIN(TRACE_CAPTURE);
+
+    if (!captureSending) {
+        startFrame();
+    }
+
+    for (sent = 0; captureSending && sent < CAPTURE_TILES_PER_CALL; sent++) {
+        if (!sendTile()) {
+            break;
+        }
+    }
+
+    if (!captureSending) {
+        captureKeyframe = 0;
+        captureFrames++;
+    }
+
+    TRACE_END(TRACE_CAPTURE);
+
+    return !captureSending;
+}
@@ -0,0 +1,33 @@
+// Frame buffer capture over the UART. While capture is on (the 'c' console
+// command), capture_frame() sends the screen as a stream that
+// tools/capture2png.py turns into PNG files or a video. The first frame is
+// a keyframe with every tile; later frames only send the tiles whose hash
+// changed since they were last sent. Tiles are RLE-compressed, so the
+// flat-colored maze costs a few hundred bytes per changed tile. Frames go
+// out through the UART's transmit queue a few tiles at a time, so sending
+// one never holds up the game; at a low baud rate the captured frame rate
+// drops instead. Capture is meant for the PL011 at a high baud rate (see
+// uart.h); at 115200 baud even one changed tile takes tens of milliseconds
+// to go out.
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+// Tile size in pixels, and the largest screen captured in tiles
+#define CAPTURE_TILE_SIZE   64
+#define CAPTURE_MAX_TILES   32
+
+// Time between captured frames
+#define CAPTURE_PERIOD_US   100000
+
+// Most tiles queued per call to capture_frame(), and the time to wait for
+// the transmit queue to empty before the next call
+#define CAPTURE_TILES_PER_CALL  4
+#define CAPTURE_POLL_US         200
+
+// Function prototypes
+void capture_toggle();
+int capture_active();
+int capture_frame();
+
+#endif
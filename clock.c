@@ -0,0 +1,329 @@
+// The functions in this file implement the clock declared in clock.h.
+//
+// The ARM generic timer has a 64-bit counter (CNTPCT_EL0) that runs at the
+// frequency given in CNTFRQ_EL0, which the firmware sets (19.2 MHz on the
+// Raspberry Pi 3, 62.5 MHz under Qemu). Each core also has a physical
+// timer that raises an interrupt when the counter reaches the compare value
+// in CNTP_CVAL_EL0. That interrupt is used for deadlines: a callback can be
+// run at a given time, and clock_wait_until() sleeps with wfi instead of
+// spinning. There is one compare value, so only one deadline can be set at
+// a time.
+
+#include "systimer.h"
+#include "irq.h"
+#include "clock.h"
+
+
+// CNTP_CTL_EL0 bits
+#define CNTP_ENABLE  (1 << 0)
+#define CNTP_IMASK   (1 << 1)
+
+// The source in use and its frequency in ticks per second
+static int clockSource = CLOCK_SYSTIMER;
+static unsigned long clockFrequency = 1000000;
+
+// The callback of the deadline that is set, and whether a deadline is set
+static void (*volatile clockCallback)();
+static volatile int clockDeadlineSet;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       clock_init
+//
+//  Arguments:      source:   CLOCK_GENERIC or CLOCK_SYSTIMER
+//
+//  Returns:        void
+//
+//  Description:    This function selects the clock source. If the generic
+//                  timer's frequency has not been set by the firmware, the
+//                  BCM system timer is used instead. For the generic timer,
+//                  the timer interrupt is routed to this core (core 0) and
+//                  IRQs are unmasked.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void clock_init(int source)
+{
+    unsigned long frequency;
+
+
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(frequency));
+
+    if (source == CLOCK_GENERIC && frequency != 0) {
+        clockSource = CLOCK_GENERIC;
+        clockFrequency = frequency;
+
+        asm volatile("msr cntp_ctl_el0, %0" :: "r"(0UL));
+        irq_enable_timer();
+        irq_enable();
+    } else {
+        clockSource = CLOCK_SYSTIMER;
+        clockFrequency = 1000000;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       clock_now
+//
+//  Arguments:      none
+//
+//  Returns:        The current time in clock ticks.
+//
+//  Description:    For the generic timer, the isb makes sure the counter is
+//                  not read ahead of the instructions before it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned long clock_now()
+{
+    unsigned long ticks;
+
+
+    if (clockSource == CLOCK_GENERIC) {
+        asm volatile("isb; mrs %0, cntpct_el0" : "=r"(ticks) :: "memory");
+        return ticks;
+    }
+
+    return get_timer_counter();
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       clock_frequency
+//
+//  Arguments:      none
+//
+//  Returns:        The number of clock ticks per second.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned long clock_frequency()
+{
+    return clockFrequency;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       clock_to_us
+//
+//  Arguments:      ticks:    A time or interval in clock ticks
+//
+//  Returns:        The same time in microseconds.
+//
+//  Description:    Whole seconds are converted separately, so the product
+//                  cannot overflow.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned long clock_to_us(unsigned long ticks)
+{
+    return (ticks / clockFrequency) * 1000000 +
+           ((ticks % clockFrequency) * 1000000) / clockFrequency;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       clock_from_us
+//
+//  Arguments:      us:       A time or interval in microseconds
+//
+//  Returns:        The same time in clock ticks.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned long clock_from_us(unsigned long us)
+{
+    return (us / 1000000) * clockFrequency +
+           ((us % 1000000) * clockFrequency) / 1000000;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       clock_set_deadline
+//
+//  Arguments:      deadline:   The time (in clock ticks) to run the callback
+//                  callback:   Function to call from the timer interrupt,
+//                              or 0 to just wake the core
+//
+//  Returns:        TRUE (non-zero) if the deadline was set. Deadlines need
+//                  the generic timer.
+//
+//  Description:    This function sets the physical timer's compare value,
+//                  replacing any deadline that was set before. A deadline
+//                  in the past fires at once.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int clock_set_deadline(unsigned long deadline, void (*callback)())
+{
+    if (clockSource != CLOCK_GENERIC) {
+        return 0;
+    }
+
+    clockCallback = callback;
+    clockDeadlineSet = 1;
+    asm volatile("msr cntp_cval_el0, %0" :: "r"(deadline));
+    asm volatile("msr cntp_ctl_el0, %0; isb" :: "r"((unsigned long)CNTP_ENABLE));
+
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       clock_cancel_deadline
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void clock_cancel_deadline()
+{
+    if (clockSource != CLOCK_GENERIC) {
+        return;
+    }
+
+    asm volatile("msr cntp_ctl_el0, %0; isb" :: "r"(0UL));
+    clockDeadlineSet = 0;
+    clockCallback = 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       clock_irq
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function is called by irq_handler() when the
+//                  physical timer interrupt is pending. The timer is turned
+//                  off, which clears the interrupt, and the deadline's
+//                  callback is run.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void clock_irq()
+{
+    void (*callback)() = clockCallback;
+
+
+    asm volatile("msr cntp_ctl_el0, %0; isb" :: "r"(0UL));
+    clockDeadlineSet = 0;
+    clockCallback = 0;
+
+    if (callback) {
+        callback();
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       clock_sleep_until
+//
+//  Arguments:      deadline:   The time (in clock ticks) to wake at
+//
+//  Returns:        void
+//
+//  Description:    This function returns once the clock reaches the given
+//                  time, or sooner once an interrupt has been taken, so the
+//                  caller can act on what the interrupt did. With the
+//                  generic timer the core sleeps in wfi, unless another
+//                  caller's callback deadline is set, in which case it
+//                  polls. The system timer is always polled, and as under
+//                  Qemu it never moves, no wait is made if it reads 0.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void clock_sleep_until(unsigned long deadline)
+{
+    unsigned long flags;
+    unsigned int count;
+
+
+    if (clockSource == CLOCK_GENERIC) {
+        if (!clockDeadlineSet || !clockCallback) {
+            // IRQs are masked while checking the time, so the interrupt
+            // cannot be taken between the check and the wfi. Any pending
+            // interrupt wakes the core, and is taken when the caller's
+            // mask is restored.
+            flags = irq_save();
+            clock_set_deadline(deadline, 0);
+            if (clock_now() < deadline) {
+                asm volatile("wfi");
+            }
+            irq_restore(flags);
+            return;
+        }
+    } else if (get_timer_counter() == 0) {
+        return;
+    }
+
+    count = irq_count();
+    while (clock_now() < deadline && irq_count() == count)
+        ;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       clock_wait_until
+//
+//  Arguments:      deadline:   The time (in clock ticks) to wait for
+//
+//  Returns:        void
+//
+//  Description:    This function returns once the clock reaches the given
+//                  time, sleeping as clock_sleep_until() does. Interrupts
+//                  taken meanwhile do not cut the wait short.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void clock_wait_until(unsigned long deadline)
+{
+    if (clockSource == CLOCK_SYSTIMER && get_timer_counter() == 0) {
+        return;
+    }
+
+    while (clock_now() < deadline) {
+        clock_sleep_until(deadline);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       clock_delay_us
+//
+//  Arguments:      us:       The time to delay in microseconds
+//
+//  Returns:        void
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void clock_delay_us(unsigned long us)
+{
+    clock_wait_until(clock_now() + clock_from_us(us));
+}
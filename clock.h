@@ -0,0 +1,32 @@
+// The clock used for timestamps, delays and frame pacing. The default
+// source is the ARM generic timer (CNTPCT_EL0), which is read with one
+// system register instruction, ticks faster than once per microsecond, and
+// is emulated by Qemu. The BCM system timer (1 MHz, two MMIO reads, and
+// always 0 under Qemu) is kept as an alternate source. Build with
+// 'make CLOCK_SOURCE=CLOCK_SYSTIMER' to use it.
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+// Clock sources
+#define CLOCK_GENERIC   0
+#define CLOCK_SYSTIMER  1
+
+#ifndef CLOCK_SOURCE
+#define CLOCK_SOURCE    CLOCK_GENERIC
+#endif
+
+// Function prototypes
+void clock_init(int source);
+unsigned long clock_now();
+unsigned long clock_frequency();
+unsigned long clock_to_us(unsigned long ticks);
+unsigned long clock_from_us(unsigned long us);
+int clock_set_deadline(unsigned long deadline, void (*callback)());
+void clock_cancel_deadline();
+void clock_sleep_until(unsigned long deadline);
+void clock_wait_until(unsigned long deadline);
+void clock_delay_us(unsigned long us);
+void clock_irq();
+
+#endif
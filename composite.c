@@ -0,0 +1,366 @@
+// The functions in this file implement the compositing described in
+// composite.h. A blend computes first + (second - first) * alpha for each
+// color channel. Channels are blended a few at a time inside each 32-bit
+// lane: at 32 bpp red and blue are spread 16 bits apart, with green
+// blended separately, so no channel's product reaches the next one; at
+// 16 bpp each RGB 565 pixel is spread over a whole lane as 0x07E0F81F
+// (green in the top half, red and blue in the bottom), which leaves room
+// for a 5-bit alpha. As in raycast.c, the vectors are written with the GCC
+// vector extensions, which GCC compiles to NEON instructions.
+//
+// The screens are saved at the full frame buffer size, so they hold any
+// resolution fb_set_size() picks. With the data cache off, a full-screen
+// 32 bpp cross-fade reads 6 MB and writes 3 MB, which is spread over three
+// cores to fit in a 60 fps frame.
+
+#include "framebuffer.h"
+#include "smp.h"
+#include "trace.h"
+#include "composite.h"
+
+
+// Vectors of four 32-bit lanes, which map onto the NEON Q registers
+typedef unsigned int u32x4 __attribute__((vector_size(16)));
+
+// The masks that spread the channels apart at each depth
+#define MASK_RB         0x00FF00FF
+#define MASK_G          0x0000FF00
+#define MASK_565        0x07E0F81F
+
+// The saved screens, each row frameBufferWidth pixels long
+static unsigned char __attribute__((aligned(16)))
+    compositeBuffer[COMPOSITE_BUFFERS][FRAMEBUFFER_WIDTH * FRAMEBUFFER_HEIGHT * 4];
+
+// One row of a solid color, blended with a pitch of 0 to fade to the color
+static unsigned int __attribute__((aligned(16))) compositeColor[FRAMEBUFFER_WIDTH];
+
+// The blend handed to cores 1 - 3
+struct composite_job {
+    unsigned char *destination, *first, *second;
+    unsigned int destinationPitch, firstPitch, secondPitch;
+    int width, height, alpha;
+};
+
+static struct composite_job compositeJob;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       blendVector32, blendVector16
+//                  blendLane32, blendLane16
+//
+//  Arguments:      first, second:   Four lanes of pixels of each image: 4
+//                                   pixels at 32 bpp, 8 at 16 bpp
+//                  alpha:           0 - COMPOSITE_OPAQUE, in every lane
+//
+//  Returns:        The blended lanes.
+//
+//  Description:    These are the inner loops of the blend, always inlined,
+//                  so that they work on vectors in blendRow() and on single
+//                  lanes for the pixels that do not fill a vector.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#define DEFINE_BLEND(name, type)                                              \
+static inline __attribute__((always_inline))                                  \
+type name##32(type first, type second, type alpha)                           \
+{                                                                             \
+    type rb, g, inverse = COMPOSITE_OPAQUE - alpha;                           \
+                                                                              \
+    rb = (((first & MASK_RB) * inverse + (second & MASK_RB) * alpha) >> 8)    \
+         & MASK_RB;                                                           \
+    g = (((first & MASK_G) * inverse + (second & MASK_G) * alpha) >> 8)       \
+        & MASK_G;                                                             \
+    return rb | g;                                                            \
+}                                                                             \
+                                                                              \
+static inline __attribute__((always_inline))                                  \
+type name##16(type first, type second, type alpha)                           \
+{                                                                             \
+    type low, high, inverse;                                                  \
+                                                                              \
+    alpha = alpha >> 3;                                                       \
+    inverse = 32 - alpha;                                                     \
+                                                                              \
+    /* The pixel in the low half of each lane, then the high one */           \
+    low = ((((first & 0xFFFF) | (first << 16)) & MASK_565) * inverse +        \
+           (((second & 0xFFFF) | (second << 16)) & MASK_565) * alpha) >> 5;  \
+    high = ((((first >> 16) | (first & 0xFFFF0000)) & MASK_565) * inverse +   \
+            (((second >> 16) | (second & 0xFFFF0000)) & MASK_565) * alpha) >> 5; \
+    low &= MASK_565;                                                          \
+    high &= MASK_565;                                                         \
+    return ((low | (low >> 16)) & 0xFFFF) | ((high | (high << 16)) & 0xFFFF0000); \
+}
+
+DEFINE_BLEND(blendVector, u32x4)
+DEFINE_BLEND(blendLane, unsigned int)
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       blendRow
+//
+//  Arguments:      destination:     The row to write
+//                  first, second:   The rows to blend
+//                  bytes:           The length of the rows in bytes
+//                  alpha:           0 - COMPOSITE_OPAQUE
+//                  bytesPerPixel:   4 or 2, a constant once inlined
+//
+//  Returns:        void
+//
+//  Description:    This function blends one row, 16 bytes at a time when all
+//                  three rows are 16-byte aligned. The pixels left over, or
+//                  the whole row when the rows are not aligned, are blended
+//                  a lane at a time; at 16 bpp a row of an odd width ends in
+//                  half a lane, which is blended on its own.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline))
+void blendRow(unsigned char *destination, unsigned char *first,
+              unsigned char *second, int bytes, int alpha,
+              const int bytesPerPixel)
+{
+    u32x4 alphas = {alpha, alpha, alpha, alpha};
+    unsigned int value;
+    int i = 0;
+
+
+    if ((((unsigned long)destination | (unsigned long)first |
+          (unsigned long)second) & 15) == 0) {
+        for (; i + 16 <= bytes; i += 16) {
+            *(u32x4 *)(destination + i) =
+                bytesPerPixel == 4 ?
+                blendVector32(*(u32x4 *)(first + i), *(u32x4 *)(second + i), alphas) :
+                blendVector16(*(u32x4 *)(first + i), *(u32x4 *)(second + i), alphas);
+        }
+    }
+
+    for (; i + 4 <= bytes; i += 4) {
+        *(unsigned int *)(destination + i) =
+            bytesPerPixel == 4 ?
+            blendLane32(*(unsigned int *)(first + i), *(unsigned int *)(second + i), alpha) :
+            blendLane16(*(unsigned int *)(first + i), *(unsigned int *)(second + i), alpha);
+    }
+
+    if (i < bytes) {
+        value = blendLane16(*(unsigned short *)(first + i),
+                            *(unsigned short *)(second + i), alpha);
+        *(unsigned short *)(destination + i) = value;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       blendBand
+//
+//  Arguments:      core:     The core running the job (1 - 3), which picks
+//                            the band
+//                  arg:      The struct composite_job
+//
+//  Returns:        void
+//
+//  Description:    This is the job run by smp_run_parallel(). The rows are
+//                  split into three bands, and the core blends its own.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void blendBand(int core, void *arg)
+{
+    struct composite_job *job = arg;
+    int bandHeight, row, last, bytes;
+
+
+    bandHeight = (job->height + 2) / 3;
+    row = (core - 1) * bandHeight;
+    last = row + bandHeight;
+    if (last > job->height) {
+        last = job->height;
+    }
+    bytes = job->width * frameBufferBytesPerPixel;
+
+    for (; row < last; row++) {
+        if (frameBufferBytesPerPixel == 4) {
+            blendRow(job->destination + row * job->destinationPitch,
+                     job->first + row * job->firstPitch,
+                     job->second + row * job->secondPitch,
+                     bytes, job->alpha, 4);
+        } else {
+            blendRow(job->destination + row * job->destinationPitch,
+                     job->first + row * job->firstPitch,
+                     job->second + row * job->secondPitch,
+                     bytes, job->alpha, 2);
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       composite_supported
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE (non-zero) if the frame buffer's pixel format can be
+//                  blended, that is at 32 or 16 bpp.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int composite_supported()
+{
+    return frameBufferBytesPerPixel == 4 || frameBufferBytesPerPixel == 2;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       composite_blend
+//
+//  Arguments:      destination:       The image to write
+//                  destinationPitch:  Bytes per row of the destination
+//                  first, second:     The images to blend, which may be the
+//                                     destination
+//                  firstPitch,
+//                  secondPitch:       Bytes per row of each, or 0 to use
+//                                     the same row for every row
+//                  width, height:     The size of the images in pixels
+//                  alpha:             0 (the first image) -
+//                                     COMPOSITE_OPAQUE (the second)
+//
+//  Returns:        void
+//
+//  Description:    This function blends two images in the frame buffer's
+//                  pixel format, with the rows split over cores 1 - 3. It
+//                  returns once every row has been written.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void composite_blend(unsigned char *destination, unsigned int destinationPitch,
+                     unsigned char *first, unsigned int firstPitch,
+                     unsigned char *second, unsigned int secondPitch,
+                     int width, int height, int alpha)
+{
+    if (!composite_supported()) {
+        return;
+    }
+
+    TRACE_BEGIN(TRACE_COMPOSITE);
+
+    compositeJob.destination = destination;
+    compositeJob.destinationPitch = destinationPitch;
+    compositeJob.first = first;
+    compositeJob.firstPitch = firstPitch;
+    compositeJob.second = second;
+    compositeJob.secondPitch = secondPitch;
+    compositeJob.width = width;
+    compositeJob.height = height;
+    compositeJob.alpha = alpha;
+    smp_run_parallel(blendBand, &compositeJob);
+
+    TRACE_END(TRACE_COMPOSITE);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       composite_save
+//
+//  Arguments:      buffer:   The saved screen to write (0 or 1)
+//
+//  Returns:        void
+//
+//  Description:    This function copies the whole frame buffer into a saved
+//                  screen.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void composite_save(int buffer)
+{
+    fb_read(0, 0, frameBufferWidth, frameBufferHeight, compositeBuffer[buffer],
+            frameBufferWidth * frameBufferBytesPerPixel);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillColor
+//
+//  Arguments:      pixel:    Pixel value returned by fb_color()
+//
+//  Returns:        void
+//
+//  Description:    This function fills compositeColor with a row of the
+//                  pixel.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void fillColor(unsigned int pixel)
+{
+    int i;
+
+
+    if (frameBufferBytesPerPixel == 2) {
+        pixel = (pixel & 0xFFFF) | (pixel << 16);
+    }
+    for (i = 0; i < FRAMEBUFFER_WIDTH; i++) {
+        compositeColor[i] = pixel;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       composite_crossfade
+//                  composite_fade_to
+//                  composite_fade_from
+//
+//  Arguments:      pixel:    Pixel value returned by fb_color()
+//                  alpha:    How far the fade has gone, from 0 to
+//                            COMPOSITE_OPAQUE
+//
+//  Returns:        void
+//
+//  Description:    These functions draw one step of a transition on the
+//                  whole frame buffer: from saved screen 0 to saved screen
+//                  1, from saved screen 0 to a solid color, and from a solid
+//                  color to saved screen 1.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void composite_crossfade(int alpha)
+{
+    unsigned int pitch = frameBufferWidth * frameBufferBytesPerPixel;
+
+    composite_blend(frameBuffer, frameBufferPitch, compositeBuffer[0], pitch,
+                    compositeBuffer[1], pitch, frameBufferWidth,
+                    frameBufferHeight, alpha);
+}
+
+void composite_fade_to(unsigned int pixel, int alpha)
+{
+    unsigned int pitch = frameBufferWidth * frameBufferBytesPerPixel;
+
+    fillColor(pixel);
+    composite_blend(frameBuffer, frameBufferPitch, compositeBuffer[0], pitch,
+                    (unsigned char *)compositeColor, 0, frameBufferWidth,
+                    frameBufferHeight, alpha);
+}
+
+void composite_fade_from(unsigned int pixel, int alpha)
+{
+    unsigned int pitch = frameBufferWidth * frameBufferBytesPerPixel;
+
+    fillColor(pixel);
+    composite_blend(frameBuffer, frameBufferPitch, (unsigned char *)compositeColor,
+                    0, compositeBuffer[1], pitch, frameBufferWidth,
+                    frameBufferHeight, alpha);
+}
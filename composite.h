@@ -0,0 +1,30 @@
+// Compositing for screen transitions. composite_blend() mixes two images
+// with a constant alpha, which gives a cross-fade between two saved
+// screens, and a fade to or from a solid color (an image whose rows all
+// come from one row of that color). The work is split over cores 1 - 3 by
+// bands of rows, and each row is blended 16 bytes at a time with NEON: 4
+// pixels per vector at 32 bpp and 8 at 16 bpp. Only 32 and 16 bpp are
+// supported; in palette mode the day/night cycle's brightness control is
+// the cheaper way to fade.
+
+#ifndef COMPOSITE_H
+#define COMPOSITE_H
+
+// The alpha that gives the second image alone. Alphas run from 0 to this.
+#define COMPOSITE_OPAQUE    256
+
+// The saved screens
+#define COMPOSITE_BUFFERS   2
+
+// Function prototypes
+int composite_supported();
+void composite_blend(unsigned char *destination, unsigned int destinationPitch,
+                     unsigned char *first, unsigned int firstPitch,
+                     unsigned char *second, unsigned int secondPitch,
+                     int width, int height, int alpha);
+void composite_save(int buffer);
+void composite_crossfade(int alpha);
+void composite_fade_to(unsigned int pixel, int alpha);
+void composite_fade_from(unsigned int pixel, int alpha);
+
+#endif
@@ -0,0 +1,113 @@
+// The functions in this file implement a tiny command console on the UART.
+// Each command is a single character typed at the terminal, and is looked up
+// in the consoleCommands table below. The console is polled by the console
+// task, so it never blocks the game when no input is waiting.
+
+#include "uart.h"
+#include "console.h"
+#include "latency.h"
+#include "game.h"
+#include "trace.h"
+#include "log.h"
+#include "capture.h"
+#include "mmio.h"
+#include "replay.h"
+#include "bench.h"
+
+
+// A console command: the character that invokes it, a short description
+// for the help text, and the function that carries it out
+struct console_command {
+    char key;
+    char *help;
+    void (*handler)();
+};
+
+static void console_help();
+
+// The table of console commands
+static struct console_command consoleCommands[] = {
+    {'?', "list commands", console_help},
+    {'l', "print input-to-photon latency report", latency_report},
+    {'d', "toggle the day/night palette cycle", toggleDayNight},
+    {'t', "dump the binary event trace", trace_dump},
+    {'g', "dump the binary log", log_dump},
+    {'w', "start or stop streaming the binary log", log_stream_toggle},
+    {'c', "start or stop capturing the screen", capture_toggle},
+    {'m', "print the MMIO access counts", mmio_report},
+    {'f', "toggle the frame rate and idle time report", toggleTelemetry},
+    {'s', "toggle dynamic resolution scaling", toggleScaling},
+    {'o', "toggle the fog of war", toggleFog},
+    {'n', "show or hide the minimap", toggleMinimap},
+    {'h', "show or hide the HUD", toggleHud},
+    {'r', "start or stop recording input", toggleRecording},
+    {'p', "start or stop replaying the recorded input", toggleReplay},
+    {'x', "export the recorded input", replay_export},
+    {'i', "import recorded input", replay_import},
+    {'b', "run the benchmark scenario", bench_run},
+};
+
+#define CONSOLE_COMMANDS  (sizeof(consoleCommands) / sizeof(consoleCommands[0]))
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       console_help
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function lists every console command on the terminal.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void console_help()
+{
+    unsigned int i;
+
+    for (i = 0; i < CONSOLE_COMMANDS; i++) {
+        uart_puts("    ");
+        uart_putc(consoleCommands[i].key);
+        uart_puts("  ");
+        uart_puts(consoleCommands[i].help);
+        uart_puts("\n");
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       console_poll
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function checks whether a character has been received
+//                  from the terminal. If so, it runs the matching command.
+//                  Unknown characters (including newlines) are ignored.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void console_poll()
+{
+    unsigned int i;
+    char c;
+
+
+    if (!uart_rx_ready()) {
+        return;
+    }
+
+    c = uart_getc();
+
+    for (i = 0; i < CONSOLE_COMMANDS; i++) {
+        if (consoleCommands[i].key == c) {
+            consoleCommands[i].handler();
+            return;
+        }
+    }
+}
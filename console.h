@@ -0,0 +1,2 @@
+// Function prototypes for the UART command console
+void console_poll();
@@ -0,0 +1,362 @@
+// The functions in this file keep the entity pools, move the chasers along
+// the flow field and draw them on the map.
+//
+// The per-frame cost is a fixed amount of work per entity: a chaser only
+// looks at the flow field distances of its four neighbouring squares, and
+// drawing only touches the squares that entities entered or left. Squares
+// shared by several entities are tracked with a per-square count of the
+// entities drawn there, so a square is only repainted when the first
+// entity arrives or the last one leaves.
+
+#include "framebuffer.h"
+#include "game.h"
+#include "flow.h"
+#include "entity.h"
+#include "trace.h"
+
+
+// Entities are drawn as a square of this size in the middle of their square
+#define ENTITY_SIZE     (tileSize / 2)
+
+// Entity properties
+int entityCount;
+short entityX[ENTITY_MAX], entityY[ENTITY_MAX];
+signed char entityVX[ENTITY_MAX], entityVY[ENTITY_MAX];
+unsigned char entityType[ENTITY_MAX];
+unsigned char entityPeriod[ENTITY_MAX], entityTimer[ENTITY_MAX];
+
+// Render state: the pixel value an entity is drawn with, and the square it
+// was last drawn in (if entityDrawn is TRUE)
+static unsigned int entityPixel[ENTITY_MAX];
+static short entityDrawnX[ENTITY_MAX], entityDrawnY[ENTITY_MAX];
+static unsigned char entityDrawn[ENTITY_MAX];
+
+// Number of entities drawn in each square, and the pixel value the square
+// was drawn with
+static unsigned short entityCellCount[MAZE_HEIGHT][MAZE_WIDTH];
+static unsigned int entityCellPixel[MAZE_HEIGHT][MAZE_WIDTH];
+
+// The update in which an entity last entered or left each square
+static unsigned int entityCellStamp[MAZE_HEIGHT][MAZE_WIDTH];
+static unsigned int entityFrame = 1;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       entity_spawn
+//
+//  Arguments:      type:     ENTITY_CHASER
+//                  x, y:     The square to place the entity in
+//                  period:   Frames between steps (1 - 255)
+//                  pixel:    Pixel value to draw the entity with
+//
+//  Returns:        The new entity's number, or -1 if the pools are full.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int entity_spawn(int type, int x, int y, int period, unsigned int pixel)
+{
+    int e = entityCount;
+
+
+    if (e >= ENTITY_MAX) {
+        return -1;
+    }
+
+    entityX[e] = x;
+    entityY[e] = y;
+    entityVX[e] = 0;
+    entityVY[e] = 0;
+    entityType[e] = type;
+    entityPeriod[e] = period;
+    entityTimer[e] = period;
+    entityPixel[e] = pixel;
+    entityDrawn[e] = 0;
+    entityCellStamp[y][x] = entityFrame;
+
+    entityCount++;
+    return e;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       stepChaser
+//
+//  Arguments:      e:     The entity
+//
+//  Returns:        void
+//
+//  Description:    This function moves a chaser one square downhill on the
+//                  flow field, to the neighbour closest to the target. When
+//                  two neighbours are equally close the chaser keeps going
+//                  the way it was going. A chaser that is on a square the
+//                  field does not reach yet stays where it is.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void stepChaser(int e)
+{
+    static const signed char stepX[4] = {1, -1, 0, 0};
+    static const signed char stepY[4] = {0, 0, 1, -1};
+    unsigned int best, distance;
+    int i, x, y, bestX, bestY;
+
+
+    x = entityX[e];
+    y = entityY[e];
+    best = flow_distance(x, y);
+    if (best == FLOW_UNREACHABLE) {
+        return;
+    }
+
+    // Try the current direction first, so it wins ties
+    bestX = entityVX[e];
+    bestY = entityVY[e];
+    if (bestX != 0 || bestY != 0) {
+        distance = flow_distance(x + bestX, y + bestY);
+        if (distance < best) {
+            best = distance;
+        } else {
+            bestX = bestY = 0;
+        }
+    }
+
+    for (i = 0; i < 4; i++) {
+        distance = flow_distance(x + stepX[i], y + stepY[i]);
+        if (distance < best) {
+            best = distance;
+            bestX = stepX[i];
+            bestY = stepY[i];
+        }
+    }
+
+    entityVX[e] = bestX;
+    entityVY[e] = bestY;
+    if (bestX == 0 && bestY == 0) {
+        return;
+    }
+
+    entityCellStamp[y][x] = entityFrame;
+    entityX[e] = x + bestX;
+    entityY[e] = y + bestY;
+    entityCellStamp[y + bestY][x + bestX] = entityFrame;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       entity_update
+//
+//  Arguments:      targetX, targetY:   The square the chasers are after
+//
+//  Returns:        TRUE (non-zero) if a chaser is on the target square.
+//
+//  Description:    This function advances every entity by one frame. Each
+//                  entity steps once every entityPeriod frames.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int entity_update(int targetX, int targetY)
+{
+    int e, caught = 0;
+
+
+    TRACE_BEGIN(TRACE_ENTITIES);
+    entityFrame++;
+
+    for (e = 0; e < entityCount; e++) {
+        if (--entityTimer[e] != 0) {
+            continue;
+        }
+        entityTimer[e] = entityPeriod[e];
+
+        if (entityType[e] == ENTITY_CHASER) {
+            stepChaser(e);
+        }
+    }
+
+    for (e = 0; e < entityCount; e++) {
+        if (entityType[e] == ENTITY_CHASER && entityX[e] == targetX &&
+            entityY[e] == targetY) {
+            caught = 1;
+        }
+    }
+
+    TRACE_END(TRACE_ENTITIES);
+    return caught;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       entity_cell_changed
+//
+//  Arguments:      x, y:     A square
+//
+//  Returns:        TRUE (non-zero) if an entity entered or left the square
+//                  in the last update, so that entity_render() may draw in
+//                  it.
+//
+//  Description:    Software sprites keep a copy of the pixels beneath them,
+//                  so a caller uses this to lift a sprite off a square
+//                  before entity_render() draws there.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int entity_cell_changed(int x, int y)
+{
+    return entityCellStamp[y][x] == entityFrame;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       drawCell
+//
+//  Arguments:      x, y:     A square
+//                  pixel:    Pixel value to draw with
+//
+//  Returns:        void
+//
+//  Description:    This function fills the middle of a square, where the
+//                  entities are drawn.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void drawCell(int x, int y, unsigned int pixel)
+{
+    fb_fill_rect(y * tileSize + (tileSize - ENTITY_SIZE) / 2,
+                 x * tileSize + (tileSize - ENTITY_SIZE) / 2,
+                 ENTITY_SIZE, ENTITY_SIZE, pixel);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       entity_render
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function brings the map up to date with the entity
+//                  positions. A square is cleared when the last entity
+//                  drawn there leaves it, and drawn when the first entity
+//                  arrives, unless the square is hidden by the fog of war.
+//                  Entities that did not move cost nothing.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void entity_render()
+{
+    int e, x, y;
+
+
+    for (e = 0; e < entityCount; e++) {
+        x = entityX[e];
+        y = entityY[e];
+
+        if (entityDrawn[e]) {
+            if (entityDrawnX[e] == x && entityDrawnY[e] == y) {
+                continue;
+            }
+            if (--entityCellCount[entityDrawnY[e]][entityDrawnX[e]] == 0) {
+                drawCell(entityDrawnX[e], entityDrawnY[e],
+                         cellPixel(entityDrawnX[e], entityDrawnY[e]));
+            }
+        }
+
+        if (entityCellCount[y][x]++ == 0) {
+            entityCellPixel[y][x] = entityPixel[e];
+            if (cellVisible(x, y)) {
+                drawCell(x, y, entityPixel[e]);
+            }
+        }
+        entityDrawnX[e] = x;
+        entityDrawnY[e] = y;
+        entityDrawn[e] = 1;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       entity_redraw_cell
+//
+//  Arguments:      x, y:     A square
+//
+//  Returns:        void
+//
+//  Description:    This function draws the entities in one square again,
+//                  for use after the square has been repainted, for example
+//                  because the fog of war over it lifted.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void entity_redraw_cell(int x, int y)
+{
+    if (entityCellCount[y][x] > 0 && cellVisible(x, y)) {
+        drawCell(x, y, entityCellPixel[y][x]);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       entity_redraw_all
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function draws every entity again, for use after
+//                  the whole map has been repainted.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void entity_redraw_all()
+{
+    int e, x, y;
+
+
+    for (y = 0; y < MAZE_HEIGHT; y++) {
+        for (x = 0; x < MAZE_WIDTH; x++) {
+            entityCellCount[y][x] = 0;
+        }
+    }
+
+    for (e = 0; e < entityCount; e++) {
+        entityDrawn[e] = 0;
+    }
+
+    entity_render();
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       entity_clear
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function removes every entity. Entities already on
+//                  the screen stay there until the map is next repainted.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void entity_clear()
+{
+    entityCount = 0;
+}
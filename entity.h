@@ -0,0 +1,32 @@
+// Entities: the actors in the maze other than the players. Each property is
+// kept in an array of its own (structure of arrays), indexed by entity
+// number, so a pass over one property touches only that property's memory.
+// Live entities are kept packed at the start of the arrays.
+
+#ifndef ENTITY_H
+#define ENTITY_H
+
+// Maximum number of entities
+#define ENTITY_MAX      256
+
+// Entity types
+#define ENTITY_NONE     0
+#define ENTITY_CHASER   1
+
+// Number of live entities, and their properties (defined in entity.c)
+extern int entityCount;
+extern short entityX[ENTITY_MAX], entityY[ENTITY_MAX];
+extern signed char entityVX[ENTITY_MAX], entityVY[ENTITY_MAX];
+extern unsigned char entityType[ENTITY_MAX];
+extern unsigned char entityPeriod[ENTITY_MAX], entityTimer[ENTITY_MAX];
+
+// Function prototypes
+int entity_spawn(int type, int x, int y, int period, unsigned int pixel);
+int entity_update(int targetX, int targetY);
+int entity_cell_changed(int x, int y);
+void entity_render();
+void entity_redraw_cell(int x, int y);
+void entity_redraw_all();
+void entity_clear();
+
+#endif
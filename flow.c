@@ -0,0 +1,242 @@
+// The functions in this file maintain the flow field used by the chasers.
+// The field is a breadth-first search (BFS) from the target square over the
+// open squares of the maze. It is only rebuilt when the target moves, and the
+// rebuild is time-sliced: flow_update() expands at most a fixed number of
+// squares per frame, so a large maze costs more frames, not a longer frame.
+// A search in progress is never thrown away when the target moves again:
+// it runs to the end, and a search from the newest target starts after it.
+// So however long a rebuild takes, the chasers get a new field every
+// rebuild, towards where the player was when it started, even when the
+// player never stops moving.
+//
+// Two fields are kept. The chasers read the current one while the next one
+// is built, and the two are swapped when the search finishes. Instead of
+// clearing a field before each search, every square carries the number of
+// the search that last reached it; a square stamped by an older search has
+// not been reached yet. Starting a search is therefore constant time too.
+
+#include "game.h"
+#include "flow.h"
+#include "trace.h"
+
+
+#define FLOW_CELLS  (MAZE_WIDTH * MAZE_HEIGHT)
+
+// One flow field
+struct flow_field {
+    unsigned short distance[FLOW_CELLS];   // Steps to the target
+    unsigned int stamp[FLOW_CELLS];        // Search that set the distance
+    unsigned int generation;               // Search that built this field
+};
+
+static struct flow_field flowFields[2];
+
+// Index of the field the chasers read; the other one is being built
+static int flowCurrent;
+
+// The search in progress (or the last one): its target, and the queue of
+// squares whose neighbours are still to be expanded. Each square is queued
+// at most once per search, so the queue never holds more than FLOW_CELLS
+// entries. The newest target asked for is kept separately, to be searched
+// from once the search in progress is finished.
+static int flowTargetX = -1, flowTargetY = -1;
+static int flowWantX = -1, flowWantY = -1;
+static int flowBuilding;
+static unsigned short flowQueue[FLOW_CELLS];
+static unsigned int flowHead, flowTail;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       startSearch
+//
+//  Arguments:      x, y:     The target square
+//
+//  Returns:        void
+//
+//  Description:    This function starts building the next field from the
+//                  target square.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void startSearch(int x, int y)
+{
+    struct flow_field *next = &flowFields[1 - flowCurrent];
+    int cell = y * MAZE_WIDTH + x;
+
+
+    flowTargetX = x;
+    flowTargetY = y;
+
+    next->generation = flowFields[flowCurrent].generation + 1;
+    next->distance[cell] = 0;
+    next->stamp[cell] = next->generation;
+
+    flowQueue[0] = cell;
+    flowHead = 0;
+    flowTail = 1;
+    flowBuilding = 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       flow_set_target
+//
+//  Arguments:      x, y:     The square the chasers head for
+//
+//  Returns:        void
+//
+//  Description:    This function asks for a field towards the target square.
+//                  If no search is in progress and the target has moved, a
+//                  new search starts now. Otherwise the search in progress
+//                  is left to finish, and flow_update() then starts one
+//                  from the newest target. The current field stays in use
+//                  until a new one is finished.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void flow_set_target(int x, int y)
+{
+    flowWantX = x;
+    flowWantY = y;
+
+    if (!flowBuilding && (x != flowTargetX || y != flowTargetY)) {
+        startSearch(x, y);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       flow_update
+//
+//  Arguments:      budget:   The largest number of squares to expand
+//
+//  Returns:        TRUE (non-zero) if a new field was finished and is now
+//                  the current one.
+//
+//  Description:    This function continues the search in progress, taking
+//                  squares from the queue and giving each open neighbour
+//                  that has not been reached yet a distance one greater.
+//                  When a search finishes and the target has moved since it
+//                  started, the next search starts at once, to be continued
+//                  on the next call.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int flow_update(int budget)
+{
+    static const int neighbourX[4] = {1, -1, 0, 0};
+    static const int neighbourY[4] = {0, 0, 1, -1};
+    struct flow_field *next = &flowFields[1 - flowCurrent];
+    unsigned int cell, distance;
+    int i, x, y, nx, ny, n;
+
+
+    if (!flowBuilding) {
+        return 0;
+    }
+
+    TRACE_BEGIN(TRACE_FLOW);
+
+    while (budget-- > 0 && flowHead < flowTail) {
+        cell = flowQueue[flowHead++];
+        x = cell % MAZE_WIDTH;
+        y = cell / MAZE_WIDTH;
+        distance = next->distance[cell] + 1;
+
+        for (i = 0; i < 4; i++) {
+            nx = x + neighbourX[i];
+            ny = y + neighbourY[i];
+            if (nx < 0 || nx >= MAZE_WIDTH || ny < 0 || ny >= MAZE_HEIGHT ||
+                maze[ny][nx] == 1) {
+                continue;
+            }
+
+            n = ny * MAZE_WIDTH + nx;
+            if (next->stamp[n] != next->generation) {
+                next->stamp[n] = next->generation;
+                next->distance[n] = distance;
+                flowQueue[flowTail++] = n;
+            }
+        }
+    }
+
+    TRACE_END(TRACE_FLOW);
+
+    if (flowHead < flowTail) {
+        return 0;
+    }
+
+    // The search is finished, so the chasers switch to the new field
+    flowCurrent = 1 - flowCurrent;
+    flowBuilding = 0;
+
+    if (flowWantX != flowTargetX || flowWantY != flowTargetY) {
+        startSearch(flowWantX, flowWantY);
+    }
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       flow_distance
+//
+//  Arguments:      x, y:     A square
+//
+//  Returns:        The number of steps from the square to the target, or
+//                  FLOW_UNREACHABLE.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int flow_distance(int x, int y)
+{
+    struct flow_field *field = &flowFields[flowCurrent];
+    int cell;
+
+
+    if (x < 0 || x >= MAZE_WIDTH || y < 0 || y >= MAZE_HEIGHT) {
+        return FLOW_UNREACHABLE;
+    }
+
+    cell = y * MAZE_WIDTH + x;
+    if (field->generation == 0 || field->stamp[cell] != field->generation) {
+        return FLOW_UNREACHABLE;
+    }
+
+    return field->distance[cell];
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       flow_reset
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function empties the flow field and abandons any
+//                  search in progress, so the next flow_set_target() starts
+//                  from scratch. Moving the current field's search number
+//                  past every stamp in either field makes every square
+//                  unreached without clearing anything.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void flow_reset()
+{
+    flowFields[flowCurrent].generation += 2;
+    flowTargetX = -1;
+    flowTargetY = -1;
+    flowWantX = -1;
+    flowWantY = -1;
+    flowBuilding = 0;
+}
@@ -0,0 +1,21 @@
+// A distance flow field over the maze. Every open square holds the number
+// of steps to the target square (the player), so a chaser only has to step
+// to the neighbouring square with the smallest distance.
+
+#ifndef FLOW_H
+#define FLOW_H
+
+// Distance of a square the target cannot be reached from (or a wall)
+#define FLOW_UNREACHABLE  0xFFFF
+
+// Number of squares expanded per call to flow_update(). This bounds the
+// per-frame cost of rebuilding the field, whatever the size of the maze.
+#define FLOW_BUDGET       64
+
+// Function prototypes
+void flow_set_target(int x, int y);
+int flow_update(int budget);
+unsigned int flow_distance(int x, int y);
+void flow_reset();
+
+#endif
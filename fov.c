@@ -0,0 +1,265 @@
+// The functions in this file compute the field of view described in fov.h,
+// with recursive shadowcasting. The view is split into eight octants. Each
+// octant is scanned one row (at distance 1, 2, ... FOV_RADIUS) at a time,
+// keeping the range of slopes that is still lit; a wall narrows the range
+// for the rows behind it, and a gap between walls starts a new scan of the
+// rows behind the gap. Walls are visible themselves, and squares off the
+// edge of the maze block the view.
+//
+// Two visible bitsets are kept. The new view is built in the spare one,
+// which is all zero, and compared with the current one word by word over
+// the box the two views cover, which is at most 2 * FOV_RADIUS + 1 squares
+// across. The current set is then cleared over its own box, so it can be
+// the spare one next time, and the two are swapped.
+
+#include "game.h"
+#include "fov.h"
+#include "trace.h"
+
+
+// The visible bitsets, the index of the current one, and the box (first
+// and last square in each direction) the current view lies in
+static unsigned long fovVisible[2][MAZE_HEIGHT][FOV_WORDS];
+static int fovCurrent;
+static int fovLeft, fovTop, fovRight = -1, fovBottom = -1;
+
+// The squares that have ever been visible
+static unsigned long fovExplored[MAZE_HEIGHT][FOV_WORDS];
+
+// The bitset being built by castLight()
+static unsigned long (*fovBuild)[FOV_WORDS];
+
+// How each octant's row and column steps map onto x and y
+static const signed char octantXX[8] = {1, 0, 0, -1, -1, 0, 0, 1};
+static const signed char octantXY[8] = {0, 1, -1, 0, 0, -1, 1, 0};
+static const signed char octantYX[8] = {0, 1, 1, 0, 0, -1, -1, 0};
+static const signed char octantYY[8] = {1, 0, 0, 1, -1, 0, 0, -1};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       opaque
+//
+//  Arguments:      x, y:     A square, which may be off the maze
+//
+//  Returns:        TRUE (non-zero) if the square blocks the view.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int opaque(int x, int y)
+{
+    return x < 0 || x >= MAZE_WIDTH || y < 0 || y >= MAZE_HEIGHT || MAZE_WALL(x, y);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       castLight
+//
+//  Arguments:      cx, cy:          The square seen from
+//                  row:             The first row of the octant to scan
+//                  start, end:      The lit range of slopes, start > end
+//                  xx, xy, yx, yy:  The octant's mapping onto x and y
+//
+//  Returns:        void
+//
+//  Description:    This function marks the lit squares of one octant in
+//                  fovBuild, from the given row out to FOV_RADIUS. It calls
+//                  itself for the rows behind each gap between walls, so its
+//                  depth is at most FOV_RADIUS.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void castLight(int cx, int cy, int row, float start, float end,
+                      int xx, int xy, int yx, int yy)
+{
+    float leftSlope, rightSlope, newStart = 0.0f;
+    int j, dx, dy, x, y, blocked;
+
+
+    if (start < end) {
+        return;
+    }
+
+    for (j = row; j <= FOV_RADIUS; j++) {
+        dy = -j;
+        blocked = 0;
+
+        for (dx = -j; dx <= 0; dx++) {
+            x = cx + dx * xx + dy * xy;
+            y = cy + dx * yx + dy * yy;
+            leftSlope = (dx - 0.5f) / (dy + 0.5f);
+            rightSlope = (dx + 0.5f) / (dy - 0.5f);
+
+            if (start < rightSlope) {
+                continue;
+            }
+            if (end > leftSlope) {
+                break;
+            }
+
+            if (dx * dx + dy * dy <= FOV_RADIUS * FOV_RADIUS &&
+                x >= 0 && x < MAZE_WIDTH && y >= 0 && y < MAZE_HEIGHT) {
+                fovBuild[y][x / 64] |= 1UL << (x % 64);
+            }
+
+            if (blocked) {
+                if (opaque(x, y)) {
+                    newStart = rightSlope;
+                } else {
+                    blocked = 0;
+                    start = newStart;
+                }
+            } else if (opaque(x, y) && j < FOV_RADIUS) {
+                // The wall starts a shadow; scan past it in the part of
+                // the range before it
+                blocked = 1;
+                castLight(cx, cy, j + 1, start, leftSlope, xx, xy, yx, yy);
+                newStart = rightSlope;
+            }
+        }
+
+        if (blocked) {
+            break;
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fov_reset
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function forgets the view and every explored
+//                  square, for a new game. It is the only call whose cost
+//                  depends on the size of the maze.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void fov_reset()
+{
+    int x, y;
+
+
+    for (y = 0; y < MAZE_HEIGHT; y++) {
+        for (x = 0; x < FOV_WORDS; x++) {
+            fovVisible[0][y][x] = 0;
+            fovVisible[1][y][x] = 0;
+            fovExplored[y][x] = 0;
+        }
+    }
+
+    fovLeft = fovTop = 0;
+    fovRight = fovBottom = -1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fov_update
+//
+//  Arguments:      x, y:      The square the player is in
+//                  changed:   Called for every square that became visible
+//                             or stopped being visible, or 0
+//
+//  Returns:        The number of squares whose visibility changed.
+//
+//  Description:    This function computes the view from the given square,
+//                  marks it explored, and reports the difference from the
+//                  previous view. fov_visible() and fov_explored() already
+//                  give the new view when the callback runs.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int fov_update(int x, int y, void (*changed)(int x, int y))
+{
+    unsigned long (*old)[FOV_WORDS] = fovVisible[fovCurrent];
+    unsigned long difference;
+    int left, top, right, bottom, i, j, bit, count = 0;
+
+
+    TRACE_BEGIN(TRACE_FOV);
+
+    fovBuild = fovVisible[1 - fovCurrent];
+    fovBuild[y][x / 64] |= 1UL << (x % 64);
+    for (i = 0; i < 8; i++) {
+        castLight(x, y, 1, 1.0f, 0.0f, octantXX[i], octantXY[i],
+                  octantYX[i], octantYY[i]);
+    }
+
+    // The box the new view lies in, and the box covering both views
+    left = (x - FOV_RADIUS < 0) ? 0 : x - FOV_RADIUS;
+    top = (y - FOV_RADIUS < 0) ? 0 : y - FOV_RADIUS;
+    right = (x + FOV_RADIUS >= MAZE_WIDTH) ? MAZE_WIDTH - 1 : x + FOV_RADIUS;
+    bottom = (y + FOV_RADIUS >= MAZE_HEIGHT) ? MAZE_HEIGHT - 1 : y + FOV_RADIUS;
+    if (fovRight >= fovLeft) {
+        left = (fovLeft < left) ? fovLeft : left;
+        top = (fovTop < top) ? fovTop : top;
+        right = (fovRight > right) ? fovRight : right;
+        bottom = (fovBottom > bottom) ? fovBottom : bottom;
+    }
+
+    // The new view is current before any square is reported, so the
+    // callback sees the visibility the square now has. Both sets are zero
+    // outside their boxes, so whole words can be compared without masking.
+    fovCurrent = 1 - fovCurrent;
+    for (j = top; j <= bottom; j++) {
+        for (i = left / 64; i <= right / 64; i++) {
+            fovExplored[j][i] |= fovBuild[j][i];
+            difference = old[j][i] ^ fovBuild[j][i];
+            while (difference) {
+                bit = __builtin_ctzl(difference);
+                difference &= difference - 1;
+                count++;
+                if (changed) {
+                    changed(i * 64 + bit, j);
+                }
+            }
+        }
+    }
+
+    for (j = fovTop; j <= fovBottom; j++) {
+        for (i = fovLeft / 64; i <= fovRight / 64; i++) {
+            old[j][i] = 0;
+        }
+    }
+
+    fovLeft = (x - FOV_RADIUS < 0) ? 0 : x - FOV_RADIUS;
+    fovTop = (y - FOV_RADIUS < 0) ? 0 : y - FOV_RADIUS;
+    fovRight = (x + FOV_RADIUS >= MAZE_WIDTH) ? MAZE_WIDTH - 1 : x + FOV_RADIUS;
+    fovBottom = (y + FOV_RADIUS >= MAZE_HEIGHT) ? MAZE_HEIGHT - 1 : y + FOV_RADIUS;
+
+    TRACE_END(TRACE_FOV);
+    return count;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fov_visible / fov_explored
+//
+//  Arguments:      x, y:     A square
+//
+//  Returns:        TRUE (non-zero) if the square is visible now, or has
+//                  ever been visible.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int fov_visible(int x, int y)
+{
+    return (fovVisible[fovCurrent][y][x / 64] >> (x % 64)) & 1;
+}
+
+int fov_explored(int x, int y)
+{
+    return (fovExplored[y][x / 64] >> (x % 64)) & 1;
+}
@@ -0,0 +1,24 @@
+// Field of view over the maze, for the fog of war. The squares player 0 can
+// see are found by shadowcasting from its square, out to FOV_RADIUS
+// squares. Two bitsets are kept, one bit per square: the squares visible
+// now, and the squares that have ever been visible (explored). Each update
+// reports only the squares whose visibility changed, so only those are
+// redrawn. The work per update depends on FOV_RADIUS, not on the size of
+// the maze.
+
+#ifndef FOV_H
+#define FOV_H
+
+// How far the player can see, in squares
+#define FOV_RADIUS      5
+
+// Words of each bitset row
+#define FOV_WORDS       ((MAZE_WIDTH + 63) / 64)
+
+// Function prototypes
+void fov_reset();
+int fov_update(int x, int y, void (*changed)(int x, int y));
+int fov_visible(int x, int y);
+int fov_explored(int x, int y);
+
+#endif
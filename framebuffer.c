@@ -1,6 +1,10 @@
 // Needed header files
 #include "uart.h"
 #include "mailbox.h"
+#include "framebuffer.h"
+#include "trace.h"
+#include "log.h"
+#include "level.h"
 
 // HTML RGB color codes.  These can be found at:
 // https://htmlcolorcodes.com/
@@ -22,41 +26,72 @@
 #define SILVER    0x00C0C0C0
 
 // Frame buffer constants
-#define FRAMEBUFFER_WIDTH      1024  // in pixels
-#define FRAMEBUFFER_HEIGHT     768   // in pixels
-#define FRAMEBUFFER_DEPTH      32    // bits per pixel (4 bytes per pixel)
 #define FRAMEBUFFER_ALIGNMENT  4     // framebuffer address preferred alignment
 #define VIRTUAL_X_OFFSET       0
 #define VIRTUAL_Y_OFFSET       0
 #define PIXEL_ORDER_BGR        0     // needed for the above color codes
 
-// Frame buffer global variables
+// Frame buffer global variables. frameBuffer is a byte pointer, since the
+// size of a pixel depends on the depth chosen at initFrameBuffer().
 unsigned int frameBufferWidth, frameBufferHeight, frameBufferPitch;
 unsigned int frameBufferDepth, frameBufferPixelOrder, frameBufferSize;
-unsigned int *frameBuffer;
+unsigned int frameBufferBytesPerPixel;
+unsigned char *frameBuffer;
+
+// The fill and blit kernels for the current pixel format. They are chosen
+// once in initFrameBuffer(), so drawing never tests the depth per pixel.
+static void (*fillRectKernel)(int rowStart, int columnStart, int width,
+                              int height, unsigned int color);
+static void (*blitRectKernel)(int rowStart, int columnStart, int width,
+                              int height, unsigned char *source,
+                              unsigned int sourcePitch);
+static void (*readRectKernel)(int rowStart, int columnStart, int width,
+                              int height, unsigned char *destination,
+                              unsigned int destinationPitch);
+static void (*fillSpansKernel)(int rowStart, int height, struct fb_span *spans,
+                               int count);
+static void (*fillSquareKernel)(int rowStart, int columnStart, int size,
+                                unsigned int color);
+
+// A copy of the palette used in 8 bits per pixel mode. Colors are stored as
+// 0x00RRGGBB codes, and fbPaletteUsed counts the entries handed out by
+// fb_color() and fb_alloc_color(). The video core is sent each entry scaled
+// by fbBrightness (256 is full brightness).
+static unsigned int fbPalette[256];
+static unsigned int fbPaletteUsed;
+static unsigned int fbBrightness = 256;
+
+static void selectKernels();
+static int sendPalette(unsigned int first, unsigned int count);
 
 
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  Function:       initFrameBuffer
+//  Function:       negotiate
 //
-//  Arguments:      none
+//  Arguments:      width:     Width in pixels
+//                  height:    Height in pixels
+//                  depth:     Bits per pixel
 //
-//  Returns:        void
+//  Returns:        TRUE (non-zero) if the video core allocated a frame
+//                  buffer, FALSE (zero) otherwise.
 //
 //  Description:    This function uses the mailbox request/response protocol
 //                  to allocate and set the frame buffer. This includes the
 //                  width, height, and depth of the framebuffer, plus the
-//                  desired pixel order (BGR). The mailbox response is used
-//                  to set the frame buffer global variables that can be used
-//                  later on when drawing to the screen. The most important of
-//                  these is the frame buffer address.
+//                  desired pixel order (BGR). The physical and virtual sizes
+//                  are the same, and the GPU scales the frame buffer to fit
+//                  the display. The mailbox response is used to set the
+//                  frame buffer global variables that can be used later on
+//                  when drawing to the screen. The most important of these
+//                  is the frame buffer address. If the request fails, the
+//                  variables are left as they were.
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-void initFrameBuffer()
+static int negotiate(unsigned int width, unsigned int height, unsigned int depth)
 {
     // Initialize the mailbox data structure.
     // It contains a series of tags that specify the
@@ -67,14 +102,14 @@ void initFrameBuffer()
     mailbox_buffer[2] = TAG_SET_PHYSICAL_WIDTH_HEIGHT;
     mailbox_buffer[3] = 8;
     mailbox_buffer[4] = 8;
-    mailbox_buffer[5] = FRAMEBUFFER_WIDTH;
-    mailbox_buffer[6] = FRAMEBUFFER_HEIGHT;
+    mailbox_buffer[5] = width;
+    mailbox_buffer[6] = height;
 
     mailbox_buffer[7] = TAG_SET_VIRTUAL_WIDTH_HEIGHT;
     mailbox_buffer[8] = 8;
     mailbox_buffer[9] = 8;
-    mailbox_buffer[10] = FRAMEBUFFER_WIDTH;
-    mailbox_buffer[11] = FRAMEBUFFER_HEIGHT;
+    mailbox_buffer[10] = width;
+    mailbox_buffer[11] = height;
     
     mailbox_buffer[12] = TAG_SET_VIRTUAL_OFFSET;
     mailbox_buffer[13] = 8;
@@ -85,7 +120,7 @@ void initFrameBuffer()
     mailbox_buffer[17] = TAG_SET_DEPTH;
     mailbox_buffer[18] = 4;
     mailbox_buffer[19] = 4;
-    mailbox_buffer[20] = FRAMEBUFFER_DEPTH;
+    mailbox_buffer[20] = depth;
 
     mailbox_buffer[21] = TAG_SET_PIXEL_ORDER;
     mailbox_buffer[22] = 4;
@@ -108,52 +143,54 @@ void initFrameBuffer()
 
 
     // Make a mailbox request using the above mailbox data structure
-    if (mailbox_query(CHANNEL_PROPERTY_TAGS_ARMTOVC)) {
-	   // If here, the query succeeded, and we can check the response
-
-	   // Get the returned frame buffer address, masking out 2 upper bits
-        mailbox_buffer[28] &= 0x3FFFFFFF;
-        frameBuffer = (void *)((unsigned long)mailbox_buffer[28]);
-
-	   // Read the frame buffer settings from the mailbox buffer
-        frameBufferWidth = mailbox_buffer[5];
-        frameBufferHeight = mailbox_buffer[6];
-        frameBufferPitch = mailbox_buffer[33];
-    	frameBufferDepth = mailbox_buffer[20];
-    	frameBufferPixelOrder = mailbox_buffer[24];
-    	frameBufferSize = mailbox_buffer[29];
-
-    	// Display frame buffer settings to the terminal
-    	uart_puts("Frame buffer settings:\n");
-
-    	uart_puts("    width:       0x");
-    	uart_puthex(frameBufferWidth);
-    	uart_puts(" pixels\n");
-
-    	uart_puts("    height:      0x");
-    	uart_puthex(frameBufferHeight);
-    	uart_puts(" pixels\n");
-
-    	uart_puts("    pitch:       0x");
-    	uart_puthex(frameBufferPitch);
-    	uart_puts(" bytes per row\n");
-
-    	uart_puts("    depth:       0x");
-    	uart_puthex(frameBufferDepth);
-    	uart_puts(" bits per pixel\n");
-
-    	uart_puts("    pixel order: 0x");
-    	uart_puthex(frameBufferPixelOrder);
-    	uart_puts(" (0=BGR, 1=RGB)\n");
-
-    	uart_puts("    address:     0x");
-    	uart_puthex(mailbox_buffer[28]);
-    	uart_puts("\n");
-
-    	uart_puts("    size:        0x");
-    	uart_puthex(frameBufferSize);
-    	uart_puts(" bytes\n");
-	
+    if (!mailbox_query(CHANNEL_PROPERTY_TAGS_ARMTOVC) || mailbox_buffer[28] == 0) {
+        return 0;
+    }
+
+    // Get the returned frame buffer address, masking out 2 upper bits
+    mailbox_buffer[28] &= 0x3FFFFFFF;
+    frameBuffer = (unsigned char *)((unsigned long)mailbox_buffer[28]);
+
+    // Read the frame buffer settings from the mailbox buffer
+    frameBufferWidth = mailbox_buffer[5];
+    frameBufferHeight = mailbox_buffer[6];
+    frameBufferPitch = mailbox_buffer[33];
+    frameBufferDepth = mailbox_buffer[20];
+    frameBufferPixelOrder = mailbox_buffer[24];
+    frameBufferSize = mailbox_buffer[29];
+
+    // Log the frame buffer settings
+    LOG("Frame buffer %ux%u, pitch %u bytes per row, depth %u bpp",
+        frameBufferWidth, frameBufferHeight, frameBufferPitch, frameBufferDepth);
+    LOG("Frame buffer pixel order %u (0=BGR, 1=RGB)", frameBufferPixelOrder);
+    LOG("Frame buffer address 0x%08x, size 0x%x bytes",
+        mailbox_buffer[28], frameBufferSize);
+
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       initFrameBuffer
+//
+//  Arguments:      depth:     Bits per pixel: 32 (XRGB 8888), 16 (RGB 565)
+//                             or 8 (indexed)
+//
+//  Returns:        void
+//
+//  Description:    This function allocates a FRAMEBUFFER_WIDTH x
+//                  FRAMEBUFFER_HEIGHT frame buffer of the given depth, and
+//                  selects the fill and blit kernels for the returned depth.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void initFrameBuffer(unsigned int depth)
+{
+    if (negotiate(FRAMEBUFFER_WIDTH, FRAMEBUFFER_HEIGHT, depth)) {
+        // Pick the drawing kernels that match the depth we were given
+        selectKernels();
     } else {
         uart_puts("Cannot initialize frame buffer\n");
     }
@@ -161,6 +198,735 @@ void initFrameBuffer()
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fb_set_size
+//
+//  Arguments:      width:     Width in pixels
+//                  height:    Height in pixels
+//
+//  Returns:        TRUE (non-zero) if the frame buffer was reallocated,
+//                  FALSE (zero) if the old one is still in use.
+//
+//  Description:    This function changes the frame buffer resolution while
+//                  keeping its depth. The GPU scales the new frame buffer to
+//                  the same display, so a smaller one costs less to draw but
+//                  still fills the screen. The contents of the frame buffer
+//                  are lost, and the caller must redraw everything, using
+//                  the frameBufferWidth, frameBufferHeight and
+//                  frameBufferPitch returned. In 8 bits per pixel mode the
+//                  palette is sent again.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int fb_set_size(unsigned int width, unsigned int height)
+{
+    if (width == frameBufferWidth && height == frameBufferHeight) {
+        return 0;
+    }
+
+    if (!negotiate(width, height, frameBufferDepth)) {
+        return 0;
+    }
+
+    if (frameBufferDepth == 8 && fbPaletteUsed > 0) {
+        sendPalette(0, fbPaletteUsed);
+    }
+
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       storePixel, fillSpan, copySpan
+//
+//  Description:    These are the inner loops shared by all pixel formats. They
+//                  are always inlined into the per-format kernels below with a
+//                  constant bytesPerPixel, so the compiler specializes each
+//                  copy for its format and the switch statements disappear.
+//                  The frame buffer is device memory while the MMU is off, so
+//                  every store is naturally aligned: single pixels are stored
+//                  until the address is doubleword aligned, then 8 bytes are
+//                  stored at a time, and any remaining pixels are stored
+//                  singly again.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline))
+void storePixel(unsigned char *p, unsigned long value, const int bytesPerPixel)
+{
+    switch (bytesPerPixel) {
+    case 4:
+        *(unsigned int *)p = (unsigned int)value;
+        break;
+    case 2:
+        *(unsigned short *)p = (unsigned short)value;
+        break;
+    default:
+        *p = (unsigned char)value;
+        break;
+    }
+}
+
+static inline __attribute__((always_inline))
+void fillSpan(unsigned char *p, int count, unsigned long pattern,
+              const int bytesPerPixel)
+{
+    unsigned long *word;
+    int words;
+
+
+    // Store single pixels until p is doubleword aligned
+    while (count > 0 && ((unsigned long)p & 7) != 0) {
+        storePixel(p, pattern, bytesPerPixel);
+        p += bytesPerPixel;
+        count--;
+    }
+
+    // Store 8 bytes (several pixels) at a time
+    words = (count * bytesPerPixel) >> 3;
+    count -= words * (8 / bytesPerPixel);
+    word = (unsigned long *)p;
+    while (words--) {
+        *word++ = pattern;
+    }
+
+    // Store the pixels left over at the end of the span
+    p = (unsigned char *)word;
+    while (count-- > 0) {
+        storePixel(p, pattern, bytesPerPixel);
+        p += bytesPerPixel;
+    }
+}
+
+static inline __attribute__((always_inline))
+void copySpan(unsigned char *p, unsigned char *source, int count,
+              const int bytesPerPixel)
+{
+    unsigned long *word, *sourceWord;
+    int words;
+
+
+    // Doubleword copies are only possible when both addresses can reach
+    // doubleword alignment together
+    if ((((unsigned long)p ^ (unsigned long)source) & 7) == 0) {
+        while (count > 0 && ((unsigned long)p & 7) != 0) {
+            storePixel(p, bytesPerPixel == 4 ? *(unsigned int *)source :
+                          bytesPerPixel == 2 ? *(unsigned short *)source :
+                          *source, bytesPerPixel);
+            p += bytesPerPixel;
+            source += bytesPerPixel;
+            count--;
+        }
+
+        words = (count * bytesPerPixel) >> 3;
+        count -= words * (8 / bytesPerPixel);
+        word = (unsigned long *)p;
+        sourceWord = (unsigned long *)source;
+        while (words--) {
+            *word++ = *sourceWord++;
+        }
+        p = (unsigned char *)word;
+        source = (unsigned char *)sourceWord;
+    }
+
+    while (count-- > 0) {
+        storePixel(p, bytesPerPixel == 4 ? *(unsigned int *)source :
+                      bytesPerPixel == 2 ? *(unsigned short *)source :
+                      *source, bytesPerPixel);
+        p += bytesPerPixel;
+        source += bytesPerPixel;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillSquare
+//
+//  Description:    This is the inner loop of drawSquare() for one square size
+//                  known at compile time. When the rows are doubleword
+//                  aligned and a whole number of doublewords wide, which they
+//                  are for maze squares at every depth, each row is a fixed
+//                  number of doubleword stores with no alignment loops. Rows
+//                  of up to 32 doublewords (64 pixels at 32 bits per pixel)
+//                  are written out in full by FILL_WORDS_32(), so they need
+//                  no loop at any optimization level.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// The first 32 doubleword stores of a fillSquare() row, written out one by
+// one. The number of doublewords is known at compile time, so the tests
+// fold away and leave only the stores the row needs.
+#define FILL_WORD(n)        if ((n) < words) word[n] = pattern;
+#define FILL_WORDS_4(n)     FILL_WORD(n) FILL_WORD((n) + 1)                   \
+                            FILL_WORD((n) + 2) FILL_WORD((n) + 3)
+#define FILL_WORDS_16(n)    FILL_WORDS_4(n) FILL_WORDS_4((n) + 4)             \
+                            FILL_WORDS_4((n) + 8) FILL_WORDS_4((n) + 12)
+#define FILL_WORDS_32(n)    FILL_WORDS_16(n) FILL_WORDS_16((n) + 16)
+
+static inline __attribute__((always_inline))
+void fillSquare(unsigned char *line, unsigned long pattern, const int size,
+                const int bytesPerPixel)
+{
+    const int words = size * bytesPerPixel / 8;
+    unsigned long *word;
+    int row, i;
+
+
+    if ((size * bytesPerPixel) % 8 != 0 ||
+        (((unsigned long)line | frameBufferPitch) & 7) != 0) {
+        for (row = 0; row < size; row++) {
+            fillSpan(line, size, pattern, bytesPerPixel);
+            line += frameBufferPitch;
+        }
+        return;
+    }
+
+    for (row = 0; row < size; row++) {
+        word = (unsigned long *)line;
+        FILL_WORDS_32(0);
+        for (i = 32; i < words; i++) {
+            word[i] = pattern;
+        }
+        line += frameBufferPitch;
+    }
+}
+
+// One case of a fillSquare kernel's switch, for each square size the level
+// uses (see level.h)
+#define SQUARE_CASE(size)                                                     \
+    case size:                                                                \
+        fillSquare(line, pattern, size, squareBytesPerPixel);                 \
+        return;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillRect32, fillRect16, fillRect8
+//                  blitRect32, blitRect16, blitRect8
+//                  readRect32, readRect16, readRect8
+//                  fillSpans32, fillSpans16, fillSpans8
+//                  fillSquare32, fillSquare16, fillSquare8
+//
+//  Description:    These are the per-format drawing kernels. A fill replicates
+//                  the pixel value across a doubleword once per call, and then
+//                  fills the rectangle row by row. A blit copies a rectangle
+//                  of pixels that are already in the frame buffer's format,
+//                  and a read copies a rectangle out of the frame buffer.
+//                  A span fill draws a list of horizontal spans on every row
+//                  of a band, so each scanline is written left to right in
+//                  one pass before moving down to the next. A square fill
+//                  has an unrolled copy for each maze square size, and
+//                  falls back on a rectangle fill for any other size.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#define DEFINE_KERNELS(bits, bytesPerPixel, replicate)                        \
+static void fillRect##bits(int rowStart, int columnStart, int width,          \
+                           int height, unsigned int color)                    \
+{                                                                             \
+    unsigned char *line;                                                      \
+    unsigned long pattern = (unsigned long)color * (replicate);               \
+                                                                              \
+    line = frameBuffer + rowStart * frameBufferPitch                          \
+           + columnStart * (bytesPerPixel);                                   \
+    while (height-- > 0) {                                                    \
+        fillSpan(line, width, pattern, (bytesPerPixel));                      \
+        line += frameBufferPitch;                                             \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+static void blitRect##bits(int rowStart, int columnStart, int width,          \
+                           int height, unsigned char *source,                 \
+                           unsigned int sourcePitch)                          \
+{                                                                             \
+    unsigned char *line;                                                      \
+                                                                              \
+    line = frameBuffer + rowStart * frameBufferPitch                          \
+           + columnStart * (bytesPerPixel);                                   \
+    while (height-- > 0) {                                                    \
+        copySpan(line, source, width, (bytesPerPixel));                       \
+        line += frameBufferPitch;                                             \
+        source += sourcePitch;                                                \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+static void readRect##bits(int rowStart, int columnStart, int width,          \
+                           int height, unsigned char *destination,            \
+                           unsigned int destinationPitch)                     \
+{                                                                             \
+    unsigned char *line;                                                      \
+                                                                              \
+    line = frameBuffer + rowStart * frameBufferPitch                          \
+           + columnStart * (bytesPerPixel);                                   \
+    while (height-- > 0) {                                                    \
+        copySpan(destination, line, width, (bytesPerPixel));                  \
+        line += frameBufferPitch;                                             \
+        destination += destinationPitch;                                      \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+static void fillSpans##bits(int rowStart, int height, struct fb_span *spans,  \
+                            int count)                                        \
+{                                                                             \
+    unsigned char *line;                                                      \
+    int i;                                                                    \
+                                                                              \
+    line = frameBuffer + rowStart * frameBufferPitch;                         \
+    while (height-- > 0) {                                                    \
+        for (i = 0; i < count; i++) {                                         \
+            fillSpan(line + spans[i].x * (bytesPerPixel), spans[i].width,     \
+                     (unsigned long)spans[i].color * (replicate),             \
+                     (bytesPerPixel));                                        \
+        }                                                                     \
+        line += frameBufferPitch;                                             \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+static void fillSquare##bits(int rowStart, int columnStart, int size,         \
+                             unsigned int color)                              \
+{                                                                             \
+    const int squareBytesPerPixel = (bytesPerPixel);                          \
+    unsigned char *line;                                                      \
+    unsigned long pattern = (unsigned long)color * (replicate);               \
+                                                                              \
+    line = frameBuffer + rowStart * frameBufferPitch                          \
+           + columnStart * (bytesPerPixel);                                   \
+    switch (size) {                                                           \
+    LEVEL_TILE_SIZES(SQUARE_CASE)                                             \
+    }                                                                         \
+    fillRect##bits(rowStart, columnStart, size, size, color);                 \
+}
+
+DEFINE_KERNELS(32, 4, 0x0000000100000001UL)
+DEFINE_KERNELS(16, 2, 0x0001000100010001UL)
+DEFINE_KERNELS(8,  1, 0x0101010101010101UL)
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       selectKernels
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function points the fill and blit kernels at the ones
+//                  specialized for frameBufferDepth. Any depth we do not
+//                  support is reported, and treated as 32 bits per pixel.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void selectKernels()
+{
+    switch (frameBufferDepth) {
+    case 16:
+        fillRectKernel = fillRect16;
+        blitRectKernel = blitRect16;
+        readRectKernel = readRect16;
+        fillSpansKernel = fillSpans16;
+        fillSquareKernel = fillSquare16;
+        frameBufferBytesPerPixel = 2;
+        break;
+    case 8:
+        fillRectKernel = fillRect8;
+        blitRectKernel = blitRect8;
+        readRectKernel = readRect8;
+        fillSpansKernel = fillSpans8;
+        fillSquareKernel = fillSquare8;
+        frameBufferBytesPerPixel = 1;
+        fbPaletteUsed = 0;
+        break;
+    default:
+        if (frameBufferDepth != 32) {
+            uart_puts("Unsupported frame buffer depth, drawing as 32 bpp\n");
+        }
+        fillRectKernel = fillRect32;
+        blitRectKernel = blitRect32;
+        readRectKernel = readRect32;
+        fillSpansKernel = fillSpans32;
+        fillSquareKernel = fillSquare32;
+        frameBufferBytesPerPixel = 4;
+        break;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fb_color
+//
+//  Arguments:      rgb:     An 0x00RRGGBB color code
+//
+//  Returns:        The pixel value that displays the color in the current
+//                  pixel format.
+//
+//  Description:    This function converts a color code into the frame
+//                  buffer's pixel format. It is meant to be called once per
+//                  color when the game starts, not per pixel. In 8 bits per
+//                  pixel mode each new color is given the next free palette
+//                  entry, and the palette entry is sent to the video core. If
+//                  the palette is full, entry 0 is returned.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int fb_color(unsigned int rgb)
+{
+    unsigned int i;
+
+
+    switch (frameBufferDepth) {
+    case 16:
+        // Keep the top 5, 6 and 5 bits of the red, green and blue channels
+        return ((rgb >> 8) & 0xF800) | ((rgb >> 5) & 0x07E0) |
+               ((rgb >> 3) & 0x001F);
+
+    case 8:
+        // Reuse an existing palette entry for the color if there is one
+        for (i = 0; i < fbPaletteUsed; i++) {
+            if (fbPalette[i] == rgb) {
+                return i;
+            }
+        }
+        if (fbPaletteUsed == 256) {
+            return 0;
+        }
+        fb_set_palette(fbPaletteUsed, 1, &rgb);
+        return fbPaletteUsed++;
+
+    default:
+        return rgb;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       sendPalette
+//
+//  Arguments:      first:   The first palette entry to send (0 - 255)
+//                  count:   The number of entries to send
+//
+//  Returns:        TRUE (non-zero) if the video core accepted the palette,
+//                  FALSE (zero) otherwise.
+//
+//  Description:    This function sends a range of palette entries to the
+//                  video core using a single mailbox request. Each entry is
+//                  scaled by the current brightness. The video core expects
+//                  each entry with red in the low byte, so the color codes
+//                  are converted to 0x00BBGGRR form.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int sendPalette(unsigned int first, unsigned int count)
+{
+    unsigned int i, c, r, g, b;
+
+
+    if (first >= 256 || count == 0 || first + count > 256) {
+        return 0;
+    }
+
+    mailbox_buffer[0] = (count + 8) * 4;
+    mailbox_buffer[1] = MAILBOX_REQUEST;
+
+    mailbox_buffer[2] = TAG_SET_PALETTE;
+    mailbox_buffer[3] = (count + 2) * 4;
+    mailbox_buffer[4] = (count + 2) * 4;
+    mailbox_buffer[5] = first;       // Response: 0 if the palette is valid
+    mailbox_buffer[6] = count;
+
+    for (i = 0; i < count; i++) {
+        c = fbPalette[first + i];
+        r = (((c >> 16) & 0xFF) * fbBrightness) >> 8;
+        g = (((c >> 8) & 0xFF) * fbBrightness) >> 8;
+        b = ((c & 0xFF) * fbBrightness) >> 8;
+        mailbox_buffer[7 + i] = (b << 16) | (g << 8) | r;
+    }
+
+    mailbox_buffer[7 + count] = TAG_LAST;
+
+    return mailbox_query(CHANNEL_PROPERTY_TAGS_ARMTOVC) &&
+           mailbox_buffer[5] == 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fb_set_palette
+//
+//  Arguments:      first:   The first palette entry to set (0 - 255)
+//                  count:   The number of entries to set
+//                  rgb:     Array of count 0x00RRGGBB color codes
+//
+//  Returns:        TRUE (non-zero) if the video core accepted the palette,
+//                  FALSE (zero) otherwise.
+//
+//  Description:    This function sets a range of palette entries using a
+//                  single mailbox request.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int fb_set_palette(unsigned int first, unsigned int count, unsigned int *rgb)
+{
+    unsigned int i;
+
+
+    if (first >= 256 || count == 0 || first + count > 256) {
+        return 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        fbPalette[first + i] = rgb[i];
+    }
+
+    return sendPalette(first, count);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fb_alloc_color
+//
+//  Arguments:      rgb:     An 0x00RRGGBB color code
+//
+//  Returns:        The pixel value that displays the color in the current
+//                  pixel format.
+//
+//  Description:    In 8 bits per pixel mode, this function always gives the
+//                  color a palette entry of its own, even if another entry
+//                  has the same color. Everything drawn with the returned
+//                  pixel value can then be recolored later with a single
+//                  fb_set_color() call. In other modes it is the same as
+//                  fb_color().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int fb_alloc_color(unsigned int rgb)
+{
+    if (frameBufferDepth != 8) {
+        return fb_color(rgb);
+    }
+
+    if (fbPaletteUsed == 256) {
+        return 0;
+    }
+
+    fb_set_palette(fbPaletteUsed, 1, &rgb);
+    return fbPaletteUsed++;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fb_set_color
+//
+//  Arguments:      pixel:   A pixel value returned by fb_alloc_color()
+//                  rgb:     The new 0x00RRGGBB color code for it
+//
+//  Returns:        TRUE (non-zero) if every pixel drawn with the value now
+//                  shows the new color, FALSE (zero) if the frame buffer is
+//                  not indexed and the pixels must be redrawn instead.
+//
+//  Description:    This function recolors a palette entry. It costs one
+//                  mailbox request no matter how many pixels use the entry.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int fb_set_color(unsigned int pixel, unsigned int rgb)
+{
+    if (frameBufferDepth != 8) {
+        return 0;
+    }
+
+    return fb_set_palette(pixel, 1, &rgb);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fb_set_brightness
+//
+//  Arguments:      level:   Brightness from 0 (black) to 256 (full)
+//
+//  Returns:        TRUE (non-zero) if the palette was updated, FALSE (zero)
+//                  if the frame buffer is not indexed.
+//
+//  Description:    This function scales every palette entry in use by the
+//                  given brightness, which fades the whole screen to or from
+//                  black with one mailbox request. The colors set through
+//                  fb_set_palette() are kept, so fading back up restores
+//                  them exactly.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int fb_set_brightness(unsigned int level)
+{
+    if (frameBufferDepth != 8) {
+        return 0;
+    }
+
+    fbBrightness = (level > 256) ? 256 : level;
+
+    return sendPalette(0, fbPaletteUsed);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fb_get_palette
+//
+//  Arguments:      rgb:     Array of 256 entries that receives the colors
+//
+//  Returns:        The number of palette entries in use, or 0 if the frame
+//                  buffer is not indexed.
+//
+//  Description:    This function gives the colors the palette entries in use
+//                  are displayed with, as 0x00RRGGBB codes scaled by the
+//                  current brightness.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int fb_get_palette(unsigned int *rgb)
+{
+    unsigned int i, c, r, g, b;
+
+
+    if (frameBufferDepth != 8) {
+        return 0;
+    }
+
+    for (i = 0; i < fbPaletteUsed; i++) {
+        c = fbPalette[i];
+        r = (((c >> 16) & 0xFF) * fbBrightness) >> 8;
+        g = (((c >> 8) & 0xFF) * fbBrightness) >> 8;
+        b = ((c & 0xFF) * fbBrightness) >> 8;
+        rgb[i] = (r << 16) | (g << 8) | b;
+    }
+
+    return fbPaletteUsed;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fb_fill_rect
+//
+//  Arguments:      rowStart:        Top left pixel y coordinate
+//                  columnStart:     Top left pixel x coordinate
+//                  width:           Width of the rectangle in pixels
+//                  height:          Height of the rectangle in pixels
+//                  color:           Pixel value returned by fb_color()
+//
+//  Returns:        void
+//
+//  Description:    This function fills a rectangle of the frame buffer with
+//                  a single color, using the kernel for the current format.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void fb_fill_rect(int rowStart, int columnStart, int width, int height,
+                  unsigned int color)
+{
+    fillRectKernel(rowStart, columnStart, width, height, color);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fb_fill_spans
+//
+//  Arguments:      rowStart:        The first row of the band
+//                  height:          Number of rows in the band
+//                  spans:           Horizontal spans, each with a start
+//                                   column, a width and a pixel value
+//                  count:           Number of spans
+//
+//  Returns:        void
+//
+//  Description:    This function fills the same spans on every row of a band
+//                  of the frame buffer. It walks the band top to bottom, one
+//                  scanline at a time, so that spans which cover a whole row
+//                  turn into a single long run of contiguous stores.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void fb_fill_spans(int rowStart, int height, struct fb_span *spans, int count)
+{
+    fillSpansKernel(rowStart, height, spans, count);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fb_blit
+//
+//  Arguments:      rowStart:        Top left pixel y coordinate
+//                  columnStart:     Top left pixel x coordinate
+//                  width:           Width of the rectangle in pixels
+//                  height:          Height of the rectangle in pixels
+//                  source:          Pixels in the frame buffer's format
+//                  sourcePitch:     Bytes per row of the source pixels
+//
+//  Returns:        void
+//
+//  Description:    This function copies a rectangle of pixels into the frame
+//                  buffer, using the kernel for the current format.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void fb_blit(int rowStart, int columnStart, int width, int height,
+             unsigned char *source, unsigned int sourcePitch)
+{
+    blitRectKernel(rowStart, columnStart, width, height, source, sourcePitch);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fb_read
+//
+//  Arguments:      rowStart:         Top left pixel y coordinate
+//                  columnStart:      Top left pixel x coordinate
+//                  width:            Width of the rectangle in pixels
+//                  height:           Height of the rectangle in pixels
+//                  destination:      Buffer that receives the pixels
+//                  destinationPitch: Bytes per row of the destination
+//
+//  Returns:        void
+//
+//  Description:    This function copies a rectangle of pixels out of the
+//                  frame buffer, in the frame buffer's format. It is the
+//                  inverse of fb_blit().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void fb_read(int rowStart, int columnStart, int width, int height,
+             unsigned char *destination, unsigned int destinationPitch)
+{
+    readRectKernel(rowStart, columnStart, width, height, destination,
+                   destinationPitch);
+}
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  Function:       drawSquare
@@ -168,7 +934,7 @@ void initFrameBuffer()
 //  Arguments:      rowStart:        Top left pixel y coordinate
 //                  columnStart:     Top left pixel x coordinate
 //                  squareSize:      Square size in pixels per side
-//                  color:           RGB color code
+//                  color:           Pixel value returned by fb_color()
 //
 //  Returns:        void
 //
@@ -177,29 +943,37 @@ void initFrameBuffer()
 //                  and it is drawn downwards and to the right on the display.
 //                  The size of the square is given in terms of pixels per side,
 //                  and the pixels in the square are given the same specified
-//                  color.
+//                  color. The maze square sizes have unrolled kernels.
 //
 ////////////////////////////////////////////////////////////////////////////////
 
 void drawSquare(int rowStart, int columnStart, int squareSize, unsigned int color)
 {
-    int row, column, rowEnd, columnEnd;
-    unsigned int *pixel = frameBuffer;
-
+    TRACE_BEGIN(TRACE_DRAW_SQUARE);
+    fillSquareKernel(rowStart, columnStart, squareSize, color);
+    TRACE_END(TRACE_DRAW_SQUARE);
+}
 
-    // Calculate where the row and columns end
-    rowEnd = rowStart + squareSize;
-    columnEnd = columnStart + squareSize;
 
-    // Draw the square row by row, from the top down
-    for (row = rowStart; row < rowEnd; row++) {
-	// Draw each pixel in the row from left to right
-        for (column = columnStart; column < columnEnd; column++) {
-	    // Draw the individual pixel by setting its
-	    // RGB value in the frame buffer
-            pixel[(row * frameBufferWidth) + column] = color;
-        }
-    }
-}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       displayFrameBuffer
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function presents the frame that has been drawn. The
+//                  display scans out of the frame buffer directly, so there is
+//                  no buffer to flip; instead we wait with a data
+//                  synchronization barrier until every pixel store issued so
+//                  far has completed, which is the point at which the frame
+//                  can reach the screen.
+//
+////////////////////////////////////////////////////////////////////////////////
 
+void displayFrameBuffer()
+{
+    asm volatile("dsb sy" ::: "memory");
+}
@@ -1,2 +1,48 @@
-void initFrameBuffer();
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+// Default frame buffer depth in bits per pixel. The supported pixel formats
+// are 32 (XRGB 8888), 16 (RGB 565) and 8 (indexed through the palette).
+// This can be overridden at build time, e.g. 'make FRAMEBUFFER_DEPTH=16'.
+#ifndef FRAMEBUFFER_DEPTH
+#define FRAMEBUFFER_DEPTH      32
+#endif
+
+// The full frame buffer resolution in pixels. fb_set_size() can lower it
+// while the game runs, and the GPU scales the frame buffer to the display.
+#define FRAMEBUFFER_WIDTH      1024
+#define FRAMEBUFFER_HEIGHT     768
+
+// A horizontal run of pixels of one color, used by fb_fill_spans()
+struct fb_span {
+    unsigned short x;         // First column
+    unsigned short width;     // Number of pixels
+    unsigned int color;       // Pixel value returned by fb_color()
+};
+
+// Frame buffer global variables (defined in framebuffer.c)
+extern unsigned int frameBufferWidth, frameBufferHeight, frameBufferPitch;
+extern unsigned int frameBufferDepth, frameBufferPixelOrder, frameBufferSize;
+extern unsigned int frameBufferBytesPerPixel;
+extern unsigned char *frameBuffer;
+
+// Function prototypes
+void initFrameBuffer(unsigned int depth);
 void displayFrameBuffer();
+int fb_set_size(unsigned int width, unsigned int height);
+unsigned int fb_color(unsigned int rgb);
+int fb_set_palette(unsigned int first, unsigned int count, unsigned int *rgb);
+unsigned int fb_alloc_color(unsigned int rgb);
+int fb_set_color(unsigned int pixel, unsigned int rgb);
+int fb_set_brightness(unsigned int level);
+unsigned int fb_get_palette(unsigned int *rgb);
+void fb_fill_rect(int rowStart, int columnStart, int width, int height,
+                  unsigned int color);
+void fb_fill_spans(int rowStart, int height, struct fb_span *spans, int count);
+void fb_blit(int rowStart, int columnStart, int width, int height,
+             unsigned char *source, unsigned int sourcePitch);
+void fb_read(int rowStart, int columnStart, int width, int height,
+             unsigned char *destination, unsigned int destinationPitch);
+void drawSquare(int rowStart, int columnStart, int squareSize, unsigned int color);
+
+#endif
@@ -0,0 +1,61 @@
+// Declarations for the game state in main.c that is used by the other
+// modules (for example the renderers and the console commands)
+
+#ifndef GAME_H
+#define GAME_H
+
+// The level, generated from maze.lvl by tools/genlevel.py
+#include "level.h"
+
+// Maze size in squares
+#define MAZE_WIDTH   LEVEL_WIDTH
+#define MAZE_HEIGHT  LEVEL_HEIGHT
+
+// The maze. 0 is a path, 1 is a wall, 2 is the entrance and 3 is the exit.
+extern int maze[MAZE_HEIGHT][MAZE_WIDTH];
+
+// The walls of the maze, one bit per square
+extern const unsigned long mazeWalls[MAZE_HEIGHT][LEVEL_WORDS];
+#define MAZE_WALL(x, y)  ((mazeWalls[y][(x) / 64] >> ((x) % 64)) & 1)
+
+// The maze as runs of squares drawn in the same color, row y's runs being
+// mazeRuns[mazeRowRuns[y]] up to mazeRuns[mazeRowRuns[y + 1]]
+struct maze_run {
+    unsigned char x;          // First square
+    unsigned char width;      // Number of squares
+    unsigned char square;     // Square value they are drawn as
+};
+extern const struct maze_run mazeRuns[LEVEL_RUN_COUNT];
+extern const unsigned short mazeRowRuns[MAZE_HEIGHT + 1];
+
+// The pixel value each square value is drawn with when it is in view
+extern unsigned int squarePixel[4];
+
+// TRUE (non-zero) while the fog of war hides part of the map
+extern int fogOfWar;
+
+// Square size in pixels, which follows the frame buffer resolution (see
+// layoutMaze())
+extern int tileSize;
+
+// The square each player is in
+extern int playerX[], playerY[];
+
+// Function prototypes
+unsigned int cellPixel(int x, int y);
+int cellVisible(int x, int y);
+void toggleDayNight();
+void toggleTelemetry();
+void toggleRecording();
+void toggleReplay();
+void drawMaze();
+void movePlayer(int p, int dx, int dy);
+void renderPlayers();
+void resetGame();
+void setScaling(int enabled);
+void toggleScaling();
+void toggleFog();
+void toggleMinimap();
+void toggleHud();
+
+#endif
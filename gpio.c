@@ -0,0 +1,224 @@
+// The functions in this file configure the GPIO pins and dispatch their
+// edge-detect interrupts, as declared in gpio.h. An edge on a pin sets its
+// bit in the Event Detect Status registers, which raises one of the GPIO
+// interrupts of the BCM interrupt controller; irq_handler() passes that on
+// to gpio_irq(), which calls the handler registered for each pin.
+
+#include "gpio.h"
+#include "irq.h"
+
+
+// The handler registered for each pin's edges
+static void (*gpioHandlers[GPIO_PINS])(unsigned int pin);
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       gpioWait
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function waits the 150 cycles of set-up or hold
+//                  time the pull-up/down control signal needs.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void gpioWait()
+{
+    register unsigned int r = 150;
+
+    while (r--) {
+        asm volatile("nop");
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       gpio_configure
+//
+//  Arguments:      table:    The pins to configure
+//                  count:    Number of entries in the table
+//
+//  Returns:        void
+//
+//  Description:    This function sets the function and the internal pull
+//                  resistor of every pin in the table. The pull resistors
+//                  are set with the procedure on page 101 of the BCM2837 ARM
+//                  Peripherals manual, once for all the pins that share a
+//                  setting rather than once per pin. Pins not in the table
+//                  keep their settings.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void gpio_configure(const struct gpio_pin_config *table, int count)
+{
+    mmio_reg *fsel;
+    unsigned int r, shift, pull, mask0, mask1;
+    int i;
+
+
+    // Each GPIO Function Select Register holds ten 3-bit FSEL fields
+    for (i = 0; i < count; i++) {
+        fsel = GPFSEL0 + (table[i].pin / 10);
+        shift = (table[i].pin % 10) * 3;
+
+        r = mmio_read(fsel);
+        r &= ~(0x7 << shift);
+        r |= table[i].function << shift;
+        mmio_write(fsel, r);
+    }
+
+    for (pull = GPIO_PULL_NONE; pull <= GPIO_PULL_UP; pull++) {
+        mask0 = mask1 = 0;
+        for (i = 0; i < count; i++) {
+            if (table[i].pull != pull) {
+                continue;
+            }
+            if (table[i].pin < 32) {
+                mask0 |= 0x1 << table[i].pin;
+            } else {
+                mask1 |= 0x1 << (table[i].pin - 32);
+            }
+        }
+        if (mask0 == 0 && mask1 == 0) {
+            continue;
+        }
+
+        // Set the control signal, clock it into the pins, then remove the
+        // clock. Pins whose clock bit is 0 keep their previous setting.
+        mmio_write(GPPUD, pull);
+        gpioWait();
+        mmio_write(GPPUDCLK0, mask0);
+        mmio_write(GPPUDCLK1, mask1);
+        gpioWait();
+        mmio_write(GPPUD, 0);
+        mmio_write(GPPUDCLK0, 0);
+        mmio_write(GPPUDCLK1, 0);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       setBit
+//
+//  Arguments:      reg:      The bank 0 register (bank 1 follows it)
+//                  pin:      The pin
+//                  on:       TRUE to set the pin's bit, FALSE to clear it
+//
+//  Returns:        void
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void setBit(mmio_reg *reg, unsigned int pin, int on)
+{
+    if (pin >= 32) {
+        reg++;
+        pin -= 32;
+    }
+
+    if (on) {
+        mmio_write(reg, mmio_read(reg) | (0x1 << pin));
+    } else {
+        mmio_write(reg, mmio_read(reg) & ~(0x1 << pin));
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       gpio_set_edge
+//
+//  Arguments:      pin:      An input pin
+//                  edges:    The GPIO_EDGE_* flags to interrupt on, or 0 to
+//                            stop interrupting
+//                  handler:  Called with the pin number, in the IRQ handler,
+//                            after each detected edge
+//
+//  Returns:        void
+//
+//  Description:    This function sets which edges of the pin raise an
+//                  interrupt. The handler runs with IRQs masked, so it
+//                  should only record the event, e.g. with task_signal().
+//                  The caller unmasks IRQs on core 0 for it to run. Pins
+//                  outside 0 - GPIO_PINS - 1 are ignored.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void gpio_set_edge(unsigned int pin, unsigned int edges, void (*handler)(unsigned int pin))
+{
+    unsigned long flags;
+
+
+    if (pin >= GPIO_PINS) {
+        return;
+    }
+
+    flags = irq_save();
+
+    gpioHandlers[pin] = handler;
+    setBit(GPREN0, pin, edges & GPIO_EDGE_RISING);
+    setBit(GPFEN0, pin, edges & GPIO_EDGE_FALLING);
+    setBit(GPAREN0, pin, edges & GPIO_EDGE_ASYNC_RISING);
+    setBit(GPAFEN0, pin, edges & GPIO_EDGE_ASYNC_FALLING);
+
+    // Discard any event detected before now (the bits are cleared by
+    // writing 1s)
+    if (pin < 32) {
+        mmio_write(GPEDS0, 0x1 << pin);
+    } else {
+        mmio_write(GPEDS1, 0x1 << (pin - 32));
+    }
+
+    if (edges) {
+        irq_enable_gpio();
+    }
+    irq_restore(flags);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       gpio_irq
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function is called by irq_handler() when a GPIO
+//                  interrupt is pending. It clears every detected event and
+//                  calls the pins' handlers.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void gpio_irq()
+{
+    unsigned int events, bank, bit;
+
+
+    for (bank = 0; bank < 2; bank++) {
+        events = bank == 0 ? mmio_read(GPEDS0) : mmio_read(GPEDS1);
+        if (events == 0) {
+            continue;
+        }
+        if (bank == 0) {
+            mmio_write(GPEDS0, events);
+        } else {
+            mmio_write(GPEDS1, events);
+        }
+
+        for (bit = 0; bit < 32; bit++) {
+            if ((events & (0x1 << bit)) && gpioHandlers[bank * 32 + bit]) {
+                gpioHandlers[bank * 32 + bit](bank * 32 + bit);
+            }
+        }
+    }
+}
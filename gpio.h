@@ -5,35 +5,120 @@
 // peripherals, which have the address range 0x3F000000 to 0x3FFFFFFF.
 // These addresses are mapped by the VideoCore Memory Management Unit (MMU)
 // onto the bus addresses in the range 0x7E000000 to 0x7EFFFFFF.
+//
+// The functions declared below configure pins from a table, drive and read
+// them, and call a handler when an input pin sees an edge. They are
+// implemented in gpio.c.
+
+#ifndef GPIO_H
+#define GPIO_H
+
+#include "mmio.h"
+
+#define GPFSEL0         MMIO_REG(MMIO_BASE + 0x00200000)
+#define GPFSEL1         MMIO_REG(MMIO_BASE + 0x00200004)
+#define GPFSEL2         MMIO_REG(MMIO_BASE + 0x00200008)
+#define GPFSEL3         MMIO_REG(MMIO_BASE + 0x0020000C)
+#define GPFSEL4         MMIO_REG(MMIO_BASE + 0x00200010)
+#define GPFSEL5         MMIO_REG(MMIO_BASE + 0x00200014)
+#define GPSET0          MMIO_REG(MMIO_BASE + 0x0020001C)
+#define GPSET1          MMIO_REG(MMIO_BASE + 0x00200020)
+#define GPCLR0          MMIO_REG(MMIO_BASE + 0x00200028)
+#define GPCLR1          MMIO_REG(MMIO_BASE + 0x0020002C)
+#define GPLEV0          MMIO_REG(MMIO_BASE + 0x00200034)
+#define GPLEV1          MMIO_REG(MMIO_BASE + 0x00200038)
+#define GPEDS0          MMIO_REG(MMIO_BASE + 0x00200040)
+#define GPEDS1          MMIO_REG(MMIO_BASE + 0x00200044)
+#define GPREN0          MMIO_REG(MMIO_BASE + 0x0020004C)
+#define GPREN1          MMIO_REG(MMIO_BASE + 0x00200050)
+#define GPFEN0          MMIO_REG(MMIO_BASE + 0x00200058)
+#define GPFEN1          MMIO_REG(MMIO_BASE + 0x0020005C)
+#define GPHEN0          MMIO_REG(MMIO_BASE + 0x00200064)
+#define GPHEN1          MMIO_REG(MMIO_BASE + 0x00200068)
+#define GPLEN0          MMIO_REG(MMIO_BASE + 0x00200070)
+#define GPLEN1          MMIO_REG(MMIO_BASE + 0x00200074)
+#define GPAREN0         MMIO_REG(MMIO_BASE + 0x0020007C)
+#define GPAREN1         MMIO_REG(MMIO_BASE + 0x00200080)
+#define GPAFEN0         MMIO_REG(MMIO_BASE + 0x00200088)
+#define GPAFEN1         MMIO_REG(MMIO_BASE + 0x0020008C)
+#define GPPUD           MMIO_REG(MMIO_BASE + 0x00200094)
+#define GPPUDCLK0       MMIO_REG(MMIO_BASE + 0x00200098)
+#define GPPUDCLK1       MMIO_REG(MMIO_BASE + 0x0020009C)
+
+// Number of GPIO pins
+#define GPIO_PINS          54
+
+// Pin functions, as encoded in the FSEL fields
+#define GPIO_INPUT         0
+#define GPIO_OUTPUT        1
+#define GPIO_ALT0          4
+#define GPIO_ALT1          5
+#define GPIO_ALT2          6
+#define GPIO_ALT3          7
+#define GPIO_ALT4          3
+#define GPIO_ALT5          2
+
+// Internal pull resistor settings, as encoded in GPPUD
+#define GPIO_PULL_NONE     0
+#define GPIO_PULL_DOWN     1
+#define GPIO_PULL_UP       2
+
+// Edges that raise an interrupt (may be combined). The synchronous edges
+// are sampled with the system clock, so they ignore glitches shorter than
+// two samples; the asynchronous ones catch even very short pulses.
+#define GPIO_EDGE_RISING         (1 << 0)
+#define GPIO_EDGE_FALLING        (1 << 1)
+#define GPIO_EDGE_ASYNC_RISING   (1 << 2)
+#define GPIO_EDGE_ASYNC_FALLING  (1 << 3)
+
+// One entry of a pin configuration table
+struct gpio_pin_config {
+    unsigned char pin;         // GPIO pin number (0 - 53)
+    unsigned char function;    // GPIO_INPUT, GPIO_OUTPUT or GPIO_ALTn
+    unsigned char pull;        // GPIO_PULL_NONE, _DOWN or _UP
+};
+
+// Function prototypes
+void gpio_configure(const struct gpio_pin_config *table, int count);
+void gpio_set_edge(unsigned int pin, unsigned int edges, void (*handler)(unsigned int pin));
+void gpio_irq();
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       gpio_set / gpio_clear / gpio_level
+//
+//  Description:    These functions drive an output pin high or low, and read
+//                  the level of a pin. They are inline so that with a
+//                  constant pin number each one is a single register access.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline void gpio_set(unsigned int pin)
+{
+    if (pin < 32) {
+        mmio_write(GPSET0, 0x1 << pin);
+    } else {
+        mmio_write(GPSET1, 0x1 << (pin - 32));
+    }
+}
+
+static inline void gpio_clear(unsigned int pin)
+{
+    if (pin < 32) {
+        mmio_write(GPCLR0, 0x1 << pin);
+    } else {
+        mmio_write(GPCLR1, 0x1 << (pin - 32));
+    }
+}
+
+static inline int gpio_level(unsigned int pin)
+{
+    if (pin < 32) {
+        return (mmio_read(GPLEV0) >> pin) & 0x1;
+    }
+    return (mmio_read(GPLEV1) >> (pin - 32)) & 0x1;
+}
 
-#define MMIO_BASE       0x3F000000
-
-#define GPFSEL0         ((volatile unsigned int *)(MMIO_BASE + 0x00200000))
-#define GPFSEL1         ((volatile unsigned int *)(MMIO_BASE + 0x00200004))
-#define GPFSEL2         ((volatile unsigned int *)(MMIO_BASE + 0x00200008))
-#define GPFSEL3         ((volatile unsigned int *)(MMIO_BASE + 0x0020000C))
-#define GPFSEL4         ((volatile unsigned int *)(MMIO_BASE + 0x00200010))
-#define GPFSEL5         ((volatile unsigned int *)(MMIO_BASE + 0x00200014))
-#define GPSET0          ((volatile unsigned int *)(MMIO_BASE + 0x0020001C))
-#define GPSET1          ((volatile unsigned int *)(MMIO_BASE + 0x00200020))
-#define GPCLR0          ((volatile unsigned int *)(MMIO_BASE + 0x00200028))
-#define GPCLR1          ((volatile unsigned int *)(MMIO_BASE + 0x0020002C))
-#define GPLEV0          ((volatile unsigned int *)(MMIO_BASE + 0x00200034))
-#define GPLEV1          ((volatile unsigned int *)(MMIO_BASE + 0x00200038))
-#define GPEDS0          ((volatile unsigned int *)(MMIO_BASE + 0x00200040))
-#define GPEDS1          ((volatile unsigned int *)(MMIO_BASE + 0x00200044))
-#define GPREN0          ((volatile unsigned int *)(MMIO_BASE + 0x0020004C))
-#define GPREN1          ((volatile unsigned int *)(MMIO_BASE + 0x00200050))
-#define GPFEN0          ((volatile unsigned int *)(MMIO_BASE + 0x00200058))
-#define GPFEN1          ((volatile unsigned int *)(MMIO_BASE + 0x0020005C))
-#define GPHEN0          ((volatile unsigned int *)(MMIO_BASE + 0x00200064))
-#define GPHEN1          ((volatile unsigned int *)(MMIO_BASE + 0x00200068))
-#define GPLEN0          ((volatile unsigned int *)(MMIO_BASE + 0x00200070))
-#define GPLEN1          ((volatile unsigned int *)(MMIO_BASE + 0x00200074))
-#define GPAREN0         ((volatile unsigned int *)(MMIO_BASE + 0x0020007C))
-#define GPAREN1         ((volatile unsigned int *)(MMIO_BASE + 0x00200080))
-#define GPAFEN0         ((volatile unsigned int *)(MMIO_BASE + 0x00200088))
-#define GPAFEN1         ((volatile unsigned int *)(MMIO_BASE + 0x0020008C))
-#define GPPUD           ((volatile unsigned int *)(MMIO_BASE + 0x00200094))
-#define GPPUDCLK0       ((volatile unsigned int *)(MMIO_BASE + 0x00200098))
-#define GPPUDCLK1       ((volatile unsigned int *)(MMIO_BASE + 0x0020009C))
+#endif
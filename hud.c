@@ -0,0 +1,415 @@
+// The functions in this file implement the HUD described in hud.h. The
+// line keeps two copies of its text: the characters set since the last
+// frame, and the characters last drawn in each cell. hud_render() draws the
+// cells where the two differ. A cell that something else drew over is
+// marked as holding nothing, so it differs from any character and is drawn
+// again. Cells are opaque, background included, so a glyph never needs
+// what was under it.
+//
+// The font is 5 x 7 pixels in an 8 x 8 cell, one byte per row with the
+// leftmost pixel in the top bit, which leaves a gap between characters and
+// between lines.
+
+#include "framebuffer.h"
+#include "trace.h"
+#include "hud.h"
+
+
+// Colors of the text and the cells behind it (0x00RRGGBB)
+#define HUD_TEXT_COLOR        0x00FFFFFF
+#define HUD_BACKGROUND_COLOR  0x00000000
+
+// Number of glyphs, and the bytes of a glyph at the largest scale and depth
+#define HUD_GLYPHS        (HUD_LAST_CHAR - HUD_FIRST_CHAR + 1)
+#define HUD_GLYPH_BYTES   (HUD_FONT_WIDTH * HUD_SCALE_MAX * \
+                           HUD_FONT_HEIGHT * HUD_SCALE_MAX * 4)
+
+// The font, from HUD_FIRST_CHAR to HUD_LAST_CHAR
+static const unsigned char hudFont[HUD_GLYPHS][HUD_FONT_HEIGHT] = {
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // ' '
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // '!'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // '"'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // '#'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // '$'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // '%'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // '&'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // '\''
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // '('
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // ')'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // '*'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // '+'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // ','
+    {0x00, 0x00, 0x00, 0x7C, 0x00, 0x00, 0x00, 0x00},   // '-'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x30, 0x00},   // '.'
+    {0x00, 0x04, 0x08, 0x10, 0x20, 0x40, 0x00, 0x00},   // '/'
+    {0x38, 0x44, 0x4C, 0x54, 0x64, 0x44, 0x38, 0x00},   // '0'
+    {0x10, 0x30, 0x10, 0x10, 0x10, 0x10, 0x38, 0x00},   // '1'
+    {0x38, 0x44, 0x04, 0x08, 0x10, 0x20, 0x7C, 0x00},   // '2'
+    {0x7C, 0x08, 0x10, 0x08, 0x04, 0x44, 0x38, 0x00},   // '3'
+    {0x08, 0x18, 0x28, 0x48, 0x7C, 0x08, 0x08, 0x00},   // '4'
+    {0x7C, 0x40, 0x78, 0x04, 0x04, 0x44, 0x38, 0x00},   // '5'
+    {0x18, 0x20, 0x40, 0x78, 0x44, 0x44, 0x38, 0x00},   // '6'
+    {0x7C, 0x04, 0x08, 0x10, 0x20, 0x20, 0x20, 0x00},   // '7'
+    {0x38, 0x44, 0x44, 0x38, 0x44, 0x44, 0x38, 0x00},   // '8'
+    {0x38, 0x44, 0x44, 0x3C, 0x04, 0x08, 0x30, 0x00},   // '9'
+    {0x00, 0x10, 0x10, 0x00, 0x10, 0x10, 0x00, 0x00},   // ':'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // ';'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // '<'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // '='
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // '>'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // '?'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // '@'
+    {0x38, 0x44, 0x44, 0x7C, 0x44, 0x44, 0x44, 0x00},   // 'A'
+    {0x78, 0x44, 0x44, 0x78, 0x44, 0x44, 0x78, 0x00},   // 'B'
+    {0x38, 0x44, 0x40, 0x40, 0x40, 0x44, 0x38, 0x00},   // 'C'
+    {0x70, 0x48, 0x44, 0x44, 0x44, 0x48, 0x70, 0x00},   // 'D'
+    {0x7C, 0x40, 0x40, 0x78, 0x40, 0x40, 0x7C, 0x00},   // 'E'
+    {0x7C, 0x40, 0x40, 0x78, 0x40, 0x40, 0x40, 0x00},   // 'F'
+    {0x38, 0x44, 0x40, 0x5C, 0x44, 0x44, 0x3C, 0x00},   // 'G'
+    {0x44, 0x44, 0x44, 0x7C, 0x44, 0x44, 0x44, 0x00},   // 'H'
+    {0x38, 0x10, 0x10, 0x10, 0x10, 0x10, 0x38, 0x00},   // 'I'
+    {0x1C, 0x08, 0x08, 0x08, 0x08, 0x48, 0x30, 0x00},   // 'J'
+    {0x44, 0x48, 0x50, 0x60, 0x50, 0x48, 0x44, 0x00},   // 'K'
+    {0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x7C, 0x00},   // 'L'
+    {0x44, 0x6C, 0x54, 0x54, 0x44, 0x44, 0x44, 0x00},   // 'M'
+    {0x44, 0x44, 0x64, 0x54, 0x4C, 0x44, 0x44, 0x00},   // 'N'
+    {0x38, 0x44, 0x44, 0x44, 0x44, 0x44, 0x38, 0x00},   // 'O'
+    {0x78, 0x44, 0x44, 0x78, 0x40, 0x40, 0x40, 0x00},   // 'P'
+    {0x38, 0x44, 0x44, 0x44, 0x54, 0x48, 0x34, 0x00},   // 'Q'
+    {0x78, 0x44, 0x44, 0x78, 0x50, 0x48, 0x44, 0x00},   // 'R'
+    {0x3C, 0x40, 0x40, 0x38, 0x04, 0x04, 0x78, 0x00},   // 'S'
+    {0x7C, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x00},   // 'T'
+    {0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x38, 0x00},   // 'U'
+    {0x44, 0x44, 0x44, 0x44, 0x44, 0x28, 0x10, 0x00},   // 'V'
+    {0x44, 0x44, 0x44, 0x54, 0x54, 0x54, 0x28, 0x00},   // 'W'
+    {0x44, 0x44, 0x28, 0x10, 0x28, 0x44, 0x44, 0x00},   // 'X'
+    {0x44, 0x44, 0x28, 0x10, 0x10, 0x10, 0x10, 0x00},   // 'Y'
+    {0x7C, 0x04, 0x08, 0x10, 0x20, 0x40, 0x7C, 0x00},   // 'Z'
+};
+
+// The glyph cache: each glyph drawn at the current scale, in the frame
+// buffer's pixel format, with rows hudGlyphPitch bytes apart
+static unsigned char __attribute__((aligned(16))) hudGlyphs[HUD_GLYPHS][HUD_GLYPH_BYTES];
+static unsigned int hudGlyphPitch;
+
+// The line's top left pixel, the scale of the font, the size of a cell in
+// pixels (0 until hud_layout() is called), and the number of cells that fit
+// in the width the line was given
+static int hudX, hudY, hudScale;
+static int hudCellWidth, hudCellHeight;
+static int hudFit;
+
+// The text set for each cell, the character drawn in each cell (0 when the
+// cell must be drawn again), and the number of cells in use
+static char hudText[HUD_COLUMNS];
+static char hudDrawn[HUD_COLUMNS];
+static int hudLength;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       expandGlyph
+//
+//  Arguments:      g:            The glyph (0 - HUD_GLYPHS - 1)
+//                  foreground,
+//                  background:   Pixel values returned by fb_color()
+//
+//  Returns:        void
+//
+//  Description:    This function draws one glyph of the font into the
+//                  glyph cache at the current scale.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void expandGlyph(int g, unsigned int foreground, unsigned int background)
+{
+    unsigned char *p;
+    unsigned int value, bytes;
+    int row, column;
+
+
+    bytes = frameBufferBytesPerPixel;
+
+    for (row = 0; row < hudCellHeight; row++) {
+        p = hudGlyphs[g] + row * hudGlyphPitch;
+        for (column = 0; column < hudCellWidth; column++) {
+            if ((hudFont[g][row / hudScale] << (column / hudScale)) & 0x80) {
+                value = foreground;
+            } else {
+                value = background;
+            }
+            if (bytes == 4) {
+                *(unsigned int *)p = value;
+            } else if (bytes == 2) {
+                *(unsigned short *)p = value;
+            } else {
+                *p = value;
+            }
+            p += bytes;
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       visibleColumns
+//
+//  Arguments:      none
+//
+//  Returns:        The number of cells drawn: those in use that fit.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int visibleColumns()
+{
+    return (hudLength < hudFit) ? hudLength : hudFit;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       hud_layout
+//
+//  Arguments:      x, y:     Top left pixel of the line
+//                  scale:    Size of a font pixel in screen pixels (1 -
+//                            HUD_SCALE_MAX)
+//                  width:    The width in pixels the line may take up
+//
+//  Returns:        void
+//
+//  Description:    This function places the line, and fills the glyph cache
+//                  for the scale and the frame buffer's pixel format. It is
+//                  called whenever the resolution changes. Cells that do
+//                  not fit in the width, or on the screen, are never drawn.
+//                  The whole line is drawn on the next hud_render().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void hud_layout(int x, int y, int scale, int width)
+{
+    unsigned int foreground, background;
+    int g;
+
+
+    if (scale < 1) {
+        scale = 1;
+    }
+    if (scale > HUD_SCALE_MAX) {
+        scale = HUD_SCALE_MAX;
+    }
+
+    hudX = x;
+    hudY = y;
+    hudScale = scale;
+    hudCellWidth = HUD_FONT_WIDTH * scale;
+    hudCellHeight = HUD_FONT_HEIGHT * scale;
+    hudGlyphPitch = hudCellWidth * frameBufferBytesPerPixel;
+
+    if (width > (int)frameBufferWidth - x) {
+        width = frameBufferWidth - x;
+    }
+    hudFit = 0;
+    if (width > 0 && y >= 0 && y + hudCellHeight <= (int)frameBufferHeight) {
+        hudFit = width / hudCellWidth;
+    }
+    if (hudFit > HUD_COLUMNS) {
+        hudFit = HUD_COLUMNS;
+    }
+
+    foreground = fb_color(HUD_TEXT_COLOR);
+    background = fb_color(HUD_BACKGROUND_COLOR);
+    for (g = 0; g < HUD_GLYPHS; g++) {
+        expandGlyph(g, foreground, background);
+    }
+
+    hud_invalidate();
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       hud_text
+//
+//  Arguments:      column:   The first cell to write
+//                  text:     The characters to put in it and the cells
+//                            after it
+//
+//  Returns:        void
+//
+//  Description:    This function sets the text of part of the line. Nothing
+//                  is drawn until hud_render(), and then only the cells
+//                  whose character changed. Text beyond the end of the line
+//                  is dropped.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void hud_text(int column, char *text)
+{
+    for (; *text && column < HUD_COLUMNS; text++, column++) {
+        hudText[column] = *text;
+    }
+    if (column > hudLength) {
+        hudLength = column;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       hud_number
+//
+//  Arguments:      column:   The first cell of the field
+//                  digits:   The width of the field in cells
+//                  value:    The number to show
+//                  pad:      The character in front of a number shorter
+//                            than the field, '0' or ' '
+//
+//  Returns:        void
+//
+//  Description:    This function sets a field of the line to a decimal
+//                  number, right-aligned. A number too long for the field
+//                  shows only its last digits.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void hud_number(int column, int digits, unsigned int value, char pad)
+{
+    char text[HUD_COLUMNS + 1];
+    int i;
+
+
+    if (digits > HUD_COLUMNS) {
+        digits = HUD_COLUMNS;
+    }
+
+    text[digits] = 0;
+    for (i = digits - 1; i >= 0; i--) {
+        if (value == 0 && i < digits - 1) {
+            text[i] = pad;
+        } else {
+            text[i] = '0' + value % 10;
+            value /= 10;
+        }
+    }
+
+    hud_text(column, text);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       hud_damage
+//
+//  Arguments:      x, y:            Top left pixel of a rectangle
+//                  width, height:   Its size in pixels
+//
+//  Returns:        void
+//
+//  Description:    The caller reports a rectangle it drew in. The cells of
+//                  the line it overlaps are drawn again on the next
+//                  hud_render(), and no others.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void hud_damage(int x, int y, int width, int height)
+{
+    int first, last, columns;
+
+
+    columns = visibleColumns();
+    if (hudCellWidth == 0 || y >= hudY + hudCellHeight || y + height <= hudY ||
+        x >= hudX + columns * hudCellWidth || x + width <= hudX) {
+        return;
+    }
+
+    first = (x > hudX) ? (x - hudX) / hudCellWidth : 0;
+    last = (x + width - 1 - hudX) / hudCellWidth;
+    if (last >= columns) {
+        last = columns - 1;
+    }
+    for (; first <= last; first++) {
+        hudDrawn[first] = 0;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       hud_invalidate
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function has the whole line drawn again on the next
+//                  hud_render(), for use after the screen has been
+//                  repainted.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void hud_invalidate()
+{
+    int i;
+
+
+    for (i = 0; i < HUD_COLUMNS; i++) {
+        hudDrawn[i] = 0;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       hud_render
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function draws the cells of the line whose character
+//                  changed since the last call, or that were damaged, each
+//                  as one blit from the glyph cache. Text past the width
+//                  given to hud_layout() is clipped a whole cell at a time.
+//                  It is meant to be called late in a frame, so the line
+//                  stays on top.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void hud_render()
+{
+    int i, columns;
+    char c;
+
+
+    if (hudCellWidth == 0) {
+        return;
+    }
+
+    TRACE_BEGIN(TRACE_HUD);
+
+    columns = visibleColumns();
+    for (i = 0; i < columns; i++) {
+        c = hudText[i];
+        if (c < HUD_FIRST_CHAR || c > HUD_LAST_CHAR) {
+            c = ' ';
+        }
+        if (c == hudDrawn[i]) {
+            continue;
+        }
+
+        fb_blit(hudY, hudX + i * hudCellWidth, hudCellWidth, hudCellHeight,
+                hudGlyphs[c - HUD_FIRST_CHAR], hudGlyphPitch);
+        hudDrawn[i] = c;
+    }
+
+    TRACE_END(TRACE_HUD);
+}
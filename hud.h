@@ -0,0 +1,33 @@
+// A line of text drawn over the map, for the timer, the move count, the
+// level and the frame rate. The text is set a field at a time into a line
+// of HUD_COLUMNS character cells, and only the cells whose character
+// changed since the last hud_render() are drawn, so a timer that ticks
+// every frame costs a few glyphs, not the whole line. Each glyph is
+// expanded into the frame buffer's pixel format once, by hud_layout(), and
+// drawn with a single fb_blit().
+
+#ifndef HUD_H
+#define HUD_H
+
+// Number of character cells in the line
+#define HUD_COLUMNS         48
+
+// Size of a glyph of the font in pixels, before scaling, and the largest
+// scale the glyph cache has room for
+#define HUD_FONT_WIDTH      8
+#define HUD_FONT_HEIGHT     8
+#define HUD_SCALE_MAX       2
+
+// The characters the font covers. Any other character is drawn as a space.
+#define HUD_FIRST_CHAR      ' '
+#define HUD_LAST_CHAR       'Z'
+
+// Function prototypes
+void hud_layout(int x, int y, int scale, int width);
+void hud_text(int column, char *text);
+void hud_number(int column, int digits, unsigned int value, char pad);
+void hud_damage(int x, int y, int width, int height);
+void hud_invalidate();
+void hud_render();
+
+#endif
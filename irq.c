@@ -0,0 +1,239 @@
+// The functions in this file handle interrupts taken through the exception
+// vector table in vectors.s. The interrupt sources of each core are
+// collected by the ARM local interrupt controller, which is separate from
+// the BCM peripherals and is described in the BCM2836 ARM-local
+// peripherals document (the BCM2837 has the same block). The interrupts of
+// the BCM peripherals arrive there as a single "GPU interrupt", and are told
+// apart with the BCM interrupt controller described on pages 109 - 118 of
+// the BCM2837 ARM Peripherals Manual.
+
+#include "uart.h"
+#include "gpio.h"
+#include "clock.h"
+#include "irq.h"
+
+// The base address of the ARM local peripherals
+#define LOCAL_BASE  0x40000000
+
+// Core 0 timers interrupt control, and core 0 IRQ source
+#define CORE0_TIMER_IRQ_CONTROL  MMIO_REG(LOCAL_BASE + 0x00000040)
+#define CORE0_IRQ_SOURCE         MMIO_REG(LOCAL_BASE + 0x00000060)
+
+// Bits of the registers above for the secure and non-secure physical
+// timers. Which of the two CNTP_* drives depends on the security state the
+// firmware leaves the core in, so both are used.
+#define CNTPS_IRQ   (1 << 0)
+#define CNTPNS_IRQ  (1 << 1)
+
+// Bit of the core IRQ source register for the BCM peripheral interrupts,
+// which are routed to core 0 by default
+#define GPU_IRQ     (1 << 8)
+
+// BCM interrupt controller registers for IRQs 32 - 63
+#define IRQ_PENDING_2    MMIO_REG(MMIO_BASE + 0x0000B208)
+#define ENABLE_IRQS_2    MMIO_REG(MMIO_BASE + 0x0000B214)
+
+// Bits of the registers above for gpio_int[0], gpio_int[1] and gpio_int[2]
+// (IRQs 49 - 51), raised by events on GPIO pins 0 - 27, 28 - 45 and 46 - 53
+#define GPIO_IRQS   ((1 << 17) | (1 << 18) | (1 << 19))
+
+// Number of IRQs taken so far, so that a core polling for a time can tell
+// that an interrupt came in meanwhile
+static volatile unsigned int irqCount;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       irq_enable
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function unmasks IRQs on the calling core.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void irq_enable()
+{
+    asm volatile("msr daifclr, #2" ::: "memory");
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       irq_disable
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function masks IRQs on the calling core.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void irq_disable()
+{
+    asm volatile("msr daifset, #2" ::: "memory");
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       irq_save
+//
+//  Arguments:      none
+//
+//  Returns:        The calling core's interrupt mask bits (DAIF) as they
+//                  were, for irq_restore().
+//
+//  Description:    This function masks IRQs on the calling core.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned long irq_save()
+{
+    unsigned long flags;
+
+
+    asm volatile("mrs %0, daif; msr daifset, #2" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       irq_restore
+//
+//  Arguments:      flags:    The value returned by irq_save()
+//
+//  Returns:        void
+//
+//  Description:    This function puts the calling core's interrupt mask back
+//                  as it was before irq_save(). If that unmasks IRQs, any
+//                  pending IRQ is taken at once.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void irq_restore(unsigned long flags)
+{
+    asm volatile("msr daif, %0; isb" :: "r"(flags) : "memory");
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       irq_count
+//
+//  Arguments:      none
+//
+//  Returns:        The number of IRQs taken since start-up.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int irq_count()
+{
+    return irqCount;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       irq_enable_timer
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function routes core 0's physical timer interrupt
+//                  to core 0 as an IRQ.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void irq_enable_timer()
+{
+    mmio_write(CORE0_TIMER_IRQ_CONTROL,
+               mmio_read(CORE0_TIMER_IRQ_CONTROL) | CNTPS_IRQ | CNTPNS_IRQ);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       irq_enable_gpio
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function enables the GPIO event interrupts in the
+//                  BCM interrupt controller. Which pins raise them is set
+//                  with gpio_set_edge().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void irq_enable_gpio()
+{
+    mmio_write(ENABLE_IRQS_2, GPIO_IRQS);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       irq_handler
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function is called from vectors.s for every IRQ,
+//                  with IRQs masked. It passes each pending source to its
+//                  handler.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void irq_handler()
+{
+    unsigned int source = mmio_read(CORE0_IRQ_SOURCE);
+
+
+    irqCount++;
+
+    if (source & (CNTPS_IRQ | CNTPNS_IRQ)) {
+        clock_irq();
+    }
+
+    if ((source & GPU_IRQ) && (mmio_read(IRQ_PENDING_2) & GPIO_IRQS)) {
+        gpio_irq();
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       exception_unexpected
+//
+//  Arguments:      entry:    The exception vector table entry (0 - 15)
+//
+//  Returns:        void
+//
+//  Description:    This function is called from vectors.s for any exception
+//                  other than an IRQ. It reports the entry, and vectors.s
+//                  then stops the core.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void exception_unexpected(unsigned long entry)
+{
+    uart_puts("Unexpected exception, vector entry ");
+    uart_putdec(entry);
+    uart_puts("\n");
+}
@@ -0,0 +1,15 @@
+// Interrupt handling. Only core 0 takes interrupts: the ARM generic timer
+// interrupt, routed through the ARM local interrupt controller, and the GPIO
+// edge-detect interrupts (see gpio.h), routed through the BCM interrupt
+// controller.
+
+// Function prototypes
+void irq_enable();
+void irq_disable();
+unsigned long irq_save();
+void irq_restore(unsigned long flags);
+unsigned int irq_count();
+void irq_enable_timer();
+void irq_enable_gpio();
+void irq_handler();
+void exception_unexpected(unsigned long entry);
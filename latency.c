@@ -0,0 +1,182 @@
+// The functions in this file record how long it takes for a button press to
+// reach the screen. The game calls latency_begin() with the time at which the
+// controllers were sampled whenever the button state changes, and then calls
+// latency_mark() as the event passes through the update, render and present
+// stages. Completed events are stored in a fixed ring of LATENCY_RING_SIZE
+// entries, so recording never allocates and old events are simply
+// overwritten. Times are recorded in clock ticks (see clock.h), and converted
+// to microseconds in the report.
+
+#include "uart.h"
+#include "clock.h"
+#include "latency.h"
+
+
+// The ring of input events. Each entry holds a timestamp for every stage.
+static unsigned long latencyRing[LATENCY_RING_SIZE][LATENCY_STAGES];
+
+// Index of the next ring entry to use, and the number of completed events
+static unsigned int latencyHead;
+static unsigned int latencyCount;
+
+// The event that is currently travelling through the stages. It is only
+// copied into the ring once it completes, so the report never sees a
+// partially stamped entry.
+static unsigned long latencyCurrent[LATENCY_STAGES];
+static int latencyOpen;
+
+// Scratch space used to sort the latencies of one stage when reporting
+static unsigned int latencySorted[LATENCY_RING_SIZE];
+
+// Row labels for the report. Each stage is measured from the stage before
+// it, and the total is measured from sampling to presentation.
+static char *latencyLabels[LATENCY_STAGES] = {
+    "total   ", "update  ", "render  ", "present "
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       latency_timestamp
+//
+//  Arguments:      none
+//
+//  Returns:        The current time in clock ticks.
+//
+//  Description:    This function returns the timestamp used for all latency
+//                  stages. It is a single counter read, so stamping a stage
+//                  costs almost nothing.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned long latency_timestamp()
+{
+    return clock_now();
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       latency_begin
+//
+//  Arguments:      sampleTime:   The time at which the controllers were
+//                                sampled (latched)
+//
+//  Returns:        void
+//
+//  Description:    This function opens a new input event. An event that was
+//                  still open is abandoned.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void latency_begin(unsigned long sampleTime)
+{
+    latencyCurrent[LATENCY_SAMPLE] = sampleTime;
+    latencyOpen = 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       latency_mark
+//
+//  Arguments:      stage:     LATENCY_UPDATE, LATENCY_RENDER or
+//                             LATENCY_PRESENT
+//
+//  Returns:        void
+//
+//  Description:    This function stamps the open event with the current time
+//                  for the given stage. Stamping the present stage completes
+//                  the event and advances the ring. Nothing is recorded if
+//                  no event is open, so the call is cheap on frames without
+//                  input.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void latency_mark(int stage)
+{
+    int i;
+
+
+    if (!latencyOpen) {
+        return;
+    }
+
+    latencyCurrent[stage] = latency_timestamp();
+
+    if (stage == LATENCY_PRESENT) {
+        for (i = 0; i < LATENCY_STAGES; i++) {
+            latencyRing[latencyHead][i] = latencyCurrent[i];
+        }
+        latencyOpen = 0;
+        latencyHead = (latencyHead + 1) % LATENCY_RING_SIZE;
+        if (latencyCount < LATENCY_RING_SIZE) {
+            latencyCount++;
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       latency_report
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function prints the p50, p95, p99 and maximum latency
+//                  of each stage over the events in the ring. The latencies
+//                  of a stage are copied into a scratch array and insertion
+//                  sorted, which is fast enough for a ring of this size and
+//                  only happens when the report is requested.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void latency_report()
+{
+    unsigned int i, j, n, value;
+    int stage, from, to;
+
+
+    n = latencyCount;
+
+    uart_puts("Input latency over ");
+    uart_putdec(n);
+    uart_puts(" events (microseconds):\n");
+
+    if (n == 0) {
+        return;
+    }
+
+    for (stage = 0; stage < LATENCY_STAGES; stage++) {
+        // Row 0 is the total latency; the others are per-stage deltas
+        from = (stage == 0) ? LATENCY_SAMPLE : stage - 1;
+        to = (stage == 0) ? LATENCY_PRESENT : stage;
+
+        // Insertion sort the latencies of this stage
+        for (i = 0; i < n; i++) {
+            value = clock_to_us(latencyRing[i][to] - latencyRing[i][from]);
+            for (j = i; j > 0 && latencySorted[j - 1] > value; j--) {
+                latencySorted[j] = latencySorted[j - 1];
+            }
+            latencySorted[j] = value;
+        }
+
+        uart_puts("    ");
+        uart_puts(latencyLabels[stage]);
+        uart_puts(" p50=");
+        uart_putdec(latencySorted[(n * 50) / 100]);
+        uart_puts(" p95=");
+        uart_putdec(latencySorted[(n * 95) / 100]);
+        uart_puts(" p99=");
+        uart_putdec(latencySorted[(n * 99) / 100]);
+        uart_puts(" max=");
+        uart_putdec(latencySorted[n - 1]);
+        uart_puts("\n");
+    }
+}
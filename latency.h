@@ -0,0 +1,20 @@
+// Input-to-photon latency tracing. Each input event is timestamped when the
+// controllers are sampled, when the game state has been updated, when
+// rendering is complete, and when the frame is presented. The last
+// LATENCY_RING_SIZE events are kept in a fixed ring, and latency_report()
+// prints per-stage percentiles over the UART.
+
+#define LATENCY_RING_SIZE  256
+
+// Event stages, in the order they are stamped
+#define LATENCY_SAMPLE     0
+#define LATENCY_UPDATE     1
+#define LATENCY_RENDER     2
+#define LATENCY_PRESENT    3
+#define LATENCY_STAGES     4
+
+// Function prototypes
+unsigned long latency_timestamp();
+void latency_begin(unsigned long sampleTime);
+void latency_mark(int stage);
+void latency_report();
@@ -0,0 +1,316 @@
+// The functions in this file implement the binary log described in log.h.
+// Each core's ring is a single-producer, single-consumer queue: the core
+// that owns it only advances its head, and log_flush() on core 0 only
+// advances its tail, with a barrier between a record's contents and the
+// index that hands it over. The history that 'g' dumps is only touched by
+// core 0, so it needs no locking either.
+//
+// log_flush() takes the oldest record at the front of any ring until all
+// the rings are empty, so the history is in timestamp order, except for a
+// record another core is still writing while an older one is taken.
+//
+// The dump format is, with all integers little-endian:
+//
+//     "LOGS"                          magic
+//     u32 version (1)
+//     u32 clock ticks per second
+//     u32 record count, then each record as a struct log_record
+//
+// Streamed records are sent as dumps of up to LOG_STREAM_BATCH records, so
+// tools/logdecode.py reads both the same way.
+
+#include "uart.h"
+#include "clock.h"
+#include "smp.h"
+#include "log.h"
+
+
+// One core's ring. head and tail count records since the start, and only
+// their difference matters; head - tail records are waiting.
+struct log_ring {
+    struct log_record records[LOG_CORE_RING_SIZE];
+    volatile unsigned int head;     // Written by the owning core
+    volatile unsigned int tail;     // Written by log_flush()
+    volatile unsigned int dropped;  // Records dropped while the ring was full
+};
+
+static struct log_ring __attribute__((aligned(64))) logRings[LOG_CORES];
+
+// The dropped records of each core already reported
+static unsigned int logReported[LOG_CORES];
+
+// The history, with the index of the next record to write and the number
+// of valid records
+static struct log_record __attribute__((aligned(16))) logRing[LOG_RING_SIZE];
+static unsigned int logHead;
+static unsigned int logCount;
+
+// TRUE (non-zero) while flushed records are also streamed, and the packet
+// they are streamed in
+static int logStreaming;
+static struct {
+    unsigned char magic[4];
+    unsigned int version;
+    unsigned int frequency;
+    unsigned int count;
+    struct log_record records[LOG_STREAM_BATCH];
+} logPacket;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       log_write
+//
+//  Arguments:      id:      Offset of the format string in .logfmt
+//                  args:    The argument words
+//                  count:   Number of argument words (at most LOG_MAX_ARGS)
+//
+//  Returns:        void
+//
+//  Description:    This function appends one record to the calling core's
+//                  ring. It is called by the LOG() macro, which supplies
+//                  the id. If the ring is full the record is dropped.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void log_write(unsigned int id, unsigned int *args, unsigned int count)
+{
+    struct log_ring *ring;
+    struct log_record *r;
+    unsigned int i, core, head;
+
+
+    core = smp_core_id();
+    ring = &logRings[core];
+    head = ring->head;
+
+    if (head - ring->tail == LOG_CORE_RING_SIZE) {
+        ring->dropped++;
+        return;
+    }
+
+    r = &ring->records[head % LOG_CORE_RING_SIZE];
+    r->timestamp = clock_now();
+    r->id = id;
+    r->count = count;
+    r->core = core;
+    r->reserved = 0;
+    for (i = 0; i < count; i++) {
+        r->args[i] = args[i];
+    }
+
+    // The record must be complete before log_flush() can see it
+    asm volatile("dmb ish" ::: "memory");
+    ring->head = head + 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mergeRecords
+//
+//  Arguments:      stream:  TRUE (non-zero) to queue the records for the
+//                           UART as well
+//
+//  Returns:        The number of records taken from the rings.
+//
+//  Description:    This function moves the waiting records into the history,
+//                  oldest first. When streaming, it takes no more than one
+//                  packet's worth, and no more than the UART's transmit
+//                  queue has room for, so it never waits.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int mergeRecords(int stream)
+{
+    struct log_ring *ring;
+    struct log_record *r;
+    unsigned long oldest = 0;
+    unsigned int core, best, limit, space, count = 0;
+
+
+    limit = ~0U;
+    if (stream) {
+        space = uart_tx_space();
+        if (space < 16 + sizeof(struct log_record)) {
+            return 0;
+        }
+        limit = (space - 16) / sizeof(struct log_record);
+        if (limit > LOG_STREAM_BATCH) {
+            limit = LOG_STREAM_BATCH;
+        }
+    }
+
+    while (count < limit) {
+        best = LOG_CORES;
+        for (core = 0; core < LOG_CORES; core++) {
+            ring = &logRings[core];
+            if (ring->tail == ring->head) {
+                continue;
+            }
+            // Read the record only after seeing the head that covers it
+            asm volatile("dmb ish" ::: "memory");
+            r = &ring->records[ring->tail % LOG_CORE_RING_SIZE];
+            if (best == LOG_CORES || r->timestamp < oldest) {
+                best = core;
+                oldest = r->timestamp;
+            }
+        }
+        if (best == LOG_CORES) {
+            break;
+        }
+
+        ring = &logRings[best];
+        r = &ring->records[ring->tail % LOG_CORE_RING_SIZE];
+        logRing[logHead] = *r;
+        logHead = (logHead + 1) % LOG_RING_SIZE;
+        if (logCount < LOG_RING_SIZE) {
+            logCount++;
+        }
+        if (stream) {
+            logPacket.records[count] = *r;
+        }
+
+        // The record must be copied before its slot is handed back
+        asm volatile("dmb ish" ::: "memory");
+        ring->tail = ring->tail + 1;
+        count++;
+    }
+
+    if (stream && count > 0) {
+        logPacket.magic[0] = 'L';
+        logPacket.magic[1] = 'O';
+        logPacket.magic[2] = 'G';
+        logPacket.magic[3] = 'S';
+        logPacket.version = 1;
+        logPacket.frequency = clock_frequency();
+        logPacket.count = count;
+        uart_queue((unsigned char *)&logPacket,
+                   16 + count * sizeof(struct log_record));
+    }
+
+    return count;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       log_flush
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function merges the records every core has logged
+//                  since the last call into the history, and queues them
+//                  for the UART while streaming. Records dropped by a full
+//                  ring are reported with a record of their own. It runs on
+//                  core 0, between frames, and never waits.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void log_flush()
+{
+    unsigned int core, dropped;
+
+
+    for (core = 0; core < LOG_CORES; core++) {
+        dropped = logRings[core].dropped;
+        if (dropped != logReported[core]) {
+            LOG("Dropped %u log records on core %u",
+                dropped - logReported[core], core);
+            logReported[core] = dropped;
+        }
+    }
+
+    mergeRecords(logStreaming);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       putWord
+//
+//  Arguments:      value:   A 32-bit value
+//
+//  Returns:        void
+//
+//  Description:    This function writes a 32-bit value to the UART as four
+//                  raw bytes, least significant byte first.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void putWord(unsigned int value)
+{
+    unsigned char bytes[4];
+
+    bytes[0] = value;
+    bytes[1] = value >> 8;
+    bytes[2] = value >> 16;
+    bytes[3] = value >> 24;
+    uart_write(bytes, 4);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       log_dump
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function takes every waiting record into the
+//                  history, and then writes the history to the UART in the
+//                  binary format described at the top of this file, oldest
+//                  record first, and empties it. Records taken here are in
+//                  the dump but are not streamed.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void log_dump()
+{
+    unsigned int i, first;
+
+
+    mergeRecords(0);
+
+    uart_write((unsigned char *)"LOGS", 4);
+    putWord(1);
+    putWord(clock_frequency());
+    putWord(logCount);
+
+    first = (logHead + LOG_RING_SIZE - logCount) % LOG_RING_SIZE;
+    for (i = 0; i < logCount; i++) {
+        uart_write((unsigned char *)&logRing[(first + i) % LOG_RING_SIZE],
+                   sizeof(struct log_record));
+    }
+    logHead = 0;
+    logCount = 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       log_stream_toggle
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This console command starts or stops streaming the log
+//                  to the UART as log_flush() merges it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void log_stream_toggle()
+{
+    logStreaming = !logStreaming;
+    uart_puts(logStreaming ? "Log streaming on\n" : "Log streaming off\n");
+}
@@ -0,0 +1,75 @@
+// Deferred-format binary logging. A LOG() call site stores its format
+// string in the .logfmt linker section, which is kept in kernel8.elf but
+// not loaded into kernel8.img. At run time only the string's offset in that
+// section, a timestamp and the argument words are copied into a ring, so a
+// log call costs a few stores instead of the serial output of the text.
+//
+// Every core logs into a ring of its own, which has that core as its only
+// writer and log_flush() on core 0 as its only reader, so logging takes no
+// locks and never waits for the UART or another core; when a core's ring
+// is full its records are dropped and counted. log_flush() merges the rings
+// in timestamp order into the history that the 'g' console command dumps,
+// and while streaming is on ('w') also queues them for the UART without
+// waiting. tools/logdecode.py formats either output using the strings in
+// kernel8.elf.
+//
+// Formats may use the printf conversions %d, %i, %u, %x, %X, %c and %%,
+// with flags and widths, and take up to LOG_MAX_ARGS integer arguments.
+// LOG() must not be used in interrupt handlers, which could interrupt a
+// LOG() on the same core. Build with -DLOG_ENABLE=0 to compile the log
+// calls out.
+
+#ifndef LOG_H
+#define LOG_H
+
+#ifndef LOG_ENABLE
+#define LOG_ENABLE      1
+#endif
+
+// Number of records kept in the history. Older records are overwritten.
+#define LOG_RING_SIZE   256
+
+// Number of records each core's ring holds until log_flush() takes them (a
+// power of two), and the number of rings
+#define LOG_CORE_RING_SIZE  64
+#define LOG_CORES           4
+
+// Most records streamed in one packet
+#define LOG_STREAM_BATCH    16
+
+// Most argument words one record holds
+#define LOG_MAX_ARGS    4
+
+// One log record (32 bytes)
+struct log_record {
+    unsigned long timestamp;         // clock_now() when the call was made
+    unsigned int id;                 // Offset of the format in .logfmt
+    unsigned short count;            // Number of argument words
+    unsigned char core;              // Core that logged the record
+    unsigned char reserved;
+    unsigned int args[LOG_MAX_ARGS];
+};
+
+// Function prototypes
+void log_write(unsigned int id, unsigned int *args, unsigned int count);
+void log_flush();
+void log_dump();
+void log_stream_toggle();
+
+// Log calls. The format must be a string literal.
+#if LOG_ENABLE
+#define LOG(format, ...)                                                      \
+    do {                                                                      \
+        static const char logFormat[]                                         \
+            __attribute__((section(".logfmt"), used)) = format;               \
+        unsigned int logArgs[] = {0, ##__VA_ARGS__};                          \
+        _Static_assert(sizeof(logArgs) / sizeof(logArgs[0]) - 1 <= LOG_MAX_ARGS, \
+                       "too many LOG arguments");                             \
+        log_write((unsigned long)logFormat, logArgs + 1,                      \
+                  sizeof(logArgs) / sizeof(logArgs[0]) - 1);                  \
+    } while (0)
+#else
+#define LOG(format, ...)
+#endif
+
+#endif
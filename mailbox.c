@@ -1,20 +1,22 @@
 #include "gpio.h"
+#include "mailbox.h"
+#include "trace.h"
 
 // Define mailbox registers. These can be found at:
 // https://github.com/raspberrypi/firmware/wiki/Mailboxes
 #define MAILBOX_BASE       (MMIO_BASE + 0x0000B880)
 
-#define MAILBOX0_READ      ((volatile unsigned int *)(MAILBOX_BASE + 0x0))
-#define MAILBOX0_PEEK      ((volatile unsigned int *)(MAILBOX_BASE + 0x10))
-#define MAILBOX0_SENDER    ((volatile unsigned int *)(MAILBOX_BASE + 0x14))
-#define MAILBOX0_STATUS    ((volatile unsigned int *)(MAILBOX_BASE + 0x18))
-#define MAILBOX0_CONFIG    ((volatile unsigned int *)(MAILBOX_BASE + 0x1C))
+#define MAILBOX0_READ      MMIO_REG(MAILBOX_BASE + 0x0)
+#define MAILBOX0_PEEK      MMIO_REG(MAILBOX_BASE + 0x10)
+#define MAILBOX0_SENDER    MMIO_REG(MAILBOX_BASE + 0x14)
+#define MAILBOX0_STATUS    MMIO_REG(MAILBOX_BASE + 0x18)
+#define MAILBOX0_CONFIG    MMIO_REG(MAILBOX_BASE + 0x1C)
 
-#define MAILBOX1_WRITE     ((volatile unsigned int *)(MAILBOX_BASE + 0x20))
-#define MAILBOX1_PEEK      ((volatile unsigned int *)(MAILBOX_BASE + 0x30))
-#define MAILBOX1_SENDER    ((volatile unsigned int *)(MAILBOX_BASE + 0x34))
-#define MAILBOX1_STATUS    ((volatile unsigned int *)(MAILBOX_BASE + 0x38))
-#define MAILBOX1_CONFIG    ((volatile unsigned int *)(MAILBOX_BASE + 0x3C))
+#define MAILBOX1_WRITE     MMIO_REG(MAILBOX_BASE + 0x20)
+#define MAILBOX1_PEEK      MMIO_REG(MAILBOX_BASE + 0x30)
+#define MAILBOX1_SENDER    MMIO_REG(MAILBOX_BASE + 0x34)
+#define MAILBOX1_STATUS    MMIO_REG(MAILBOX_BASE + 0x38)
+#define MAILBOX1_CONFIG    MMIO_REG(MAILBOX_BASE + 0x3C)
 
 // Define mailbox bitmasks
 #define MAILBOX_RESPONSE   0x80000000
@@ -25,7 +27,7 @@
 // Allocate memory for the global mailbox buffer. It has to be
 // quadword aligned, since the channel is encoded using the low-order
 // 4 bits of its address.
-volatile unsigned int  __attribute__((aligned(16))) mailbox_buffer[36];
+volatile unsigned int  __attribute__((aligned(16))) mailbox_buffer[MAILBOX_BUFFER_SIZE];
 
 
 
@@ -59,32 +61,70 @@ volatile unsigned int  __attribute__((aligned(16))) mailbox_buffer[36];
 int mailbox_query(unsigned char channel)
 {
     unsigned int address;
+    int valid;
 
     // Combine the address of the mailbox buffer with the channel number
     address = (unsigned int)((unsigned long)&mailbox_buffer[0]) & 0xFFFFFFF0;
     address |= (channel & 0xF);
 
+    TRACE_BEGIN(TRACE_MAILBOX_QUERY);
+
     // Keep polling mailbox 1 until it can accept a request
-    while (*MAILBOX1_STATUS & MAILBOX_FULL)
+    while (mmio_read(MAILBOX1_STATUS) & MAILBOX_FULL)
 	;
 
     // Write the address of our request to mailbox 1 with channel identifier
-    *MAILBOX1_WRITE = address;
+    mmio_write(MAILBOX1_WRITE, address);
 
     // Wait for a response in mailbox 0
     while (1) {
 	// Keep polling mailbox 0 until a response appears there
-	while (*MAILBOX0_STATUS & MAILBOX_EMPTY)
+	while (mmio_read(MAILBOX0_STATUS) & MAILBOX_EMPTY)
 	    ;
 
         // Make sure it is a response to our original request,
 	// otherwise keep waiting for a response
-        if (*MAILBOX0_READ == address) {
+        if (mmio_read(MAILBOX0_READ) == address) {
             // Return TRUE if is it a valid response, otherwise return FALSE
-            return (mailbox_buffer[1] == MAILBOX_RESPONSE);
+            valid = (mailbox_buffer[1] == MAILBOX_RESPONSE);
+            TRACE_END(TRACE_MAILBOX_QUERY);
+            return valid;
 	}
     }
 
     // We should never arrive here, but if we do, return FALSE (invalid message)
     return 0;
 }
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mailbox_get_clock_rate
+//
+//  Arguments:      clock:       The clock id (CLOCK_UART, CLOCK_CORE, ...)
+//
+//  Returns:        The clock's rate in Hz, or 0 if the video core did not
+//                  answer.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int mailbox_get_clock_rate(unsigned int clock)
+{
+    mailbox_buffer[0] = 8 * 4;
+    mailbox_buffer[1] = MAILBOX_REQUEST;
+
+    mailbox_buffer[2] = TAG_GET_CLOCK_RATE;
+    mailbox_buffer[3] = 8;
+    mailbox_buffer[4] = 0;
+    mailbox_buffer[5] = clock;
+    mailbox_buffer[6] = 0;     // Response: rate in Hz
+
+    mailbox_buffer[7] = TAG_LAST;
+
+    if (!mailbox_query(CHANNEL_PROPERTY_TAGS_ARMTOVC)) {
+        return 0;
+    }
+
+    return mailbox_buffer[6];
+}
@@ -133,9 +133,14 @@
 #define TAG_LAST                        0
 
 
+// Size of the mailbox buffer in 32-bit words. This is large enough for a
+// TAG_SET_PALETTE request that sets all 256 palette entries.
+#define MAILBOX_BUFFER_SIZE             272
+
 // External declaration for the mailbox buffer.
 // It is allocated in mailbox.c
-extern volatile unsigned int mailbox_buffer[36];
+extern volatile unsigned int mailbox_buffer[MAILBOX_BUFFER_SIZE];
 
-// Function prototype
+// Function prototypes
 int mailbox_query(unsigned char channel);
+unsigned int mailbox_get_clock_rate(unsigned int clock);
@@ -5,12 +5,36 @@
 #include "uart.h"
 #include "framebuffer.h"
 #include "gpio.h"
-#include "systimer.h"
+#include "irq.h"
+#include "clock.h"
+#include "latency.h"
+#include "console.h"
+#include "game.h"
+#include "sprite.h"
+#include "render.h"
+#include "trace.h"
+#include "smp.h"
+#include "raycast.h"
+#include "flow.h"
+#include "entity.h"
+#include "task.h"
+#include "replay.h"
+#include "log.h"
+#include "capture.h"
+#include "scale.h"
+#include "fov.h"
+#include "minimap.h"
+#include "composite.h"
+#include "hud.h"
 
 #define BLACK     0x00000000
 #define WHITE     0x00FFFFFF
 #define RED       0x00FF0000
 #define GREEN     0x00008000
+#define BLUE      0x000000FF
+#define ORANGE    0x00FF8000
+#define DARK_GRAY   0x00404040
+#define LIGHT_GRAY  0x00A0A0A0
 #define BUTTON_B  (1<<0)
 #define BUTTON_Y  (1<<1)
 #define BUTTON_SEL  (1<<2)
@@ -25,47 +49,189 @@
 #define BUTTON_R  (1<<11)
 
 
+// The SNES controllers' shared LATCH and CLOCK output pins
+#define SNES_LATCH     9
+#define SNES_CLOCK     11
+
+// An optional arcade START button (or coin mech switch), wired between this
+// pin and ground. Pressing it starts a new game. The pin must read the
+// same for START_DEBOUNCE_US before a press or release is believed.
+#define START_PIN          17
+#define START_DEBOUNCE_US  20000
+
+// Number of SNES controllers that can share the LATCH and CLOCK lines. Each
+// controller has its own DATA line, and all of them are sampled from the
+// same GPLEV0 read, so extra players cost no extra bus time.
+#define SNES_MAX_PADS  4
+
+// Number of players in race mode (one per controller)
+#define PLAYERS        2
+
+// Number of chasers (one per 'C' in the level), and the frames they take
+// per step
+#define CHASERS        LEVEL_CHASER_COUNT
+#define CHASER_PERIOD  24
+
+// The transitions played over the map (see composite.h), and their length
+// in frames
+#define TRANSITION_NONE       0
+#define TRANSITION_CROSSFADE  1     // From the old screen to a new game
+#define TRANSITION_FADE_IN    2     // From black to the map, at start-up
+#define TRANSITION_FLASH      3     // Half way to GREEN and back, on a win
+#define TRANSITION_FRAMES     30
+
+
 // Function prototypes
 unsigned short get_SNES();
-void init_GPIO9_to_output();
-void set_GPIO9();
-void clear_GPIO9();
-void init_GPIO11_to_output();
-void set_GPIO11();
-void clear_GPIO11();
-void init_GPIO10_to_input();
-unsigned int get_GPIO10();
-void drawSquare(int rowStart, int columnStart, int squareSize, unsigned int color);
+void get_SNES_pads(unsigned short *data, int pads);
+int SNES_pad_connected(unsigned short data);
+void toggleFirstPerson();
+void firstPersonInput(unsigned short data);
+void renderEntities();
+void resetGame();
+unsigned int gameStateHash();
+void inputTask(void *arg);
+void gameTask(void *arg);
+void renderTask(void *arg);
+void consoleTask(void *arg);
+void telemetryTask(void *arg);
+void startTask(void *arg);
+void captureTask(void *arg);
+void logTask(void *arg);
+void startPressed(unsigned int pin);
+void layoutMaze();
+void applyResolution();
+void renderFog();
+void fogCellChanged(int x, int y);
+void renderMinimap();
+void renderHud();
+void beginTransition(int kind);
+void renderTransition();
+
+
+// The DATA input pin for each SNES controller. Pad 0 is the original
+// controller on GPIO 10; the others are wired to GPIO 22 - 24. All pins
+// must be below 32 so that they can be read through GPLEV0.
+unsigned int snesDataPins[SNES_MAX_PADS] = {10, 22, 23, 24};
+
+// The pins used by the game. The DATA lines are pulled down by external
+// resistors, and the START button by the internal pull-up.
+static const struct gpio_pin_config gamePins[] = {
+    {SNES_LATCH, GPIO_OUTPUT, GPIO_PULL_NONE},
+    {SNES_CLOCK, GPIO_OUTPUT, GPIO_PULL_NONE},
+    {10, GPIO_INPUT, GPIO_PULL_NONE},
+    {22, GPIO_INPUT, GPIO_PULL_NONE},
+    {23, GPIO_INPUT, GPIO_PULL_NONE},
+    {24, GPIO_INPUT, GPIO_PULL_NONE},
+    {START_PIN, GPIO_INPUT, GPIO_PULL_UP},
+};
 
+#define GAME_PINS  (sizeof(gamePins) / sizeof(gamePins[0]))
 
-int maze[12][16] = {
-    {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1},
+int maze[MAZE_HEIGHT][MAZE_WIDTH] = LEVEL_CELLS;
 
-    {1, 0, 1, 0, 1, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1},
+// The tables tools/genlevel.py worked out from the level (see game.h)
+const unsigned long mazeWalls[MAZE_HEIGHT][LEVEL_WORDS] = LEVEL_WALL_BITS;
+const struct maze_run mazeRuns[LEVEL_RUN_COUNT] = LEVEL_RUNS;
+const unsigned short mazeRowRuns[MAZE_HEIGHT + 1] = LEVEL_ROW_RUNS;
 
-    {2, 0, 0, 0, 1, 0, 1, 0, 1, 0, 0, 0, 1, 1, 0, 1},
+// Player positions and colors. Player 0 uses the original controller and is
+// always in play; the other players join once their controller is detected.
+int playerX[PLAYERS], playerY[PLAYERS];
+int playerActive[PLAYERS];
+unsigned int playerColor[PLAYERS] = {RED, BLUE};
 
-    {1, 0, 1, 1, 1, 0, 1, 0, 1, 1, 1, 1, 1, 1, 0, 1},
+// The colors above converted to the frame buffer's pixel format. This is done
+// once in initColors(), so drawing never converts colors per pixel.
+unsigned int wallPixel, floorPixel, exitPixel;
+unsigned int fogPixel, exploredPixel;
+unsigned int playerPixel[PLAYERS];
+unsigned int squarePixel[4];
 
-    {1, 0, 0, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 1},
+// TRUE (non-zero) when the frame buffer is indexed. Each player then has a
+// palette entry of its own, so color effects are made by rewriting palette
+// entries instead of repainting pixels.
+int paletteMode;
 
-    {1, 1, 0, 0, 0, 1, 1, 1, 1, 1, 0, 1, 1, 1, 0, 1},
+// The color currently shown for each player, and whether the day/night
+// brightness cycle is running (palette mode only)
+unsigned int playerShownColor[PLAYERS];
+int dayNightCycle;
 
-    {1, 0, 0, 1, 0, 1, 0, 0, 0, 1, 0, 1, 0, 0, 0, 1},
+// Number of frames since the game started, used to time effects
+unsigned int frameCount;
 
-    {1, 0, 1, 1, 0, 1, 0, 1, 1, 1, 0, 1, 0, 1, 1, 1},
+// When the frame being drawn started, for dynamic resolution scaling
+unsigned long frameStart;
 
-    {1, 0, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 3},
+// Square size in pixels at the current frame buffer resolution
+int tileSize;
 
-    {1, 1, 0, 1, 0, 0, 0, 1, 0, 1, 0, 1, 1, 1, 0, 1},
+// Each player is a sprite overlay, so moving a player never redraws the
+// maze. Player 0 gets the hardware cursor when the firmware supports it.
+struct sprite playerSprite[PLAYERS];
 
-    {1, 0, 0, 1, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0, 1},
+// The first player to reach the exit, or -1 while the race is still on
+int winner = -1;
 
-    {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1}
-    
+// A square of the maze
+struct maze_square {
+    unsigned char x, y;
 };
 
-int playerX, playerY; 
+// Where each player starts, and where each chaser starts, as marked in the
+// level
+const struct maze_square playerStart[LEVEL_START_COUNT] = LEVEL_STARTS;
+const struct maze_square chaserStart[CHASERS] = LEVEL_CHASERS;
+
+// The controller state sampled by the input task, and the state the game
+// task last acted on
+unsigned short padData[PLAYERS], padState[PLAYERS];
+
+// Signalled by the input task when the controllers have been sampled, and
+// by the game task when the game state has been updated
+struct task_event inputSampled, gameUpdated;
+
+// Signalled from the GPIO interrupt when the START button is pressed
+struct task_event startButton;
+
+// TRUE (non-zero) while the telemetry task reports once a second
+int telemetry;
+
+// TRUE (non-zero) while the map only shows what player 0 can see (see
+// fov.h). Squares never seen are drawn in fogPixel, and open squares seen
+// before but not visible now in exploredPixel. fogX and fogY are where
+// player 0 was when the field of view was last computed.
+int fogOfWar;
+int fogX, fogY;
+
+// TRUE (non-zero) while the minimap (see minimap.h) is shown over the map
+int minimapShown;
+
+// TRUE (non-zero) while the HUD (see hud.h) is shown over the map
+int hudShown = 1;
+
+// The HUD's line, with room for the fields renderHud() fills in
+#define HUD_LINE         "TIME   :  .    MOVES       LEVEL     FPS    "
+#define HUD_LINE_LENGTH  ((int)sizeof(HUD_LINE) - 1)
+
+// What the HUD shows: the squares player 0 has moved, the level (which
+// goes up by one for each game started after a win), when the game started
+// and how long it has run, in clock ticks, and the frames drawn in the
+// last whole second
+unsigned int moveCount, level = 1;
+unsigned long gameStart, gameTime;
+unsigned int hudFps;
+
+// The transition being played over the map, the number of its frames drawn
+// so far, and a transition the game asked for, which the render task
+// begins once the frame is drawn
+int transition, transitionFrame, pendingTransition;
+
+// TRUE (non-zero) while player 0 sees the maze in first person. viewChanged
+// is set when the first-person view must be drawn even if the camera has
+// not moved.
+int firstPerson, viewChanged;
 
 
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -81,531 +247,1646 @@ int playerX, playerY;
 /////////////////////////////////////////////////////////////////////////////////////
 
 char pass(int x, int y){
-    if (maze[y][x]== 0 || maze[y][x] == 2 || maze[y][x] ==3) {
+    if (!MAZE_WALL(x, y)) {
         return 'p'; 
-    }else if (maze[y][x]==1){
-        return 'n'; 
     }
+    return 'n'; 
 }
 
 
 
-void refreshSquare(int x, int y){
-  if (maze[y][x]== 0 || maze[y][x] == 2 || maze[y][x] ==3) {
-        drawSquare(y*64, x*64, 64, WHITE);
-    }else if (maze[y][x]==1){
-        drawSquare(y*64, x*64, 64, BLACK);
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       cellPixel
+//
+//  Arguments:      int x, int y
+//
+//  Returns:        The pixel value that a maze square is drawn with.
+/////////////////////////////////////////////////////////////////////////////////////
+
+unsigned int cellPixel(int x, int y){
+    if (fogOfWar && !fov_visible(x, y)) {
+        if (!fov_explored(x, y)) {
+            return fogPixel;
+        }
+        if (!MAZE_WALL(x, y)) {
+            return exploredPixel;
+        }
     }
-}   
 
-void defaultState(){
-    playerX = 0;
-    playerY = 2;
+    return squarePixel[maze[y][x]];
 }
 
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       cellVisible
+//
+//  Arguments:      int x, int y
+//
+//  Returns:        TRUE (non-zero) if what is in the square is shown, that
+//                  is unless the fog of war hides it.
+/////////////////////////////////////////////////////////////////////////////////////
 
-void drawMaze(){
-    for(unsigned int x = 0; x <16; x++){
-        for(unsigned int y = 0; y <12; y++){
-            refreshSquare(x,y); 
-        }
-    }
+int cellVisible(int x, int y){
+    return !fogOfWar || fov_visible(x, y);
 }
 
-void drawPlayer(unsigned int color){
-    drawSquare(playerY*64, playerX*64, 64, color);
-}
+void refreshSquare(int x, int y){
+    drawSquare(y*tileSize, x*tileSize, tileSize, cellPixel(x, y));
+    minimap_damage(x*tileSize, y*tileSize, tileSize, tileSize);
+    hud_damage(x*tileSize, y*tileSize, tileSize, tileSize);
+}   
 
 ////////////////////////////////////////////////////////////////////////////////////////
 //
-//  Function:       main
+//  Function:       initColors
 //
 //  Arguments:      none
 //
 //  Returns:        void
 //
-//  Description:    This function initializes the UART terminal and initializes
-//                  a frame buffer for a 1024 x 768 display. It also initializes 
-//                  pins 9, 11 to output, and 10 to input. Each pixel in the
-//                  frame buffer is 32 bits in size, which encodes an RGB value
-//                  (plus an 8-bit alpha channel that is not used). The program
-//                  then draws and displays an 12 x 16 maze, defines the games logic 
-//
+//  Description:    This function converts the game's colors into the pixel
+//                  format chosen by initFrameBuffer(). In palette mode every
+//                  player gets a palette entry of its own, so that it can be
+//                  recolored without drawing. Nothing recolors the exit
+//                  square, so it shares the floor's entry.
 /////////////////////////////////////////////////////////////////////////////////////
 
-void main()
-{
-    unsigned short data, currentState = 0xFFFF;
+void initColors(){
+    int p;
 
-    // Initialize the UART terminal
-    uart_init();
+    paletteMode = (frameBufferDepth == 8);
 
-    // Set up GPIO pin #9 for output (LATCH output)
-    init_GPIO9_to_output();
-    
-    // Set up GPIO pin #11 for output (CLOCK output)
-    init_GPIO11_to_output();
-    
-    // Set up GPIO pin #10 for input (DATA input)
-    init_GPIO10_to_input();
-    
-    // Clear the LATCH line (GPIO 9) to low
-    clear_GPIO9();
-    
-    // Set CLOCK line (GPIO 11) to high
-    set_GPIO11();
+    wallPixel = fb_color(BLACK);
+    floorPixel = fb_color(WHITE);
+    exitPixel = fb_color(WHITE);
+    fogPixel = fb_color(DARK_GRAY);
+    exploredPixel = fb_color(LIGHT_GRAY);
 
-    // Initialize the frame buffer
-    initFrameBuffer();
+    // The pixel each square value is drawn with: the entrance is drawn as
+    // a path
+    squarePixel[0] = floorPixel;
+    squarePixel[1] = wallPixel;
+    squarePixel[2] = floorPixel;
+    squarePixel[3] = exitPixel;
 
-    // draw game maze
-    drawMaze(); 
-    //drawPlayer(); 
+    for (p = 0; p < PLAYERS; p++) {
+        playerPixel[p] = fb_alloc_color(playerColor[p]);
+        playerShownColor[p] = playerColor[p];
+    }
+}
 
-    // Loop forever, echoing characters received from the console
-    // on a separate line with : : around the character
-    while (1) {
-      data = get_SNES(); 
-
-        if (data != currentState){
-            if((data & BUTTON_START) == BUTTON_START){
-                defaultState();
-                refreshSquare(playerX, playerY);
-                drawPlayer(RED);
-            }  
-            if((data & BUTTON_LEFT) == BUTTON_LEFT){
-                if((playerX > 0 )  && (pass(playerX, playerY) == 'p')){
-                  refreshSquare(playerX, playerY); 
-                  playerX -= 1; 
-                  drawPlayer(RED); 
-                }
-            }
-            if((data & BUTTON_RIGHT) == BUTTON_RIGHT){
-                if((playerX < 15 )  && (pass(playerX, playerY) == 'p')){
-                  refreshSquare(playerX, playerY);
-                  playerX += 1; 
-                  drawPlayer(RED); 
-                }
-            }
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       layoutMaze
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function fits the maze to the frame buffer
+//                  resolution: the squares get the largest size at which the
+//                  whole maze fits, and the player sprites are set up again
+//                  at that size, in the color they are shown in. Any strip
+//                  to the right of or below the maze is cleared, and the
+//                  minimap and the HUD are fitted to the screen. The HUD
+//                  goes in the top row of squares, left of the minimap, in
+//                  the font's largest scale that fits half a square and
+//                  leaves room for the whole line. The maze itself is not
+//                  drawn.
+/////////////////////////////////////////////////////////////////////////////////////
 
-            if((data & BUTTON_UP) == BUTTON_UP){
-                if((playerY > 0 )  && (1pass(playerX, playerY) == 'p')){
-                  refreshSquare(playerX, playerY); 
-                  playerY -= 1; 
-                  drawPlayer(RED); 
-                }
-            }
-            if(((data & BUTTON_DOWN) == BUTTON_DOWN) ){
-                if((playerY < 11) && (pass(playerX, playerY) == 'p')){
-                  refreshSquare(playerX, playerY);
-                  playerY += 1; 
-                  drawPlayer(RED); 
-                }
-            }  
-            currentState = data;
-        }
+void layoutMaze(){
+    int p, x, scale, left, top, width, height;
 
+    tileSize = frameBufferWidth / MAZE_WIDTH;
+    if (tileSize > frameBufferHeight / MAZE_HEIGHT) {
+        tileSize = frameBufferHeight / MAZE_HEIGHT;
+    }
+    if (tileSize > SPRITE_MAX_SIZE) {
+        tileSize = SPRITE_MAX_SIZE;
+    }
 
-        if (maze[playerY][playerX] == 3){
-            refreshSquare(playerX,playerY);
-            drawPlayer(GREEN);
-        }
+    for (p = 0; p < PLAYERS; p++) {
+        sprite_init_solid(&playerSprite[p], tileSize, tileSize, playerShownColor[p],
+                          paletteMode ? playerPixel[p] : fb_color(playerShownColor[p]),
+                          p == 0);
+    }
+
+    if (tileSize * MAZE_WIDTH < frameBufferWidth ||
+        tileSize * MAZE_HEIGHT < frameBufferHeight) {
+        fb_fill_rect(0, 0, frameBufferWidth, frameBufferHeight, wallPixel);
+    }
+
+    minimap_layout();
 
-        microsecond_delay(16667); 
+    // The HUD stops short of the minimap, and drops to a smaller scale
+    // when the whole line does not fit
+    minimap_bounds(&left, &top, &width, &height);
+    x = tileSize / 4;
+    width = left - MINIMAP_MARGIN - x;
+    scale = tileSize / (2 * HUD_FONT_HEIGHT);
+    if (scale > HUD_SCALE_MAX) {
+        scale = HUD_SCALE_MAX;
     }
+    while (scale > 1 && HUD_LINE_LENGTH * HUD_FONT_WIDTH * scale > width) {
+        scale--;
+    }
+    if (scale < 1) {
+        scale = 1;
+    }
+    hud_layout(x, (tileSize - scale * HUD_FONT_HEIGHT) / 2, scale, width);
 }
 
-////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////
 //
-//  Function:       get_SNES
+//  Function:       applyResolution
 //
 //  Arguments:      none
 //
-//  Returns:        A short integer with the button presses encoded with 16
-//                  bits. 1 means pressed, and 0 means unpressed. Bit 0 is
-//                  button B, Bit 1 is button Y, etc. up to Bit 11, which is
-//                  button R. Bits 12-15 are always 0.
-//
-//  Description:    This function samples the button presses on the SNES
-//                  controller, and returns an encoding of these in a 16-bit
-//                  integer. We assume that the CLOCK output is already high,
-//                  and set the LATCH output to high for 12 microseconds. This
-//                  causes the controller to latch the values of the button
-//                  presses into its internal register. We then clock this data
-//                  to the CPU over the DATA line in a serial fashion, by
-//                  pulsing the CLOCK line low 16 times. We read the data on
-//                  the falling edge of the clock. The rising edge of the clock
-//                  causes the controller to output the next bit of serial data
-//                  to be place on the DATA line. The clock cycle is 12
-//                  microseconds long, so the clock is low for 6 microseconds,
-//                  and then high for 6 microseconds. 
+//  Returns:        void
 //
-////////////////////////////////////////////////////////////////////////////////
+//  Description:    This function switches the frame buffer to the resolution
+//                  chosen by the scaling controller (see scale.h), and
+//                  redraws the current view at it. The sprites are hidden
+//                  first, so that software sprites put their backgrounds
+//                  back while the old frame buffer is still in use; the
+//                  next renderPlayers() shows them again.
+/////////////////////////////////////////////////////////////////////////////////////
 
-unsigned short get_SNES()
-{
-    int i;
-    unsigned short data = 0;
-    unsigned int value;
-	
-	
-    // Set LATCH to high for 12 microseconds. This causes the controller to
-    // latch the values of button presses into its internal register. The
-    // first serial bit also becomes available on the DATA line.
-    set_GPIO9();
-    microsecond_delay(12);
-    clear_GPIO9();
-	
-    // Output 16 clock pulses, and read 16 bits of serial data
-    for (i = 0; i < 16; i++) {
-    	// Delay 6 microseconds (half a cycle)
-    	microsecond_delay(6);
-    		
-    	// Clear the CLOCK line (creates a falling edge)
-    	clear_GPIO11();
-    		
-    	// Read the value on the input DATA line
-    	value = get_GPIO10();
-    		
-    	// Store the bit read. Note we convert a 0 (which indicates a button
-    	// press) to a 1 in the returned 16-bit integer. Unpressed buttons
-    	// will be encoded as a 0.
-    	if (value == 0) {
-    	    data |= (0x1 << i);
-    	}
-    		
-    	// Delay 6 microseconds (half a cycle)
-    	microsecond_delay(6);
-    		
-    	// Set the CLOCK to 1 (creates a rising edge). This causes the
-    	// controller to output the next bit, which we read half a
-    	// cycle later.
-    	set_GPIO11();
+void applyResolution(){
+    unsigned int width, height;
+    int p;
+
+    for (p = 0; p < PLAYERS; p++) {
+        sprite_hide(&playerSprite[p]);
+    }
+
+    scale_size(&width, &height);
+    if (!fb_set_size(width, height)) {
+        return;
+    }
+    LOG("Render resolution %ux%u", frameBufferWidth, frameBufferHeight);
+
+    // The saved screens are at the old resolution
+    transition = TRANSITION_NONE;
+    layoutMaze();
+    if (firstPerson) {
+        raycast_init();
+        viewChanged = 1;
+    } else {
+        drawMaze();
     }
-	
-    // Return the encoded data
-    return data;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       setScaling
+//
+//  Arguments:      int enabled
+//
+//  Returns:        void
+//
+//  Description:    This function turns dynamic resolution scaling on or off.
+//                  Turning it off goes back to full resolution.
+/////////////////////////////////////////////////////////////////////////////////////
 
+void setScaling(int enabled){
+    if (scale_set_enabled(enabled)) {
+        applyResolution();
+    }
+}
 
-////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////
 //
-//  Function:       init_GPIO9_to_output
+//  Function:       toggleScaling
 //
 //  Arguments:      none
 //
 //  Returns:        void
 //
-//  Description:    This function sets GPIO pin 9 to an output pin without
-//                  any pull-up or pull-down resistors.
-//
-////////////////////////////////////////////////////////////////////////////////
+//  Description:    This console command turns dynamic resolution scaling on
+//                  or off.
+/////////////////////////////////////////////////////////////////////////////////////
 
-void init_GPIO9_to_output()
-{
-    register unsigned int r;
-    
-    
-    // Get the current contents of the GPIO Function Select Register 0
-    r = *GPFSEL0;
+void toggleScaling(){
+    setScaling(!scale_enabled());
+    uart_puts(scale_enabled() ? "Resolution scaling on\n" : "Resolution scaling off\n");
+}
 
-    // Clear bits 27 - 29. This is the field FSEL9, which maps to GPIO pin 9.
-    // We clear the bits by ANDing with a 000 bit pattern in the field.
-    r &= ~(0x7 << 27);
+void defaultState(int p){
+    // Each player starts on its own square of the level, or at the
+    // entrance when the level marks fewer squares than there are players
+    int start = (p < LEVEL_START_COUNT) ? p : 0;
 
-    // Set the field FSEL9 to 001, which sets pin 9 to an output pin.
-    // We do so by ORing the bit pattern 001 into the field.
-    r |= (0x1 << 27);
+    playerX[p] = playerStart[start].x;
+    playerY[p] = playerStart[start].y;
+}
 
-    // Write the modified bit pattern back to the
-    // GPIO Function Select Register 0
-    *GPFSEL0 = r;
 
-    // Disable the pull-up/pull-down control line for GPIO pin 9. We follow the
-    // procedure outlined on page 101 of the BCM2837 ARM Peripherals manual. The
-    // internal pull-up and pull-down resistor isn't needed for an output pin.
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       drawMaze
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function repaints the whole maze with the scanline
+//                  renderer, and then puts the entities and the sprites
+//                  back on top of it. The minimap and the HUD are drawn
+//                  again on the next frame.
+/////////////////////////////////////////////////////////////////////////////////////
 
-    // Disable pull-up/pull-down by setting bits 0:1
-    // to 00 in the GPIO Pull-Up/Down Register 
-    *GPPUD = 0x0;
+void drawMaze(){
+    render_maze();
+    entity_redraw_all();
+    sprite_refresh_all();
+    minimap_invalidate();
+    hud_invalidate();
+}
 
-    // Wait 150 cycles to provide the required set-up time 
-    // for the control signal
-    r = 150;
-    while (r--) {
-	asm volatile("nop");
-    }
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       movePlayer
+//
+//  Arguments:      int p, int dx, int dy
+//
+//  Returns:        void
+//
+//  Description:    This function moves player p by one square in the given
+//                  direction, provided the destination is inside the maze and
+//                  is not a wall. Only the game state changes here; the screen
+//                  is brought up to date by renderPlayers().
+/////////////////////////////////////////////////////////////////////////////////////
 
-    // Write to the GPIO Pull-Up/Down Clock Register 0, using a 1 on bit 9 to
-    // clock in the control signal for GPIO pin 9. Note that all other pins
-    // will retain their previous state.
-    *GPPUDCLK0 = (0x1 << 9);
+void movePlayer(int p, int dx, int dy){
+    int x = playerX[p] + dx;
+    int y = playerY[p] + dy;
 
-    // Wait 150 cycles to provide the required hold time
-    // for the control signal
-    r = 150;
-    while (r--) {
-        asm volatile("nop");
+    if (x < 0 || x >= MAZE_WIDTH || y < 0 || y >= MAZE_HEIGHT || pass(x, y) != 'p') {
+        return;
     }
 
-    // Clear all bits in the GPIO Pull-Up/Down Clock Register 0
-    // in order to remove the clock
-    *GPPUDCLK0 = 0;
+    playerX[p] = x;
+    playerY[p] = y;
+    if (p == 0) {
+        moveCount++;
+    }
 }
 
-
-
-////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////
 //
-//  Function:       set_GPIO9
+//  Function:       updateGame
 //
-//  Arguments:      none
+//  Arguments:      data:          The button state of every controller
+//                  currentState:  The button state seen on the previous frame
 //
 //  Returns:        void
 //
-//  Description:    This function sets the GPIO output pin 9
-//                  to a 1 (high) level.
-//
-////////////////////////////////////////////////////////////////////////////////
+//  Description:    This function applies the controller input to the game
+//                  state: players join, leave, reset and move, the winner
+//                  of the race is decided, and the chasers move. Nothing is
+//                  drawn here.
+/////////////////////////////////////////////////////////////////////////////////////
 
-void set_GPIO9()
-{
-    register unsigned int r;
-	  
-    // Put a 1 into the SET9 field of the GPIO Pin Output Set Register 0
-    r = (0x1 << 9);
-    *GPSET0 = r;
-}
+void updateGame(unsigned short *data, unsigned short *currentState){
+    int p;
 
+    for (p = 0; p < PLAYERS; p++) {
+        // A player is in the race while its controller is plugged in. An
+        // unplugged controller reads as every button pressed, so its state
+        // is ignored. Player 0 stays in the race, as the chasers' target.
+        if (!SNES_pad_connected(data[p])) {
+            if (p != 0) {
+                playerActive[p] = 0;
+            }
+            continue;
+        }
+        playerActive[p] = 1;
 
+        if (data[p] == currentState[p]) {
+            continue;
+        }
 
-////////////////////////////////////////////////////////////////////////////////
+        if((data[p] & BUTTON_START) == BUTTON_START){
+            defaultState(p);
+            if (winner == p) {
+                winner = -1;
+            }
+            if (p == 0 && firstPerson) {
+                raycast_set_pose(playerX[p], playerY[p], 1, 0);
+                viewChanged = 1;
+            }
+        }  
+        if(p == 0 && (data[p] & BUTTON_SEL) == BUTTON_SEL){
+            toggleFirstPerson();
+        }
+        if (p == 0 && firstPerson) {
+            firstPersonInput(data[p]);
+            currentState[p] = data[p];
+            continue;
+        }
+        if((data[p] & BUTTON_LEFT) == BUTTON_LEFT){
+            movePlayer(p, -1, 0);
+        }
+        if((data[p] & BUTTON_RIGHT) == BUTTON_RIGHT){
+            movePlayer(p, 1, 0);
+        }
+        if((data[p] & BUTTON_UP) == BUTTON_UP){
+            movePlayer(p, 0, -1);
+        }
+        if((data[p] & BUTTON_DOWN) == BUTTON_DOWN){
+            movePlayer(p, 0, 1);
+        }  
+        currentState[p] = data[p];
+    }
+
+    for (p = 0; p < PLAYERS; p++) {
+        if (playerActive[p] && playerX[p] == LEVEL_EXIT_X &&
+            playerY[p] == LEVEL_EXIT_Y && winner < 0){
+            winner = p;
+            pendingTransition = TRANSITION_FLASH;
+            LOG("Player %d wins", p + 1);
+        }
+    }
+
+    // The chasers hunt player 0. Their flow field is only rebuilt when the
+    // player changes square, a few squares per frame.
+    flow_set_target(playerX[0], playerY[0]);
+    flow_update(FLOW_BUDGET);
+    if (entity_update(playerX[0], playerY[0])) {
+        LOG("Player 1 caught");
+        defaultState(0);
+        if (firstPerson) {
+            raycast_set_pose(playerX[0], playerY[0], 1, 0);
+            viewChanged = 1;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
 //
-//  Function:       clear_GPIO9
+//  Function:       toggleFirstPerson
 //
 //  Arguments:      none
 //
 //  Returns:        void
 //
-//  Description:    This function clears the GPIO output pin 9
-//                  to a 0 (low) level.
-//
-////////////////////////////////////////////////////////////////////////////////
-
-void clear_GPIO9()
-{
-    register unsigned int r;
-	  
-    // Put a 1 into the CLR9 field of the GPIO Pin Output Clear Register 0
-    r = (0x1 << 9);
-    *GPCLR0 = r;
-}
+//  Description:    This function switches player 0 between the map and the
+//                  first-person view. The sprites are hidden while the
+//                  first-person view is shown, and the map is repainted when
+//                  leaving it. The first-person view needs 32 bits per pixel.
+/////////////////////////////////////////////////////////////////////////////////////
 
+void toggleFirstPerson(){
+    int p;
 
+    if (!firstPerson) {
+        if (!raycast_init()) {
+            uart_puts("First-person view needs FRAMEBUFFER_DEPTH=32\n");
+            return;
+        }
+        for (p = 0; p < PLAYERS; p++) {
+            sprite_hide(&playerSprite[p]);
+        }
+        raycast_set_pose(playerX[0], playerY[0], 1, 0);
+        firstPerson = 1;
+        viewChanged = 1;
+        transition = TRANSITION_NONE;
+    } else {
+        firstPerson = 0;
+        drawMaze();
+    }
+}
 
-////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////
 //
-//  Function:       init_GPIO11_to_output
+//  Function:       firstPersonInput
 //
-//  Arguments:      none
+//  Arguments:      unsigned short data
 //
 //  Returns:        void
 //
-//  Description:    This function sets GPIO pin 11 to an output pin without
-//                  any pull-up or pull-down resistors.
-//
-////////////////////////////////////////////////////////////////////////////////
+//  Description:    This function moves player 0 in the first-person view. UP
+//                  and DOWN step forwards and backwards along the direction
+//                  the camera faces, and LEFT and RIGHT turn by 90 degrees.
+//                  Buttons pressed while the camera is still moving or
+//                  turning are ignored.
+/////////////////////////////////////////////////////////////////////////////////////
 
-void init_GPIO11_to_output()
-{
-    register unsigned int r;
-    
-    
-    // Get the current contents of the GPIO Function Select Register 1
-    r = *GPFSEL1;
+void firstPersonInput(unsigned short data){
+    int dx, dy;
 
-    // Clear bits 3 - 5. This is the field FSEL11, which maps to GPIO pin 11.
-    // We clear the bits by ANDing with a 000 bit pattern in the field.
-    r &= ~(0x7 << 3);
+    if (raycast_busy()) {
+        return;
+    }
 
-    // Set the field FSEL11 to 001, which sets pin 9 to an output pin.
-    // We do so by ORing the bit pattern 001 into the field.
-    r |= (0x1 << 3);
+    raycast_facing(&dx, &dy);
 
-    // Write the modified bit pattern back to the
-    // GPIO Function Select Register 1
-    *GPFSEL1 = r;
+    if((data & BUTTON_UP) == BUTTON_UP){
+        movePlayer(0, dx, dy);
+    }else if((data & BUTTON_DOWN) == BUTTON_DOWN){
+        movePlayer(0, -dx, -dy);
+    }else if((data & BUTTON_LEFT) == BUTTON_LEFT){
+        raycast_turn(-1);
+    }else if((data & BUTTON_RIGHT) == BUTTON_RIGHT){
+        raycast_turn(1);
+    }
 
-    // Disable the pull-up/pull-down control line for GPIO pin 11. We follow the
-    // procedure outlined on page 101 of the BCM2837 ARM Peripherals manual. The
-    // internal pull-up and pull-down resistor isn't needed for an output pin.
+    raycast_move_to(playerX[0], playerY[0]);
+}
 
-    // Disable pull-up/pull-down by setting bits 0:1
-    // to 00 in the GPIO Pull-Up/Down Register 
-    *GPPUD = 0x0;
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       playerTargetColor
+//
+//  Arguments:      int p
+//
+//  Returns:        The 0x00RRGGBB color player p should be shown in.
+//
+//  Description:    A player standing on the exit is GREEN. The winner flashes
+//                  between GREEN and WHITE every half second (30 frames) when
+//                  recoloring is cheap, that is in palette mode or with the
+//                  hardware cursor.
+/////////////////////////////////////////////////////////////////////////////////////
 
-    // Wait 150 cycles to provide the required set-up time 
-    // for the control signal
-    r = 150;
-    while (r--) {
-	asm volatile("nop");
+unsigned int playerTargetColor(int p){
+    if (playerX[p] != LEVEL_EXIT_X || playerY[p] != LEVEL_EXIT_Y) {
+        return playerColor[p];
     }
 
-    // Write to the GPIO Pull-Up/Down Clock Register 0, using a 1 on bit 11 to
-    // clock in the control signal for GPIO pin 11. Note that all other pins
-    // will retain their previous state.
-    *GPPUDCLK0 = (0x1 << 11);
-
-    // Wait 150 cycles to provide the required hold time
-    // for the control signal
-    r = 150;
-    while (r--) {
-        asm volatile("nop");
+    if (p == winner && (paletteMode || sprite_is_hardware(&playerSprite[p])) &&
+        ((frameCount / 30) & 1)) {
+        return WHITE;
     }
 
-    // Clear all bits in the GPIO Pull-Up/Down Clock Register 0
-    // in order to remove the clock
-    *GPPUDCLK0 = 0;
+    return GREEN;
 }
 
-
-
-////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////
 //
-//  Function:       set_GPIO11
+//  Function:       setPlayerColor
 //
-//  Arguments:      none
+//  Arguments:      int p, unsigned int rgb
 //
 //  Returns:        void
 //
-//  Description:    This function sets the GPIO output pin 11
-//                  to a 1 (high) level.
-//
-////////////////////////////////////////////////////////////////////////////////
+//  Description:    This function recolors player p when its color changes.
+//                  A software sprite in palette mode is recolored through its
+//                  palette entry without drawing. Otherwise the sprite itself
+//                  is recolored, which for the hardware cursor is a new
+//                  cursor image.
+/////////////////////////////////////////////////////////////////////////////////////
 
-void set_GPIO11()
-{
-    register unsigned int r;
-	  
-    // Put a 1 into the SET11 field of the GPIO Pin Output Set Register 0
-    r = (0x1 << 11);
-    *GPSET0 = r;
-}
+void setPlayerColor(int p, unsigned int rgb){
+    if (playerShownColor[p] == rgb) {
+        return;
+    }
 
+    if (paletteMode && !sprite_is_hardware(&playerSprite[p])) {
+        fb_set_color(playerPixel[p], rgb);
+    } else {
+        sprite_set_solid(&playerSprite[p], rgb, fb_color(rgb));
+    }
 
+    playerShownColor[p] = rgb;
+}
 
-////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////
 //
-//  Function:       clear_GPIO11
+//  Function:       renderEntities
 //
 //  Arguments:      none
 //
 //  Returns:        void
 //
-//  Description:    This function clears the GPIO output pin 11
-//                  to a 0 (low) level.
-//
-////////////////////////////////////////////////////////////////////////////////
+//  Description:    This function brings the chasers on the map up to date.
+//                  A software sprite over a square that a chaser entered or
+//                  left is hidden first, since it keeps a copy of the pixels
+//                  beneath it; renderPlayers() then shows it again.
+/////////////////////////////////////////////////////////////////////////////////////
 
-void clear_GPIO11()
-{
-    register unsigned int r;
-	  
-    // Put a 1 into the CLR11 field of the GPIO Pin Output Clear Register 0
-    r = (0x1 << 11);
-    *GPCLR0 = r;
-}
+void renderEntities(){
+    struct sprite *s;
+    int p;
 
+    for (p = 0; p < PLAYERS; p++) {
+        s = &playerSprite[p];
+        if (s->visible && !sprite_is_hardware(s) &&
+            entity_cell_changed(s->x / tileSize, s->y / tileSize)) {
+            sprite_hide(s);
+        }
+    }
 
+    entity_render();
+}
 
-////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////
 //
-//  Function:       init_GPIO10_to_input
+//  Function:       renderPlayers
 //
 //  Arguments:      none
 //
 //  Returns:        void
 //
-//  Description:    This function sets GPIO pin 10 to an input pin without
-//                  any internal pull-up or pull-down resistors. Note that
-//                  a pull-down (or pull-up) resistor must be used externally
-//                  on the bread board circuit connected to the pin. Be sure
-//                  that the pin high level is 3.3V (definitely NOT 5V).
-//
-////////////////////////////////////////////////////////////////////////////////
-
-void init_GPIO10_to_input()
-{
-    register unsigned int r;
-    
-    
-    // Get the current contents of the GPIO Function Select Register 1
-    r = *GPFSEL1;
-
-    // Clear bits 0 - 2. This is the field FSEL10, which maps to GPIO pin 10.
-    // We clear the bits by ANDing with a 000 bit pattern in the field. This
-    // sets the pin to be an input pin.
-    r &= ~(0x7 << 0);
-
-    // Write the modified bit pattern back to the
-    // GPIO Function Select Register 1
-    *GPFSEL1 = r;
+//  Description:    This function brings every player's sprite up to date,
+//                  hiding those of players who left. Sprites are only moved
+//                  or recolored when something has changed, so an idle
+//                  frame draws nothing.
+/////////////////////////////////////////////////////////////////////////////////////
 
-    // Disable the pull-up/pull-down control line for GPIO pin 10. We follow the
-    // procedure outlined on page 101 of the BCM2837 ARM Peripherals manual. We
-    // will pull down the pin using an external resistor connected to ground.
+void renderPlayers(){
+    struct sprite *s;
+    int p;
 
-    // Disable internal pull-up/pull-down by setting bits 0:1
-    // to 00 in the GPIO Pull-Up/Down Register 
-    *GPPUD = 0x0;
+    for (p = 0; p < PLAYERS; p++) {
+        s = &playerSprite[p];
 
-    // Wait 150 cycles to provide the required set-up time 
-    // for the control signal
-    r = 150;
-    while (r--) {
-        asm volatile("nop");
-    }
+        // A player whose controller was unplugged leaves the map
+        if (!playerActive[p]) {
+            if (s->visible) {
+                minimap_damage(s->x, s->y, tileSize, tileSize);
+                hud_damage(s->x, s->y, tileSize, tileSize);
+                sprite_hide(s);
+            }
+            continue;
+        }
 
-    // Write to the GPIO Pull-Up/Down Clock Register 0, using a 1 on bit 10 to
-    // clock in the control signal for GPIO pin 10. Note that all other pins
-    // will retain their previous state.
-    *GPPUDCLK0 = (0x1 << 10);
+        setPlayerColor(p, playerTargetColor(p));
 
-    // Wait 150 cycles to provide the required hold time
-    // for the control signal
-    r = 150;
-    while (r--) {
-        asm volatile("nop");
+        if (!s->visible || s->x != playerX[p]*tileSize || s->y != playerY[p]*tileSize) {
+            if (s->visible) {
+                minimap_damage(s->x, s->y, tileSize, tileSize);
+                hud_damage(s->x, s->y, tileSize, tileSize);
+            }
+            sprite_move(s, playerX[p]*tileSize, playerY[p]*tileSize);
+            minimap_damage(s->x, s->y, tileSize, tileSize);
+            hud_damage(s->x, s->y, tileSize, tileSize);
+        }
     }
-
-    // Clear all bits in the GPIO Pull-Up/Down Clock Register 0
-    // in order to remove the clock
-    *GPPUDCLK0 = 0;
 }
 
-
-
-////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////
 //
-//  Function:       get_GPIO10
+//  Function:       fogCellChanged
 //
-//  Arguments:      none
+//  Arguments:      int x, int y
 //
-//  Returns:        1 if the pin level is high, and 0 if the pin level is low.
+//  Returns:        void
+//
+//  Description:    This function repaints a square whose visibility has
+//                  changed, with the entities in it, and adds a square that
+//                  came into view to the minimap. A software sprite on the
+//                  square is hidden first, since it keeps a copy of the
+//                  pixels beneath it; renderPlayers() then shows it again.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void fogCellChanged(int x, int y){
+    struct sprite *s;
+    int p;
+
+    for (p = 0; p < PLAYERS; p++) {
+        s = &playerSprite[p];
+        if (s->visible && !sprite_is_hardware(s) &&
+            s->x == x*tileSize && s->y == y*tileSize) {
+            sprite_hide(s);
+        }
+    }
+
+    refreshSquare(x, y);
+    entity_redraw_cell(x, y);
+
+    if (fov_visible(x, y)) {
+        minimap_explore(x, y);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       renderFog
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function brings the fog of war up to date with
+//                  player 0's position. The field of view is only computed
+//                  again when the player has moved since the last time,
+//                  and then only the squares whose visibility changed are
+//                  repainted.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void renderFog(){
+    if (!fogOfWar || (playerX[0] == fogX && playerY[0] == fogY)) {
+        return;
+    }
+
+    fov_update(playerX[0], playerY[0], fogCellChanged);
+    fogX = playerX[0];
+    fogY = playerY[0];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       exploreCell
+//
+//  Arguments:      int x, int y
+//
+//  Returns:        void
+//
+//  Description:    This function adds a square that came into view to the
+//                  minimap, without drawing it, for a view computed before
+//                  the whole map is repainted.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void exploreCell(int x, int y){
+    if (fov_visible(x, y)) {
+        minimap_explore(x, y);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       renderMinimap
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function brings the minimap up to date, last in the
+//                  frame so that it stays on top of the map. The players
+//                  the fog of war does not hide are marked on it, and a
+//                  chaser drawn in a square under it has it drawn again.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void renderMinimap(){
+    int p, x, y, left, top, width, height;
+
+    if (!minimapShown) {
+        return;
+    }
+
+    for (p = 0; p < PLAYERS && p < MINIMAP_PLAYERS; p++) {
+        if (playerActive[p] && cellVisible(playerX[p], playerY[p])) {
+            minimap_set_player(p, playerX[p], playerY[p],
+                               paletteMode ? playerPixel[p] : fb_color(playerShownColor[p]));
+        } else {
+            minimap_set_player(p, -1, 0, 0);
+        }
+    }
+
+    minimap_bounds(&left, &top, &width, &height);
+    for (y = top / tileSize; y <= (top + height - 1) / tileSize && y < MAZE_HEIGHT; y++) {
+        for (x = left / tileSize; x <= (left + width - 1) / tileSize && x < MAZE_WIDTH; x++) {
+            if (entity_cell_changed(x, y)) {
+                minimap_invalidate();
+            }
+        }
+    }
+
+    minimap_render();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       toggleMinimap
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This console command shows or hides the minimap. Hiding
+//                  it repaints the map beneath it.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void toggleMinimap(){
+    minimapShown = !minimapShown;
+    if (!firstPerson) {
+        drawMaze();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       renderHud
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function sets the HUD's text for this frame and
+//                  draws the characters that changed. The timer stops when
+//                  a player wins. A chaser drawn in a square of the top row
+//                  has the characters over that square drawn again.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void renderHud(){
+    static unsigned long second;
+    static unsigned int secondFrames;
+    unsigned long now, hundredths;
+    int x;
+
+    now = clock_now();
+    if (now - second >= clock_from_us(1000000)) {
+        hudFps = frameCount - secondFrames;
+        secondFrames = frameCount;
+        second = now;
+    }
+
+    if (!hudShown) {
+        return;
+    }
+
+    if (winner < 0) {
+        gameTime = now - gameStart;
+    }
+    hundredths = gameTime / clock_from_us(10000);
+
+    hud_text(0, HUD_LINE);
+    hud_number(5, 2, hundredths / 6000, ' ');
+    hud_number(8, 2, (hundredths / 100) % 60, '0');
+    hud_number(11, 2, hundredths % 100, '0');
+    hud_number(21, 4, moveCount, ' ');
+    hud_number(33, 2, level, ' ');
+    hud_number(41, 3, hudFps, ' ');
+
+    for (x = 0; x < MAZE_WIDTH; x++) {
+        if (entity_cell_changed(x, 0)) {
+            hud_damage(x*tileSize, 0, tileSize, tileSize);
+        }
+    }
+
+    hud_render();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       toggleHud
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This console command shows or hides the HUD. Hiding it
+//                  repaints the map beneath it.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void toggleHud(){
+    hudShown = !hudShown;
+    if (!firstPerson) {
+        drawMaze();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       toggleFog
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This console command turns the fog of war on or off.
+//                  Turning it on starts with nothing explored. The map is
+//                  repainted either way.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void toggleFog(){
+    fogOfWar = !fogOfWar;
+    minimap_build(!fogOfWar);
+    if (fogOfWar) {
+        fov_reset();
+        fov_update(playerX[0], playerY[0], exploreCell);
+        fogX = playerX[0];
+        fogY = playerY[0];
+    }
+    if (!firstPerson) {
+        drawMaze();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       beginTransition
+//
+//  Arguments:      int kind
+//
+//  Returns:        void
+//
+//  Description:    This function starts a transition over the map, which
+//                  must already show what the transition ends on. It is
+//                  saved, and the first frame of the transition is drawn
+//                  over it at once, so the end is not seen early. A
+//                  cross-fade also needs the screen it starts from, saved
+//                  before the map was drawn. In palette mode there are no
+//                  transitions.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void beginTransition(int kind){
+    if (!composite_supported() || firstPerson) {
+        return;
+    }
+
+    composite_save(kind == TRANSITION_FLASH ? 0 : 1);
+    transition = kind;
+    transitionFrame = 0;
+    renderTransition();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       renderTransition
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function draws the next frame of the transition.
+//                  The game goes on underneath, so once the last frame is
+//                  drawn the map is repainted to bring it up to date.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void renderTransition(){
+    int alpha;
+
+    alpha = transitionFrame * COMPOSITE_OPAQUE / TRANSITION_FRAMES;
+
+    switch (transition) {
+    case TRANSITION_CROSSFADE:
+        composite_crossfade(alpha);
+        break;
+    case TRANSITION_FADE_IN:
+        composite_fade_from(wallPixel, alpha);
+        break;
+    case TRANSITION_FLASH:
+        if (alpha > COMPOSITE_OPAQUE / 2) {
+            alpha = COMPOSITE_OPAQUE - alpha;
+        }
+        composite_fade_to(fb_color(GREEN), alpha);
+        break;
+    }
+
+    if (++transitionFrame > TRANSITION_FRAMES) {
+        transition = TRANSITION_NONE;
+        drawMaze();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       updateEffects
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function runs the day/night cycle in palette mode,
+//                  which slowly fades the whole palette down and back up.
+//                  This is one mailbox request per frame, whatever the number
+//                  of pixels involved, and no pixels are redrawn.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void updateEffects(){
+    unsigned int phase;
+
+    if (!paletteMode) {
+        return;
+    }
+
+    if (dayNightCycle) {
+        // A 20 second (1200 frame) triangle wave between full brightness
+        // and one quarter brightness
+        phase = frameCount % 1200;
+        if (phase >= 600) {
+            phase = 1200 - phase;
+        }
+        fb_set_brightness(256 - (phase * 192) / 600);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       toggleDayNight
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This console command starts or stops the day/night cycle.
+//                  Stopping it restores full brightness.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void toggleDayNight(){
+    if (!paletteMode) {
+        uart_puts("Day/night cycle needs FRAMEBUFFER_DEPTH=8\n");
+        return;
+    }
+
+    dayNightCycle = !dayNightCycle;
+    if (!dayNightCycle) {
+        fb_set_brightness(256);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       resetGame
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function puts the game back in the state it starts
+//                  in: the players at the entrance with only player 0 in
+//                  play, the chasers at their starting squares with an
+//                  empty flow field, nothing explored under the fog of
+//                  war, the timer and the move count at zero, and the map
+//                  view. A game started after a win is the next level. The
+//                  game has no random state, so a game started from here
+//                  runs the same way for the same input. The old screen
+//                  cross-fades into the new game.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void resetGame(){
+    int p;
+
+    if (composite_supported()) {
+        composite_save(0);
+    }
+
+    for (p = 0; p < PLAYERS; p++) {
+        defaultState(p);
+        playerActive[p] = (p == 0);
+        padState[p] = 0xFFFF;
+        sprite_hide(&playerSprite[p]);
+    }
+    if (winner >= 0) {
+        level++;
+    }
+    winner = -1;
+    firstPerson = 0;
+    moveCount = 0;
+    gameStart = clock_now();
+
+    entity_clear();
+    for (p = 0; p < CHASERS; p++) {
+        entity_spawn(ENTITY_CHASER, chaserStart[p].x, chaserStart[p].y,
+                     CHASER_PERIOD, fb_color(ORANGE));
+    }
+    flow_reset();
+
+    minimap_build(!fogOfWar);
+    if (fogOfWar) {
+        fov_reset();
+        fov_update(playerX[0], playerY[0], exploreCell);
+        fogX = playerX[0];
+        fogY = playerY[0];
+    }
+
+    drawMaze();
+    beginTransition(TRANSITION_CROSSFADE);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       gameStateHash
+//
+//  Arguments:      none
+//
+//  Returns:        A 32-bit FNV-1a hash of the game state.
+//
+//  Description:    The hash covers everything the game logic decides: the
+//                  players, the winner, the entities, and whether player 0
+//                  is in the first-person view and, if so, its camera.
+//                  Replays compare it to check that they reproduced a
+//                  recording.
+/////////////////////////////////////////////////////////////////////////////////////
+
+unsigned int gameStateHash(){
+    unsigned int hash = 2166136261u;
+    int p, e;
+
+    for (p = 0; p < PLAYERS; p++) {
+        hash = (hash ^ playerX[p]) * 16777619u;
+        hash = (hash ^ playerY[p]) * 16777619u;
+        hash = (hash ^ playerActive[p]) * 16777619u;
+    }
+    hash = (hash ^ winner) * 16777619u;
+
+    for (e = 0; e < entityCount; e++) {
+        hash = (hash ^ entityX[e]) * 16777619u;
+        hash = (hash ^ entityY[e]) * 16777619u;
+    }
+
+    hash = (hash ^ firstPerson) * 16777619u;
+    if (firstPerson) {
+        hash = raycast_hash(hash);
+    }
+
+    return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       toggleRecording
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This console command starts recording the input from a
+//                  freshly reset game, or stops the recording.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void toggleRecording(){
+    if (replay_recording()) {
+        replay_record_stop();
+        return;
+    }
+
+    replay_play_stop();
+    resetGame();
+    replay_record_start();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       toggleReplay
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This console command replays the recording from a freshly
+//                  reset game, or stops the replay.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void toggleReplay(){
+    if (replay_playing()) {
+        replay_play_stop();
+        return;
+    }
+
+    replay_record_stop();
+    resetGame();
+    replay_play_start();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
 //
-//  Description:    This function gets the current value of pin 10.
+//  Function:       inputTask
+//
+//  Arguments:      void *arg (unused)
+//
+//  Returns:        Never
+//
+//  Description:    This task starts every frame. It samples the controllers
+//                  60 times per second (or takes the buttons from a replay),
+//                  starts a latency event when the
+//                  buttons change, and wakes the game task. Frames are paced
+//                  against an absolute schedule; if a frame runs late the
+//                  schedule restarts from now rather than trying to catch up.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void inputTask(void *arg){
+    unsigned long sampleTime, nextFrame, frameTicks;
+    int p, changed;
+
+    frameTicks = clock_from_us(16667);
+    nextFrame = clock_now();
+
+    while (1) {
+        TRACE_BEGIN(TRACE_FRAME);
+        frameStart = clock_now();
+
+        // Sample the controllers. The buttons are latched at the start of
+        // get_SNES_pads(), so that is the time the input event happened.
+        sampleTime = latency_timestamp();
+        // A replay supplies the recorded buttons instead of the GPIO reads
+        if (!replay_playing()) {
+            TRACE_BEGIN(TRACE_GET_SNES);
+            get_SNES_pads(padData, PLAYERS);
+            TRACE_END(TRACE_GET_SNES);
+        }
+        replay_input(padData, PLAYERS);
+
+        changed = 0;
+        for (p = 0; p < PLAYERS; p++) {
+            if (padData[p] != padState[p]) {
+                changed = 1;
+                TRACE_INSTANT(TRACE_INPUT, (p << 16) | padData[p]);
+            }
+        }
+        if (changed) {
+            latency_begin(sampleTime);
+        }
+
+        task_signal(&inputSampled);
+
+        nextFrame += frameTicks;
+        if (clock_now() > nextFrame) {
+            nextFrame = clock_now();
+        }
+        task_sleep_until(nextFrame);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       gameTask
+//
+//  Arguments:      void *arg (unused)
+//
+//  Returns:        Never
+//
+//  Description:    This task applies each frame's input to the game state,
+//                  and then wakes the render task.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void gameTask(void *arg){
+    while (1) {
+        task_wait_event(&inputSampled);
+
+        updateGame(padData, padState);
+        replay_end_frame(gameStateHash());
+        latency_mark(LATENCY_UPDATE);
+
+        task_signal(&gameUpdated);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       renderTask
+//
+//  Arguments:      void *arg (unused)
+//
+//  Returns:        Never
+//
+//  Description:    This task draws and presents each frame once the game
+//                  state has been updated. The time the frame took drives
+//                  the dynamic resolution scaling, and a change of
+//                  resolution is made between frames.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void renderTask(void *arg){
+    while (1) {
+        task_wait_event(&gameUpdated);
+
+        if (firstPerson) {
+            // Only draw the view when the camera has moved
+            if (raycast_update() || viewChanged) {
+                raycast_render();
+                viewChanged = 0;
+            }
+        } else if (transition != TRANSITION_NONE) {
+            renderTransition();
+        } else {
+            renderFog();
+            renderEntities();
+            renderPlayers();
+            renderMinimap();
+            renderHud();
+            if (pendingTransition != TRANSITION_NONE) {
+                beginTransition(pendingTransition);
+            }
+        }
+        pendingTransition = TRANSITION_NONE;
+        updateEffects();
+        latency_mark(LATENCY_RENDER);
+
+        displayFrameBuffer();
+        latency_mark(LATENCY_PRESENT);
+        TRACE_END(TRACE_FRAME);
+
+        frameCount++;
+        mmio_frame();
+
+        if (scale_frame(clock_now() - frameStart)) {
+            applyResolution();
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       consoleTask
+//
+//  Arguments:      void *arg (unused)
+//
+//  Returns:        Never
+//
+//  Description:    This task runs any command typed at the terminal. The
+//                  UART is checked every 10 ms, between frames.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void consoleTask(void *arg){
+    while (1) {
+        console_poll();
+        task_sleep_until(clock_now() + clock_from_us(10000));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       telemetryTask
+//
+//  Arguments:      void *arg (unused)
+//
+//  Returns:        Never
+//
+//  Description:    Once a second, this task prints the frame rate, the
+//                  share of time core 0 spent idle and the render
+//                  resolution, while telemetry is
+//                  turned on (see toggleTelemetry()).
+/////////////////////////////////////////////////////////////////////////////////////
+
+void telemetryTask(void *arg){
+    unsigned long second, wake, idle, lastIdle;
+    unsigned int lastFrames;
+
+    second = clock_from_us(1000000);
+    wake = clock_now();
+    lastIdle = task_idle_ticks();
+    lastFrames = frameCount;
+
+    while (1) {
+        wake += second;
+        task_sleep_until(wake);
+
+        idle = task_idle_ticks();
+        if (telemetry) {
+            uart_puts("fps=");
+            uart_putdec(frameCount - lastFrames);
+            uart_puts(" idle=");
+            uart_putdec(((idle - lastIdle) * 100) / second);
+            uart_puts("% res=");
+            uart_putdec(frameBufferWidth);
+            uart_puts("x");
+            uart_putdec(frameBufferHeight);
+            uart_puts("\n");
+        }
+        lastIdle = idle;
+        lastFrames = frameCount;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       captureTask
+//
+//  Arguments:      void *arg (unused)
+//
+//  Returns:        Never
+//
+//  Description:    While the screen is being captured (see capture.h), this
+//                  task starts a frame every CAPTURE_PERIOD_US, and sends
+//                  it a few tiles at a time, moving the transmit queue into
+//                  the UART between them, so the other tasks run while it
+//                  goes out. If sending falls behind, the schedule restarts
+//                  from now.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void captureTask(void *arg){
+    unsigned long period, wake;
+
+    period = clock_from_us(CAPTURE_PERIOD_US);
+    wake = clock_now();
+
+    while (1) {
+        wake += period;
+        if (clock_now() > wake) {
+            wake = clock_now();
+        }
+        task_sleep_until(wake);
+
+        while (!capture_frame()) {
+            uart_tx_poll();
+            task_sleep_until(clock_now() + clock_from_us(CAPTURE_POLL_US));
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       logTask
+//
+//  Arguments:      void *arg (unused)
+//
+//  Returns:        Never
+//
+//  Description:    Every millisecond, this task merges the log records of
+//                  every core (see log.h) and moves queued output into the
+//                  UART. Neither waits for the UART, so a slow serial line
+//                  only delays the log, never a frame.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void logTask(void *arg){
+    while (1) {
+        log_flush();
+        uart_tx_poll();
+        task_sleep_until(clock_now() + clock_from_us(1000));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       toggleTelemetry
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This console command starts or stops the once a second
+//                  telemetry report.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void toggleTelemetry(){
+    telemetry = !telemetry;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       startPressed
+//
+//  Arguments:      pin:     The START button pin
+//
+//  Returns:        void
+//
+//  Description:    This GPIO edge handler runs in the IRQ handler when the
+//                  START button is pressed. The interrupt wakes core 0 from
+//                  wfi, and the signal makes the start task ready.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void startPressed(unsigned int pin){
+    task_signal(&startButton);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       startTask
+//
+//  Arguments:      void *arg (unused)
+//
+//  Returns:        Never
+//
+//  Description:    This task starts a new game each time the START button
+//                  is pressed. The button is ignored while input is being
+//                  recorded or replayed, since it is not part of the
+//                  recording. Contact bounce makes several falling edges
+//                  per press and per release, so an edge only counts if the
+//                  pin still reads low once it has settled, and after a
+//                  press no edge counts until the pin has read high again.
+/////////////////////////////////////////////////////////////////////////////////////
+
+void startTask(void *arg){
+    while (1) {
+        task_wait_event(&startButton);
+
+        // An edge with the pin back high is a bounce from a release
+        task_sleep_until(clock_now() + clock_from_us(START_DEBOUNCE_US));
+        if (gpio_level(START_PIN) != 0) {
+            continue;
+        }
+
+        if (!replay_recording() && !replay_playing()) {
+            resetGame();
+        }
+
+        // Wait for the release to settle. Edges signalled in the meantime
+        // are dropped, since nothing is waiting for them.
+        do {
+            task_sleep_until(clock_now() + clock_from_us(START_DEBOUNCE_US));
+        } while (gpio_level(START_PIN) == 0);
+        task_sleep_until(clock_now() + clock_from_us(START_DEBOUNCE_US));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       main
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function initializes the UART terminal and initializes
+//                  a frame buffer for a 1024 x 768 display. It also initializes 
+//                  pins 9, 11 to output, the DATA pin of every controller
+//                  to input, and the START button pin to interrupt when
+//                  pressed. Each pixel in the frame buffer is 32, 16 or 8
+//                  bits in size (FRAMEBUFFER_DEPTH), encoding an RGB value
+//                  directly or through the palette. The program
+//                  then draws and displays an 12 x 16 maze, defines the games logic.
+//                  Every connected controller drives its own player, and the
+//                  players race each other to the exit. SELECT on the first
+//                  controller switches player 0 to a first-person view,
+//                  which is drawn by all four cores. Orange chasers hunt
+//                  player 0 and send it back to the entrance when they
+//                  catch it. Each frame is split
+//                  into sampling, update, render and present stages, which are
+//                  timestamped for the latency report whenever input changes.
+//                  The stages, the console and the telemetry run as
+//                  cooperative tasks (see task.h), so core 0 sleeps instead
+//                  of spinning while it waits. The render resolution drops
+//                  below 1024 x 768 when frames run over budget (see
+//                  scale.h), and the maze is laid out again to fit.
+//
+/////////////////////////////////////////////////////////////////////////////////////
+
+void main()
+{
+    int p;
+
+    // Initialize the UART terminal
+    uart_init();
+
+    // Start the clock used for timestamps and frame pacing
+    clock_init(CLOCK_SOURCE);
+
+    // Set up the LATCH and CLOCK outputs, the DATA input of every
+    // controller, and the START button
+    gpio_configure(gamePins, GAME_PINS);
+    
+    // Clear the LATCH line to low, and set the CLOCK line to high
+    gpio_clear(SNES_LATCH);
+    gpio_set(SNES_CLOCK);
+
+    // A press of the START button pulls its pin low, which interrupts
+    // this core
+    gpio_set_edge(START_PIN, GPIO_EDGE_FALLING, startPressed);
+    irq_enable();
+
+    // Initialize the frame buffer in the configured pixel format, and
+    // convert the game's colors to that format
+    initFrameBuffer(FRAMEBUFFER_DEPTH);
+    initColors();
+    minimap_build(1);
+    layoutMaze();
+
+    // Start cores 1 - 3, which share the first-person rendering
+    smp_init();
+
+    // Place the chasers
+    for (p = 0; p < CHASERS; p++) {
+        entity_spawn(ENTITY_CHASER, chaserStart[p].x, chaserStart[p].y,
+                     CHASER_PERIOD, fb_color(ORANGE));
+    }
+
+    // Start the timer shown on the HUD
+    gameStart = clock_now();
+
+    // draw game maze, and fade it in
+    drawMaze(); 
+    beginTransition(TRANSITION_FADE_IN);
+
+    for (p = 0; p < PLAYERS; p++) {
+        padState[p] = 0xFFFF;
+        defaultState(p);
+    }
+    playerActive[0] = 1;
+
+    // Split the frame into tasks, and let the scheduler run them
+    task_create("input", inputTask, 0);
+    task_create("game", gameTask, 0);
+    task_create("render", renderTask, 0);
+    task_create("console", consoleTask, 0);
+    task_create("telemetry", telemetryTask, 0);
+    task_create("start", startTask, 0);
+    task_create("capture", captureTask, 0);
+    task_create("log", logTask, 0);
+    task_run();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       get_SNES
+//
+//  Arguments:      none
+//
+//  Returns:        A short integer with the button presses encoded with 16
+//                  bits. 1 means pressed, and 0 means unpressed. Bit 0 is
+//                  button B, Bit 1 is button Y, etc. up to Bit 11, which is
+//                  button R. Bits 12-15 are always 0.
+//
+//  Description:    This function samples the button presses on the first
+//                  SNES controller (DATA on GPIO 10). It is a convenience
+//                  wrapper around get_SNES_pads().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned short get_SNES()
+{
+    unsigned short data;
+
+    get_SNES_pads(&data, 1);
+    return data;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       get_SNES_pads
+//
+//  Arguments:      data:     Array that receives one button encoding per pad
+//                  pads:     Number of pads to read (1 to SNES_MAX_PADS)
+//
+//  Returns:        void
+//
+//  Description:    This function samples the button presses on up to four
+//                  SNES controllers at once. All controllers share the LATCH
+//                  (GPIO 9) and CLOCK (GPIO 11) lines, and each one has its
+//                  own DATA line given in snesDataPins[]. We assume that the
+//                  CLOCK output is already high, and set the LATCH output to
+//                  high for 12 microseconds. This causes the controllers to
+//                  latch the values of the button presses into their internal
+//                  registers. We then clock this data to the CPU over the DATA
+//                  lines in a serial fashion, by pulsing the CLOCK line low 16
+//                  times. We read the data on the falling edge of the clock.
+//                  The rising edge of the clock causes the controllers to
+//                  output the next bit of serial data to be place on the DATA
+//                  lines. The clock cycle is 12 microseconds long, so the clock
+//                  is low for 6 microseconds, and then high for 6 microseconds.
+//                  Every DATA line is extracted from the same read of the GPIO
+//                  Pin Level Register 0, so reading extra pads costs no extra
+//                  time. Each pad's buttons are encoded as in get_SNES().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void get_SNES_pads(unsigned short *data, int pads)
+{
+    int i, p;
+    unsigned int value;
+    unsigned int mask[SNES_MAX_PADS];
+
+
+    if (pads > SNES_MAX_PADS) {
+        pads = SNES_MAX_PADS;
+    }
+
+    // Work out the GPLEV0 bit for each pad's DATA line once, up front
+    for (p = 0; p < pads; p++) {
+        mask[p] = 0x1 << snesDataPins[p];
+        data[p] = 0;
+    }
+	
+    // Set LATCH to high for 12 microseconds. This causes the controllers to
+    // latch the values of button presses into their internal registers. The
+    // first serial bit also becomes available on the DATA lines.
+    gpio_set(SNES_LATCH);
+    clock_delay_us(12);
+    gpio_clear(SNES_LATCH);
+	
+    // Output 16 clock pulses, and read 16 bits of serial data from each pad
+    for (i = 0; i < 16; i++) {
+    	// Delay 6 microseconds (half a cycle)
+    	clock_delay_us(6);
+    		
+    	// Clear the CLOCK line (creates a falling edge)
+    	gpio_clear(SNES_CLOCK);
+    		
+    	// Read the values on all of the input DATA lines at once
+    	value = mmio_read(GPLEV0);
+    		
+    	// Store the bit read for each pad. Note we convert a 0 (which
+    	// indicates a button press) to a 1 in the returned 16-bit integer.
+    	// Unpressed buttons will be encoded as a 0.
+    	for (p = 0; p < pads; p++) {
+    	    if ((value & mask[p]) == 0) {
+    	        data[p] |= (0x1 << i);
+    	    }
+    	}
+    		
+    	// Delay 6 microseconds (half a cycle)
+    	clock_delay_us(6);
+    		
+    	// Set the CLOCK to 1 (creates a rising edge). This causes the
+    	// controllers to output the next bit, which we read half a
+    	// cycle later.
+    	gpio_set(SNES_CLOCK);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       SNES_pad_connected
+//
+//  Arguments:      data:     A button encoding returned by get_SNES_pads()
+//
+//  Returns:        1 if a controller appears to be plugged in, 0 otherwise.
+//
+//  Description:    A SNES controller always shifts out 1s for bits 12-15,
+//                  which we encode as 0s. An unplugged DATA line is held low
+//                  by its pull-down resistor, so it reads as every button
+//                  pressed, including bits 12-15.
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-unsigned int get_GPIO10()
+int SNES_pad_connected(unsigned short data)
 {
-    register unsigned int r;
-	  
-	  
-    // Get the current contents of the GPIO Pin Level Register 0
-    r = *GPLEV0;
-	  
-    // Isolate pin 10, and return its value (a 0 if low, or a 1 if high)
-    return ((r >> 10) & 0x1);
-}
\ No newline at end of file
+    return ((data & 0xF000) == 0);
+}
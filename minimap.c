@@ -0,0 +1,447 @@
+// The functions in this file keep the minimap pyramid described in
+// minimap.h and draw the overlay. All levels are kept in one array, level
+// after level, each row-major. A texel's color is decided by majority: a
+// texel with fewer than half of its squares explored shows fog, otherwise
+// it shows wall or floor depending on which most of its explored squares
+// are. A player marker is drawn over the texel the player is in.
+//
+// Only the level shown is drawn, so only its texels are marked dirty. The
+// other levels are still kept up to date, so a change of resolution can
+// switch levels without rebuilding the pyramid.
+
+#include "framebuffer.h"
+#include "game.h"
+#include "minimap.h"
+#include "trace.h"
+
+
+// Colors of the overlay (0x00RRGGBB)
+#define MINIMAP_WALL_COLOR    0x00000000
+#define MINIMAP_FLOOR_COLOR   0x00FFFFFF
+#define MINIMAP_FOG_COLOR     0x00404040
+#define MINIMAP_BORDER_COLOR  0x00808080
+
+// Width of the border around the overlay in pixels
+#define MINIMAP_BORDER        2
+
+// Enough texels for every level: the first holds MAZE_WIDTH x MAZE_HEIGHT,
+// and each one after it a quarter of that, rounded up in each direction
+#define MINIMAP_TEXELS  (MAZE_WIDTH * MAZE_HEIGHT * 2 + MAZE_WIDTH + \
+                         MAZE_HEIGHT + MINIMAP_LEVELS)
+
+// Squares explored, and explored squares that are walls, under each texel
+static unsigned int minimapExplored[MINIMAP_TEXELS];
+static unsigned int minimapWalls[MINIMAP_TEXELS];
+
+// Where each level starts in the arrays above, and its size in texels
+static int levelOffset[MINIMAP_LEVELS];
+static int levelWidth[MINIMAP_LEVELS], levelHeight[MINIMAP_LEVELS];
+static int minimapLevels;
+
+// The level shown, the size of its texels in pixels, and the overlay's
+// top left pixel and size, border included
+static int minimapLevel, minimapScale;
+static int minimapX, minimapY, minimapWidth, minimapHeight;
+
+// The overlay colors in the frame buffer's pixel format
+static unsigned int wallPixel, floorPixel, fogPixel, borderPixel;
+
+// The player markers: the square each player is in (x < 0 when not shown)
+// and the pixel value to draw it with
+static int markerX[MINIMAP_PLAYERS] = {-1, -1, -1, -1};
+static int markerY[MINIMAP_PLAYERS];
+static unsigned int markerPixel[MINIMAP_PLAYERS];
+
+// The texels of the level shown that must be drawn again, or TRUE in
+// minimapFull if the whole overlay must be
+static unsigned short dirtyX[MINIMAP_DIRTY], dirtyY[MINIMAP_DIRTY];
+static int dirtyCount, minimapFull = 1;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       markDirty
+//
+//  Arguments:      x, y:     A square
+//
+//  Returns:        void
+//
+//  Description:    This function marks the texel of the level shown that
+//                  covers the square to be drawn again.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void markDirty(int x, int y)
+{
+    if (minimapFull) {
+        return;
+    }
+    if (dirtyCount == MINIMAP_DIRTY) {
+        minimapFull = 1;
+        return;
+    }
+
+    dirtyX[dirtyCount] = x >> minimapLevel;
+    dirtyY[dirtyCount] = y >> minimapLevel;
+    dirtyCount++;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       minimap_build
+//
+//  Arguments:      explored:  TRUE (non-zero) to start with every square
+//                             explored, FALSE to start with none
+//
+//  Returns:        void
+//
+//  Description:    This function builds the pyramid from the maze, for a
+//                  new game. Each level is summed from the one below it.
+//                  This is the only call whose cost depends on the size of
+//                  the maze.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void minimap_build(int explored)
+{
+    int k, x, y, i, j, child, parent, width, height;
+
+
+    width = MAZE_WIDTH;
+    height = MAZE_HEIGHT;
+    levelOffset[0] = 0;
+    for (k = 0; k < MINIMAP_LEVELS; k++) {
+        levelWidth[k] = width;
+        levelHeight[k] = height;
+        if (k + 1 < MINIMAP_LEVELS) {
+            levelOffset[k + 1] = levelOffset[k] + width * height;
+        }
+        minimapLevels = k + 1;
+        if (width == 1 && height == 1) {
+            break;
+        }
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+
+    for (y = 0; y < MAZE_HEIGHT; y++) {
+        for (x = 0; x < MAZE_WIDTH; x++) {
+            minimapExplored[y * MAZE_WIDTH + x] = explored ? 1 : 0;
+            minimapWalls[y * MAZE_WIDTH + x] = (explored && maze[y][x] == 1) ? 1 : 0;
+        }
+    }
+
+    for (k = 1; k < minimapLevels; k++) {
+        for (i = 0; i < levelWidth[k] * levelHeight[k]; i++) {
+            minimapExplored[levelOffset[k] + i] = 0;
+            minimapWalls[levelOffset[k] + i] = 0;
+        }
+        for (j = 0; j < levelHeight[k - 1]; j++) {
+            for (i = 0; i < levelWidth[k - 1]; i++) {
+                child = levelOffset[k - 1] + j * levelWidth[k - 1] + i;
+                parent = levelOffset[k] + (j / 2) * levelWidth[k] + i / 2;
+                minimapExplored[parent] += minimapExplored[child];
+                minimapWalls[parent] += minimapWalls[child];
+            }
+        }
+    }
+
+    minimapFull = 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       minimap_layout
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function fits the overlay to the frame buffer
+//                  resolution. The overlay is about 1 / MINIMAP_FRACTION of
+//                  the screen wide and no taller than the screen, and shows
+//                  the most detailed level that gives texels of at least
+//                  one pixel in that space. A tall, narrow maze is shown at
+//                  a coarser level or a smaller scale, since the overlay is
+//                  drawn without clipping.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void minimap_layout()
+{
+    int targetWidth, targetHeight, scale;
+
+
+    targetWidth = frameBufferWidth / MINIMAP_FRACTION;
+    targetHeight = frameBufferHeight - 2 * MINIMAP_MARGIN - 2 * MINIMAP_BORDER;
+
+    for (minimapLevel = 0; minimapLevel < minimapLevels - 1; minimapLevel++) {
+        if (levelWidth[minimapLevel] <= targetWidth &&
+            levelHeight[minimapLevel] <= targetHeight) {
+            break;
+        }
+    }
+    minimapScale = targetWidth / levelWidth[minimapLevel];
+    scale = targetHeight / levelHeight[minimapLevel];
+    if (scale < minimapScale) {
+        minimapScale = scale;
+    }
+    if (minimapScale < 1) {
+        minimapScale = 1;
+    }
+
+    minimapWidth = levelWidth[minimapLevel] * minimapScale + 2 * MINIMAP_BORDER;
+    minimapHeight = levelHeight[minimapLevel] * minimapScale + 2 * MINIMAP_BORDER;
+    minimapX = frameBufferWidth - MINIMAP_MARGIN - minimapWidth;
+    minimapY = MINIMAP_MARGIN;
+
+    wallPixel = fb_color(MINIMAP_WALL_COLOR);
+    floorPixel = fb_color(MINIMAP_FLOOR_COLOR);
+    fogPixel = fb_color(MINIMAP_FOG_COLOR);
+    borderPixel = fb_color(MINIMAP_BORDER_COLOR);
+
+    minimapFull = 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       minimap_explore
+//
+//  Arguments:      x, y:     A square
+//
+//  Returns:        void
+//
+//  Description:    This function marks a square explored, updating the one
+//                  texel that covers it on each level. Exploring a square
+//                  twice costs nothing.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void minimap_explore(int x, int y)
+{
+    int k, t, wall;
+
+
+    if (minimapExplored[y * MAZE_WIDTH + x]) {
+        return;
+    }
+
+    wall = (maze[y][x] == 1);
+    for (k = 0; k < minimapLevels; k++) {
+        t = levelOffset[k] + (y >> k) * levelWidth[k] + (x >> k);
+        minimapExplored[t]++;
+        minimapWalls[t] += wall;
+    }
+
+    markDirty(x, y);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       minimap_set_player
+//
+//  Arguments:      p:        The player (0 - MINIMAP_PLAYERS - 1)
+//                  x, y:     The square the player is in, or x < 0 to
+//                            remove the marker
+//                  pixel:    Pixel value to draw the marker with
+//
+//  Returns:        void
+//
+//  Description:    This function moves or recolors a player marker. Nothing
+//                  is marked for drawing unless the marker changed.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void minimap_set_player(int p, int x, int y, unsigned int pixel)
+{
+    if (markerX[p] == x && markerY[p] == y && markerPixel[p] == pixel) {
+        return;
+    }
+
+    if (markerX[p] >= 0) {
+        markDirty(markerX[p], markerY[p]);
+    }
+    markerX[p] = x;
+    markerY[p] = y;
+    markerPixel[p] = pixel;
+    if (x >= 0) {
+        markDirty(x, y);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       minimap_damage
+//
+//  Arguments:      x, y:            Top left pixel of a rectangle
+//                  width, height:   Its size in pixels
+//
+//  Returns:        void
+//
+//  Description:    The caller reports a rectangle it drew in. If it overlaps
+//                  the overlay, the whole overlay is drawn again on the next
+//                  minimap_render().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void minimap_damage(int x, int y, int width, int height)
+{
+    if (x < minimapX + minimapWidth && x + width > minimapX &&
+        y < minimapY + minimapHeight && y + height > minimapY) {
+        minimapFull = 1;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       minimap_invalidate
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function has the whole overlay drawn again on the
+//                  next minimap_render(), for use after the screen has been
+//                  repainted.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void minimap_invalidate()
+{
+    minimapFull = 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       minimap_bounds
+//
+//  Arguments:      x, y:            Receive the overlay's top left pixel
+//                  width, height:   Receive its size in pixels
+//
+//  Returns:        void
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void minimap_bounds(int *x, int *y, int *width, int *height)
+{
+    *x = minimapX;
+    *y = minimapY;
+    *width = minimapWidth;
+    *height = minimapHeight;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       drawTexel
+//
+//  Arguments:      tx, ty:   A texel of the level shown
+//
+//  Returns:        void
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void drawTexel(int tx, int ty)
+{
+    unsigned int pixel, squares, explored, walls;
+    int p, size, width, height, t;
+
+
+    pixel = 0;
+    for (p = MINIMAP_PLAYERS - 1; p >= 0; p--) {
+        if (markerX[p] >= 0 && (markerX[p] >> minimapLevel) == tx &&
+            (markerY[p] >> minimapLevel) == ty) {
+            pixel = markerPixel[p];
+            break;
+        }
+    }
+
+    if (p < 0) {
+        // The number of squares the texel covers, which is less than
+        // 4^level at the right and bottom edges
+        size = 1 << minimapLevel;
+        width = MAZE_WIDTH - (tx << minimapLevel);
+        height = MAZE_HEIGHT - (ty << minimapLevel);
+        squares = ((width < size) ? width : size) * ((height < size) ? height : size);
+
+        t = levelOffset[minimapLevel] + ty * levelWidth[minimapLevel] + tx;
+        explored = minimapExplored[t];
+        walls = minimapWalls[t];
+
+        if (explored * 2 < squares) {
+            pixel = fogPixel;
+        } else if (walls * 2 > explored) {
+            pixel = wallPixel;
+        } else {
+            pixel = floorPixel;
+        }
+    }
+
+    fb_fill_rect(minimapY + MINIMAP_BORDER + ty * minimapScale,
+                 minimapX + MINIMAP_BORDER + tx * minimapScale,
+                 minimapScale, minimapScale, pixel);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       minimap_render
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function draws the overlay: only the texels that
+//                  changed since the last call, or all of it with its
+//                  border after minimap_invalidate() or an overlapping
+//                  minimap_damage(). It is meant to be called last in a
+//                  frame, so the overlay stays on top.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void minimap_render()
+{
+    int i, tx, ty;
+
+
+    if (minimapScale == 0) {
+        return;
+    }
+
+    TRACE_BEGIN(TRACE_MINIMAP);
+
+    if (minimapFull) {
+        fb_fill_rect(minimapY, minimapX, minimapWidth, minimapHeight, borderPixel);
+        for (ty = 0; ty < levelHeight[minimapLevel]; ty++) {
+            for (tx = 0; tx < levelWidth[minimapLevel]; tx++) {
+                drawTexel(tx, ty);
+            }
+        }
+    } else {
+        for (i = 0; i < dirtyCount; i++) {
+            drawTexel(dirtyX[i], dirtyY[i]);
+        }
+    }
+
+    minimapFull = 0;
+    dirtyCount = 0;
+
+    TRACE_END(TRACE_MINIMAP);
+}
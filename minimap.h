@@ -0,0 +1,38 @@
+// A minimap of the maze, drawn over the top right corner of the screen. It
+// is built from a pyramid of downsampled copies of the maze: each texel of
+// level k covers 2^k x 2^k squares, and counts how many of them have been
+// explored and how many of those are walls. The level shown is the most
+// detailed one that fits the overlay. A square being explored updates one
+// texel per level, and only the texels that changed (or that a player
+// entered or left) are drawn again, so the per-frame cost does not depend
+// on the size of the maze.
+
+#ifndef MINIMAP_H
+#define MINIMAP_H
+
+// Number of pyramid levels kept. Level MINIMAP_LEVELS - 1 must be small
+// enough to fit the overlay.
+#define MINIMAP_LEVELS      12
+
+// Overlay width as a fraction of the frame buffer width, and its distance
+// from the corner in pixels
+#define MINIMAP_FRACTION    8
+#define MINIMAP_MARGIN      8
+
+// Texels drawn one by one per frame; more than this redraws the overlay
+#define MINIMAP_DIRTY       64
+
+// Number of player markers
+#define MINIMAP_PLAYERS     4
+
+// Function prototypes
+void minimap_build(int explored);
+void minimap_layout();
+void minimap_explore(int x, int y);
+void minimap_set_player(int p, int x, int y, unsigned int pixel);
+void minimap_damage(int x, int y, int width, int height);
+void minimap_invalidate();
+void minimap_bounds(int *x, int *y, int *width, int *height);
+void minimap_render();
+
+#endif
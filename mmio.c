@@ -0,0 +1,302 @@
+// The functions in this file report the register accesses counted by
+// mmio_read() and mmio_write() when building with MMIO_COUNT=1, and hold
+// the simulated registers used when building with MMIO_SIMULATE=1 (see
+// mmio.h).
+//
+// Each counting use has a struct mmio_site in the .mmiosites section, which
+// the linker script gathers between __mmio_sites_start and __mmio_sites_end,
+// so the uses are found without registering them. A use such as a
+// read-modify-write helper can access many registers, so its accesses are
+// also counted per register, in a table of (use, register) pairs.
+
+#include "uart.h"
+#include "mmio.h"
+
+
+// Most registers listed in the per-register part of the report
+#define MMIO_REPORT_REGISTERS   32
+
+// Most (use, register) pairs counted. Accesses of pairs that do not fit are
+// counted against their use only.
+#define MMIO_PAIRS              512
+
+// Number of simulated registers
+#define MMIO_SIM_REGISTERS      256
+
+
+#if MMIO_COUNT
+// The access counts of one register accessed by one use
+struct mmio_pair {
+    struct mmio_site *site;      // 0 if the slot is free
+    unsigned long address;
+    unsigned int count;          // Accesses in the frame in progress
+    unsigned int last;           // Accesses in the last complete frame
+    unsigned long total;         // Accesses in all complete frames
+};
+
+// The uses, gathered by the linker script
+extern struct mmio_site __mmio_sites_start[], __mmio_sites_end[];
+
+// The (use, register) pairs, open-addressed by use and register address
+static struct mmio_pair mmioPairs[MMIO_PAIRS];
+
+// Number of complete frames counted, and of accesses that had no room in
+// mmioPairs
+static unsigned long mmioFrames, mmioUnpaired;
+#endif
+
+#if MMIO_SIMULATE
+// The simulated registers, open-addressed by register address
+static unsigned long mmioSimAddress[MMIO_SIM_REGISTERS];
+static unsigned int mmioSimValue[MMIO_SIM_REGISTERS];
+#endif
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mmio_count
+//
+//  Arguments:      site:     The use making the access
+//                  address:  The register it accesses
+//
+//  Returns:        void
+//
+//  Description:    This function counts an access by mmio_read() or
+//                  mmio_write() when built with MMIO_COUNT=1, against its
+//                  use and against the pair of the use and the register.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void mmio_count(struct mmio_site *site, unsigned long address)
+{
+#if MMIO_COUNT
+    struct mmio_pair *pair;
+    int i, n;
+
+
+    site->count++;
+
+    i = (((unsigned long)site >> 3) ^ (address >> 2)) % MMIO_PAIRS;
+    for (n = 0; n < MMIO_PAIRS; n++) {
+        pair = &mmioPairs[i];
+        if (pair->site == site && pair->address == address) {
+            pair->count++;
+            return;
+        }
+        if (pair->site == 0) {
+            pair->site = site;
+            pair->address = address;
+            pair->count = 1;
+            return;
+        }
+        i = (i + 1) % MMIO_PAIRS;
+    }
+    mmioUnpaired++;
+#endif
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mmio_frame
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function ends a frame of access counting, and is
+//                  called by the render task after each frame. It does
+//                  nothing unless built with MMIO_COUNT=1.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void mmio_frame()
+{
+#if MMIO_COUNT
+    struct mmio_site *site;
+    int i;
+
+
+    for (site = __mmio_sites_start; site < __mmio_sites_end; site++) {
+        site->last = site->count;
+        site->total += site->count;
+        site->count = 0;
+    }
+    for (i = 0; i < MMIO_PAIRS; i++) {
+        mmioPairs[i].last = mmioPairs[i].count;
+        mmioPairs[i].total += mmioPairs[i].count;
+        mmioPairs[i].count = 0;
+    }
+    mmioFrames++;
+#endif
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mmio_report
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This console command prints, for each use that has
+//                  made an access, its accesses in the last frame and per
+//                  frame on average, followed by the same counts for each
+//                  register it accessed, and then the totals per register
+//                  over all uses.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void mmio_report()
+{
+#if MMIO_COUNT
+    unsigned long address[MMIO_REPORT_REGISTERS];
+    unsigned long total[MMIO_REPORT_REGISTERS];
+    unsigned int last[MMIO_REPORT_REGISTERS];
+    struct mmio_site *site;
+    struct mmio_pair *pair;
+    int registers, i, p;
+
+
+    if (mmioFrames == 0) {
+        uart_puts("No frames counted yet\n");
+        return;
+    }
+
+    uart_puts("MMIO accesses over ");
+    uart_putdec(mmioFrames);
+    uart_puts(" frames\nsite, last frame, per frame\n");
+    uart_puts("    register, last frame, per frame\n");
+
+    for (site = __mmio_sites_start; site < __mmio_sites_end; site++) {
+        if (site->total == 0) {
+            continue;
+        }
+
+        uart_puts(site->write ? "W " : "R ");
+        uart_puts((char *)site->file);
+        uart_putc(':');
+        uart_putdec(site->line);
+        uart_puts(" ");
+        uart_putdec(site->last);
+        uart_puts(" ");
+        uart_putdec(site->total / mmioFrames);
+        uart_puts("\n");
+
+        for (p = 0; p < MMIO_PAIRS; p++) {
+            pair = &mmioPairs[p];
+            if (pair->site != site || pair->total == 0) {
+                continue;
+            }
+            uart_puts("    ");
+            uart_puthex(pair->address);
+            uart_puts(" ");
+            uart_putdec(pair->last);
+            uart_puts(" ");
+            uart_putdec(pair->total / mmioFrames);
+            uart_puts("\n");
+        }
+    }
+
+    registers = 0;
+    for (p = 0; p < MMIO_PAIRS; p++) {
+        pair = &mmioPairs[p];
+        if (pair->total == 0) {
+            continue;
+        }
+
+        for (i = 0; i < registers && address[i] != pair->address; i++) {
+        }
+        if (i == registers) {
+            if (registers == MMIO_REPORT_REGISTERS) {
+                continue;
+            }
+            address[i] = pair->address;
+            total[i] = 0;
+            last[i] = 0;
+            registers++;
+        }
+        total[i] += pair->total;
+        last[i] += pair->last;
+    }
+
+    uart_puts("register, last frame, per frame\n");
+    for (i = 0; i < registers; i++) {
+        uart_puthex(address[i]);
+        uart_puts(" ");
+        uart_putdec(last[i]);
+        uart_puts(" ");
+        uart_putdec(total[i] / mmioFrames);
+        uart_puts("\n");
+    }
+
+    if (mmioUnpaired != 0) {
+        uart_putdec(mmioUnpaired);
+        uart_puts(" accesses not counted per register\n");
+    }
+#else
+    uart_puts("Build with 'make MMIO_COUNT=1' to count MMIO accesses\n");
+#endif
+}
+
+
+
+#if MMIO_SIMULATE
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       simRegister
+//
+//  Arguments:      address:  A register address
+//
+//  Returns:        The register's slot in the simulated register file. A
+//                  register is given a slot, reading as 0, when it is first
+//                  accessed. If the file is full, the last slot is shared.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int simRegister(unsigned long address)
+{
+    int i, n;
+
+    i = (address >> 2) % MMIO_SIM_REGISTERS;
+    for (n = 0; n < MMIO_SIM_REGISTERS; n++) {
+        if (mmioSimAddress[i] == address) {
+            return i;
+        }
+        if (mmioSimAddress[i] == 0) {
+            mmioSimAddress[i] = address;
+            mmioSimValue[i] = 0;
+            return i;
+        }
+        i = (i + 1) % MMIO_SIM_REGISTERS;
+    }
+    return MMIO_SIM_REGISTERS - 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mmio_sim_read / mmio_sim_write
+//
+//  Description:    These functions read and write a simulated register,
+//                  which holds the last value written to it. A host test
+//                  can preload the registers a driver polls, e.g. a UART
+//                  status register, with mmio_sim_write().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int mmio_sim_read(unsigned long address)
+{
+    return mmioSimValue[simRegister(address)];
+}
+
+void mmio_sim_write(unsigned long address, unsigned int value)
+{
+    mmioSimValue[simRegister(address)] = value;
+}
+#endif
@@ -0,0 +1,131 @@
+// Access to memory-mapped device registers. Every register is declared with
+// MMIO_REG() and accessed with mmio_read() and mmio_write(), never through a
+// plain pointer, so that:
+//
+//   - The barriers the BCM2837 needs are in one place. Reads from different
+//     peripherals can return out of order, so a read is followed by a load
+//     barrier, and a write is preceded by a store barrier.
+//
+//   - Building with 'make MMIO_COUNT=1' counts the accesses made by each
+//     use of mmio_read() and mmio_write() to each register, frame by frame
+//     (see mmio_frame()). The 'm' console command reports them per use, per
+//     register of each use, and per register, which shows the device bus
+//     time that cache profiling misses. A use is a line of source, so a use
+//     inside a static inline helper defined in a header is counted once per
+//     translation unit that includes it, not once per caller of the helper.
+//
+//   - A host build can define MMIO_SIMULATE=1, which sends every access to
+//     a simulated register file (see mmio.c) instead of the hardware.
+
+#ifndef MMIO_H
+#define MMIO_H
+
+#ifndef MMIO_COUNT
+#define MMIO_COUNT      0
+#endif
+
+#ifndef MMIO_SIMULATE
+#define MMIO_SIMULATE   0
+#endif
+
+// The ARM physical address of the BCM peripherals. They appear to the
+// VideoCore at the bus addresses 0x7E000000 to 0x7EFFFFFF.
+#define MMIO_BASE       0x3F000000
+
+// A 32-bit device register
+typedef volatile unsigned int mmio_reg;
+#define MMIO_REG(address)   ((mmio_reg *)(unsigned long)(address))
+
+// The access counts of one use of mmio_read() or mmio_write(), over all the
+// registers it accesses. mmio.c keeps the counts per register.
+struct mmio_site {
+    const char *file;
+    unsigned int line;
+    unsigned int write;          // TRUE for mmio_write()
+    unsigned int count;          // Accesses in the frame in progress
+    unsigned int last;           // Accesses in the last complete frame
+    unsigned long total;         // Accesses in all complete frames
+};
+
+// Function prototypes
+void mmio_count(struct mmio_site *site, unsigned long address);
+void mmio_frame();
+void mmio_report();
+unsigned int mmio_sim_read(unsigned long address);
+void mmio_sim_write(unsigned long address, unsigned int value);
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mmio_read_raw / mmio_write_raw
+//
+//  Description:    These functions read and write a register with the
+//                  barriers described above, without counting.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int mmio_read_raw(mmio_reg *reg)
+{
+#if MMIO_SIMULATE
+    return mmio_sim_read((unsigned long)reg);
+#else
+    unsigned int value = *reg;
+
+    asm volatile("dmb ld" ::: "memory");
+    return value;
+#endif
+}
+
+static inline void mmio_write_raw(mmio_reg *reg, unsigned int value)
+{
+#if MMIO_SIMULATE
+    mmio_sim_write((unsigned long)reg, value);
+#else
+    asm volatile("dmb st" ::: "memory");
+    *reg = value;
+#endif
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mmio_read_counted / mmio_write_counted
+//
+//  Description:    These functions count an access against its use and
+//                  register, and then make it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int mmio_read_counted(struct mmio_site *site, mmio_reg *reg)
+{
+    mmio_count(site, (unsigned long)reg);
+    return mmio_read_raw(reg);
+}
+
+static inline void mmio_write_counted(struct mmio_site *site, mmio_reg *reg,
+                                      unsigned int value)
+{
+    mmio_count(site, (unsigned long)reg);
+    mmio_write_raw(reg, value);
+}
+
+// Register accesses. When counting, each use gets a struct mmio_site of its
+// own in the .mmiosites section, which mmio.c walks.
+#if MMIO_COUNT
+#define MMIO_SITE(isWrite)                                                    \
+    ({                                                                        \
+        static struct mmio_site mmioSite                                      \
+            __attribute__((section(".mmiosites"), used)) =                    \
+            {__FILE__, __LINE__, (isWrite), 0, 0, 0};                         \
+        &mmioSite;                                                            \
+    })
+#define mmio_read(reg)          mmio_read_counted(MMIO_SITE(0), (reg))
+#define mmio_write(reg, value)  mmio_write_counted(MMIO_SITE(1), (reg), (value))
+#else
+#define mmio_read(reg)          mmio_read_raw(reg)
+#define mmio_write(reg, value)  mmio_write_raw((reg), (value))
+#endif
+
+#endif
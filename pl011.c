@@ -0,0 +1,241 @@
+// The functions in this file drive the PL011 UART (UART0) on GPIO pins 14
+// and 15, as described in pl011.h. The registers are described on pages
+// 175 - 191 of the Broadcom BCM2837 ARM Peripherals Manual.
+
+#include "gpio.h"
+#include "mailbox.h"
+#include "pl011.h"
+
+// The addresses of the PL011 registers
+#define UART0_DR        MMIO_REG(MMIO_BASE + 0x00201000)
+#define UART0_FR        MMIO_REG(MMIO_BASE + 0x00201018)
+#define UART0_IBRD      MMIO_REG(MMIO_BASE + 0x00201024)
+#define UART0_FBRD      MMIO_REG(MMIO_BASE + 0x00201028)
+#define UART0_LCRH      MMIO_REG(MMIO_BASE + 0x0020102C)
+#define UART0_CR        MMIO_REG(MMIO_BASE + 0x00201030)
+#define UART0_IMSC      MMIO_REG(MMIO_BASE + 0x00201038)
+#define UART0_ICR       MMIO_REG(MMIO_BASE + 0x00201044)
+
+// Flag register bits
+#define FR_BUSY         (1 << 3)
+#define FR_RXFE         (1 << 4)
+#define FR_TXFF         (1 << 5)
+#define FR_TXFE         (1 << 7)
+
+// The UART clock the firmware sets up by default, used if the mailbox
+// query fails
+#define PL011_DEFAULT_CLOCK  48000000
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       pl011_init
+//
+//  Arguments:      baud:     The baud rate, up to the UART clock / 16
+//                            (3 Mbaud with the default 48 MHz clock)
+//
+//  Returns:        void
+//
+//  Description:    This function maps UART0 to GPIO pins 14 and 15 and sets
+//                  it up for 8 data bits, no parity, 1 stop bit, with the
+//                  FIFOs enabled and all interrupts masked.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void pl011_init(unsigned int baud)
+{
+    static const struct gpio_pin_config uartPins[] = {
+        {14, GPIO_ALT0, GPIO_PULL_NONE},
+        {15, GPIO_ALT0, GPIO_PULL_NONE},
+    };
+    unsigned int clock, divisor;
+
+
+    // Disable the UART while it is set up, and let it finish sending
+    mmio_write(UART0_CR, 0);
+    while (mmio_read(UART0_FR) & FR_BUSY)
+        ;
+
+    // Set GPIO pins 14 and 15 to alternate function 0 (TXD0 and RXD0)
+    gpio_configure(uartPins, 2);
+
+    // The baud rate divisor is clock / (16 * baud), as an integer part and
+    // a fractional part in 64ths, rounded to the nearest 64th
+    clock = mailbox_get_clock_rate(CLOCK_UART);
+    if (clock == 0) {
+        clock = PL011_DEFAULT_CLOCK;
+    }
+    divisor = (unsigned int)(((unsigned long)clock * 4 + baud / 2) / baud);
+
+    mmio_write(UART0_ICR, 0x7FF);
+    mmio_write(UART0_IBRD, divisor >> 6);
+    mmio_write(UART0_FBRD, divisor & 0x3F);
+
+    // 8 data bits (WLEN = 11) with the FIFOs enabled (FEN). Writing LCRH
+    // after the divisors latches them.
+    mmio_write(UART0_LCRH, (0x3 << 5) | (1 << 4));
+
+    // Mask all interrupts, and enable the UART, its transmitter and its
+    // receiver
+    mmio_write(UART0_IMSC, 0);
+    mmio_write(UART0_CR, (1 << 9) | (1 << 8) | 1);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       pl011_putc
+//
+//  Arguments:      c:     The character to send
+//
+//  Returns:        void
+//
+//  Description:    This function waits until the transmit FIFO has room,
+//                  and then puts the character in it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void pl011_putc(unsigned int c)
+{
+    while (mmio_read(UART0_FR) & FR_TXFF) {
+        asm volatile("nop");
+    }
+    mmio_write(UART0_DR, c);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       pl011_getc
+//
+//  Arguments:      none
+//
+//  Returns:        The next received character, untranslated.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int pl011_getc()
+{
+    while (mmio_read(UART0_FR) & FR_RXFE) {
+        asm volatile("nop");
+    }
+    return mmio_read(UART0_DR) & 0xFF;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       pl011_rx_ready
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE (non-zero) if a received character is waiting in the
+//                  receive FIFO.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int pl011_rx_ready()
+{
+    return !(mmio_read(UART0_FR) & FR_RXFE);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       pl011_tx_ready
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE (non-zero) if the transmit FIFO has room for a
+//                  character.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int pl011_tx_ready()
+{
+    return !(mmio_read(UART0_FR) & FR_TXFF);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       pl011_write
+//
+//  Arguments:      buffer:   The bytes to send
+//                  length:   The number of bytes
+//
+//  Returns:        void
+//
+//  Description:    This function sends raw bytes in bursts: it waits until
+//                  the transmit FIFO is empty, and then writes up to a
+//                  whole FIFO's worth without reading the flag register
+//                  again.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void pl011_write(unsigned char *buffer, unsigned int length)
+{
+    unsigned int burst;
+
+
+    while (length > 0) {
+        while (!(mmio_read(UART0_FR) & FR_TXFE)) {
+            asm volatile("nop");
+        }
+
+        burst = length < PL011_FIFO_SIZE ? length : PL011_FIFO_SIZE;
+        length -= burst;
+        while (burst--) {
+            mmio_write(UART0_DR, *buffer++);
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       pl011_puts
+//
+//  Arguments:      s:     The string to send
+//
+//  Returns:        void
+//
+//  Description:    This function sends a string in bursts, the same way as
+//                  pl011_write(), with a carriage return sent before every
+//                  newline.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void pl011_puts(char *s)
+{
+    unsigned int space;
+
+
+    while (*s) {
+        while (!(mmio_read(UART0_FR) & FR_TXFE)) {
+            asm volatile("nop");
+        }
+
+        // A newline takes two entries, so stop one short of a full FIFO
+        // if the next character would not fit with its carriage return
+        space = PL011_FIFO_SIZE;
+        while (*s && space > 0) {
+            if (*s == '\n') {
+                if (space < 2) {
+                    break;
+                }
+                mmio_write(UART0_DR, '\r');
+                space--;
+            }
+            mmio_write(UART0_DR, *s++);
+            space--;
+        }
+    }
+}
@@ -0,0 +1,22 @@
+// The PL011 UART (UART0). Its baud rate is derived from the UART clock
+// reported by the firmware, which does not follow the core clock, so it
+// supports rates up to 3 Mbaud. Writes fill the 16-byte transmit FIFO on
+// each status check instead of polling once per byte. Build with
+// 'make UART_BACKEND=UART_PL011' to use it for the console (see uart.h).
+
+#ifndef PL011_H
+#define PL011_H
+
+// Size of the transmit and receive FIFOs
+#define PL011_FIFO_SIZE  16
+
+// Function prototypes
+void pl011_init(unsigned int baud);
+void pl011_putc(unsigned int c);
+unsigned int pl011_getc();
+int pl011_rx_ready();
+int pl011_tx_ready();
+void pl011_write(unsigned char *buffer, unsigned int length);
+void pl011_puts(char *s);
+
+#endif
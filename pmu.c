@@ -0,0 +1,82 @@
+// The functions in this file read the Cortex-A53 performance monitors. Qemu
+// emulates the cycle counter and the instructions-retired event; run with
+// -icount both become deterministic, which is what the benchmark harness
+// (tools/bench.py) relies on.
+
+#include "pmu.h"
+
+
+// PMCR_EL0 bits: enable, reset the event counters, and reset the cycle
+// counter. The D bit is left clear, so every cycle is counted.
+#define PMCR_E      (1 << 0)
+#define PMCR_P      (1 << 1)
+#define PMCR_C      (1 << 2)
+
+// The architectural event number of instructions retired
+#define PMU_INST_RETIRED  0x08
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       pmu_init
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function sets event counter 0 to count retired
+//                  instructions, resets the counters, and starts both it and
+//                  the cycle counter.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void pmu_init()
+{
+    asm volatile("msr pmevtyper0_el0, %0" :: "r"((unsigned long)PMU_INST_RETIRED));
+    asm volatile("msr pmccfiltr_el0, %0" :: "r"(0UL));
+    asm volatile("msr pmcntenset_el0, %0" :: "r"((1UL << 31) | 1));
+    asm volatile("msr pmcr_el0, %0; isb" :: "r"((unsigned long)(PMCR_E | PMCR_P | PMCR_C)));
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       pmu_cycles
+//
+//  Arguments:      none
+//
+//  Returns:        The cycle counter.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned long pmu_cycles()
+{
+    unsigned long cycles;
+
+    asm volatile("isb; mrs %0, pmccntr_el0" : "=r"(cycles) :: "memory");
+    return cycles;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       pmu_instructions
+//
+//  Arguments:      none
+//
+//  Returns:        The number of instructions retired. The counter is 32
+//                  bits wide, so intervals must be measured by subtracting
+//                  two readings as 32-bit values.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned long pmu_instructions()
+{
+    unsigned long instructions;
+
+    asm volatile("isb; mrs %0, pmevcntr0_el0" : "=r"(instructions) :: "memory");
+    return instructions;
+}
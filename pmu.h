@@ -0,0 +1,7 @@
+// The ARM performance monitors of the calling core: the cycle counter, and
+// one event counter set up to count retired instructions.
+
+// Function prototypes
+void pmu_init();
+unsigned long pmu_cycles();
+unsigned long pmu_instructions();
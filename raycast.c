@@ -0,0 +1,662 @@
+// The functions in this file draw a first-person view of the maze. A ray is
+// cast through every screen column with a digital differential analyser
+// (DDA), which steps from square to square until it reaches a wall. The
+// distance to the wall gives the height of the wall slice in that column,
+// and where the ray hit the wall gives the texture column to draw it with.
+//
+// The screen is split into three bands of columns, one for each of cores
+// 1 - 3. Each core casts the rays for its own columns, and then fills its
+// band in row order, four pixels at a time, with NEON (Advanced SIMD)
+// vector operations: the wall/ceiling/floor selection, the texture
+// coordinates and the distance shading are all done for four columns at
+// once, and the result is written with one 16-byte store. The vectors are
+// written with the GCC vector extensions, since arm_neon.h is not available
+// without the standard include directories; GCC compiles them to the same
+// NEON instructions.
+
+#include "framebuffer.h"
+#include "game.h"
+#include "smp.h"
+#include "raycast.h"
+#include "trace.h"
+
+
+// Vectors of four 32-bit lanes, which map onto the NEON Q registers
+typedef unsigned int u32x4 __attribute__((vector_size(16)));
+typedef int i32x4 __attribute__((vector_size(16)));
+
+// Textures are 64 x 64 pixels, stored column by column so that a wall slice
+// reads one contiguous column
+#define TEXTURE_SIZE    64
+
+// Width of the view plane relative to the facing vector. 0.66 gives a field
+// of view of about 66 degrees.
+#define PLANE_SCALE     0.66f
+
+// Rays closer than this are treated as being this far, which limits the
+// height of a wall slice
+#define MIN_DISTANCE    0.05f
+
+// Colors of the ceiling and floor, and of the textures (0x00RRGGBB)
+#define CEILING_COLOR   0x00303040
+#define FLOOR_COLOR     0x00606060
+#define BRICK_COLOR     0x00A04030
+#define MORTAR_COLOR    0x00C0C0C0
+#define EXIT_COLOR      0x0000C000
+#define EXIT_LINE_COLOR 0x00008000
+
+// The cosine and sine of a 90 / RAYCAST_STEPS (11.25) degree turn
+#define TURN_COS        0.98078528f
+#define TURN_SIN        0.19509032f
+
+// The textures, in the frame buffer's pixel format
+static unsigned int brickTexture[TEXTURE_SIZE * TEXTURE_SIZE];
+static unsigned int exitTexture[TEXTURE_SIZE * TEXTURE_SIZE];
+static unsigned int ceilingPixel, floorPixel;
+
+// The camera: the position in squares, the facing vector and the view
+// plane. The camera being animated towards is kept as a target position
+// and facing, and the number of animation steps left.
+static float cameraX, cameraY, facingX, facingY, planeX, planeY;
+static float moveX, moveY;
+static int targetX, targetY, targetDX, targetDY;
+static int turnDirection, turnSteps, moveSteps;
+
+// The result of casting the ray through each column. colTop and colBottom
+// are the first and last + 1 rows of the wall slice, colTexPos is the texture
+// row at colTop in 16.16 fixed point and colStep is the texture rows per
+// screen row. colTexel points to the texture column of the slice, and
+// colShade is the brightness it is drawn with (0 - 256). These are read four
+// columns at a time, so they are aligned for vector loads.
+static int colTop[RAYCAST_MAX_WIDTH] __attribute__((aligned(16)));
+static int colBottom[RAYCAST_MAX_WIDTH] __attribute__((aligned(16)));
+static int colTexPos[RAYCAST_MAX_WIDTH] __attribute__((aligned(16)));
+static int colStep[RAYCAST_MAX_WIDTH] __attribute__((aligned(16)));
+static unsigned int colShade[RAYCAST_MAX_WIDTH] __attribute__((aligned(16)));
+static unsigned int *colTexel[RAYCAST_MAX_WIDTH];
+
+// Number of columns drawn, which is the frame buffer width limited to the
+// size of the tables above
+static int viewWidth;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       raycast_init
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE (non-zero) if the view can be drawn in the current
+//                  frame buffer format.
+//
+//  Description:    This function builds the textures in the frame buffer's
+//                  pixel format. The brick texture has rows of bricks with
+//                  offset joints, and the exit (seen through the open end
+//                  of the maze) is green with horizontal lines.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int raycast_init()
+{
+    unsigned int brick, mortar, exit, exitLine;
+    int x, y, row, joint;
+
+
+    if (frameBufferDepth != 32) {
+        return 0;
+    }
+
+    viewWidth = frameBufferWidth;
+    if (viewWidth > RAYCAST_MAX_WIDTH) {
+        viewWidth = RAYCAST_MAX_WIDTH;
+    }
+
+    brick = fb_color(BRICK_COLOR);
+    mortar = fb_color(MORTAR_COLOR);
+    exit = fb_color(EXIT_COLOR);
+    exitLine = fb_color(EXIT_LINE_COLOR);
+    ceilingPixel = fb_color(CEILING_COLOR);
+    floorPixel = fb_color(FLOOR_COLOR);
+
+    for (x = 0; x < TEXTURE_SIZE; x++) {
+        for (y = 0; y < TEXTURE_SIZE; y++) {
+            // Bricks are 16 rows high and 32 columns wide, and every
+            // other row of bricks is offset by half a brick
+            row = y / 16;
+            joint = (x + (row & 1) * 16) % 32;
+            brickTexture[x * TEXTURE_SIZE + y] =
+                (y % 16 == 0 || joint == 0) ? mortar : brick;
+
+            exitTexture[x * TEXTURE_SIZE + y] = (y % 8 == 0) ? exitLine : exit;
+        }
+    }
+
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       raycast_set_pose
+//
+//  Arguments:      x, y:     The square the camera stands in
+//                  dx, dy:   The direction the camera faces, which must be
+//                            one of the four compass directions
+//
+//  Returns:        void
+//
+//  Description:    This function places the camera in the middle of a square
+//                  without animating, and stops any animation in progress.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void raycast_set_pose(int x, int y, int dx, int dy)
+{
+    targetX = x;
+    targetY = y;
+    targetDX = dx;
+    targetDY = dy;
+
+    cameraX = x + 0.5f;
+    cameraY = y + 0.5f;
+    facingX = dx;
+    facingY = dy;
+    planeX = -facingY * PLANE_SCALE;
+    planeY = facingX * PLANE_SCALE;
+
+    turnSteps = 0;
+    moveSteps = 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       raycast_move_to
+//
+//  Arguments:      x, y:     The square to move the camera to
+//
+//  Returns:        void
+//
+//  Description:    This function starts moving the camera to the middle of
+//                  the given square over RAYCAST_STEPS frames.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void raycast_move_to(int x, int y)
+{
+    if (x == targetX && y == targetY) {
+        return;
+    }
+
+    targetX = x;
+    targetY = y;
+    moveX = (x + 0.5f - cameraX) / RAYCAST_STEPS;
+    moveY = (y + 0.5f - cameraY) / RAYCAST_STEPS;
+    moveSteps = RAYCAST_STEPS;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       raycast_turn
+//
+//  Arguments:      direction:   1 to turn right (clockwise on the map), or
+//                               -1 to turn left
+//
+//  Returns:        void
+//
+//  Description:    This function starts a 90 degree turn of the camera over
+//                  RAYCAST_STEPS frames.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void raycast_turn(int direction)
+{
+    int dx = targetDX;
+
+    // The map's y axis points down, so turning right takes (1, 0) to (0, 1)
+    targetDX = -targetDY * direction;
+    targetDY = dx * direction;
+
+    turnDirection = direction;
+    turnSteps = RAYCAST_STEPS;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       raycast_facing
+//
+//  Arguments:      dx, dy:   Set to the compass direction the camera faces,
+//                            or will face once the current turn is done
+//
+//  Returns:        void
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void raycast_facing(int *dx, int *dy)
+{
+    *dx = targetDX;
+    *dy = targetDY;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       raycast_hash
+//
+//  Arguments:      hash:     A 32-bit FNV-1a hash
+//
+//  Returns:        The hash with the camera state added to it.
+//
+//  Description:    This function adds the camera, the camera it is being
+//                  animated towards and the animation steps left to a hash
+//                  of the game state, so that a replay whose view drifts
+//                  does not match its recording. The floating-point values
+//                  are hashed bit for bit.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int raycast_hash(unsigned int hash)
+{
+    union {
+        float f;
+        unsigned int u;
+    } bits[6];
+    int state[7], i;
+
+
+    bits[0].f = cameraX;
+    bits[1].f = cameraY;
+    bits[2].f = facingX;
+    bits[3].f = facingY;
+    bits[4].f = planeX;
+    bits[5].f = planeY;
+    for (i = 0; i < 6; i++) {
+        hash = (hash ^ bits[i].u) * 16777619u;
+    }
+
+    state[0] = targetX;
+    state[1] = targetY;
+    state[2] = targetDX;
+    state[3] = targetDY;
+    state[4] = turnDirection;
+    state[5] = turnSteps;
+    state[6] = moveSteps;
+    for (i = 0; i < 7; i++) {
+        hash = (hash ^ (unsigned int)state[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       raycast_busy
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE (non-zero) while a move or turn is being animated.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int raycast_busy()
+{
+    return turnSteps > 0 || moveSteps > 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       raycast_update
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE (non-zero) if the camera changed, and the view
+//                  needs to be drawn again.
+//
+//  Description:    This function advances the camera animation by one frame.
+//                  A turn rotates the facing vector by 90 / RAYCAST_STEPS
+//                  degrees per frame, and its last step snaps the vector to
+//                  the exact compass direction, so rounding errors do not
+//                  build up. A move works the same way.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int raycast_update()
+{
+    float x, sin;
+    int changed = 0;
+
+
+    if (turnSteps > 0) {
+        turnSteps--;
+        if (turnSteps == 0) {
+            facingX = targetDX;
+            facingY = targetDY;
+        } else {
+            sin = TURN_SIN * turnDirection;
+            x = facingX;
+            facingX = x * TURN_COS - facingY * sin;
+            facingY = x * sin + facingY * TURN_COS;
+        }
+        planeX = -facingY * PLANE_SCALE;
+        planeY = facingX * PLANE_SCALE;
+        changed = 1;
+    }
+
+    if (moveSteps > 0) {
+        moveSteps--;
+        if (moveSteps == 0) {
+            cameraX = targetX + 0.5f;
+            cameraY = targetY + 0.5f;
+        } else {
+            cameraX += moveX;
+            cameraY += moveY;
+        }
+        changed = 1;
+    }
+
+    return changed;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       castRay
+//
+//  Arguments:      column:   The screen column to cast the ray through
+//
+//  Returns:        void
+//
+//  Description:    This function walks the ray through the maze grid one
+//                  square boundary at a time until it enters a wall, and
+//                  fills in the column's entries in the column tables. A ray
+//                  that leaves the maze (through the entrance or the exit)
+//                  is drawn with the exit texture where it leaves.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void castRay(int column)
+{
+    float cameraPlane, rayX, rayY, deltaX, deltaY, sideX, sideY;
+    float distance, wallX, step;
+    unsigned int *texture = brickTexture;
+    int mapX, mapY, stepX, stepY, side = 0;
+    int height, lineHeight, top, bottom, texX, shade;
+
+
+    height = frameBufferHeight;
+
+    // The ray through this column, from -1 at the left edge to +1 at the
+    // right edge of the view plane
+    cameraPlane = 2.0f * column / viewWidth - 1.0f;
+    rayX = facingX + planeX * cameraPlane;
+    rayY = facingY + planeY * cameraPlane;
+
+    mapX = (int)cameraX;
+    mapY = (int)cameraY;
+
+    // Distance along the ray between successive vertical and horizontal
+    // square boundaries
+    deltaX = (rayX == 0.0f) ? 1e30f : 1.0f / (rayX < 0.0f ? -rayX : rayX);
+    deltaY = (rayY == 0.0f) ? 1e30f : 1.0f / (rayY < 0.0f ? -rayY : rayY);
+
+    if (rayX < 0.0f) {
+        stepX = -1;
+        sideX = (cameraX - mapX) * deltaX;
+    } else {
+        stepX = 1;
+        sideX = (mapX + 1.0f - cameraX) * deltaX;
+    }
+    if (rayY < 0.0f) {
+        stepY = -1;
+        sideY = (cameraY - mapY) * deltaY;
+    } else {
+        stepY = 1;
+        sideY = (mapY + 1.0f - cameraY) * deltaY;
+    }
+
+    // Step to the next square boundary until the ray enters a wall
+    while (1) {
+        if (sideX < sideY) {
+            sideX += deltaX;
+            mapX += stepX;
+            side = 0;
+        } else {
+            sideY += deltaY;
+            mapY += stepY;
+            side = 1;
+        }
+
+        if (mapX < 0 || mapX >= MAZE_WIDTH || mapY < 0 || mapY >= MAZE_HEIGHT) {
+            texture = exitTexture;
+            break;
+        }
+        if (maze[mapY][mapX] == 1) {
+            break;
+        }
+    }
+
+    // Perpendicular distance to the wall, which avoids the fisheye effect
+    distance = (side == 0) ? sideX - deltaX : sideY - deltaY;
+    if (distance < MIN_DISTANCE) {
+        distance = MIN_DISTANCE;
+    }
+
+    lineHeight = (int)(height / distance);
+    top = height / 2 - lineHeight / 2;
+    bottom = top + lineHeight;
+
+    // Where along the wall the ray hit, as a texture column
+    wallX = (side == 0) ? cameraY + distance * rayY : cameraX + distance * rayX;
+    wallX -= (int)wallX;
+    texX = (int)(wallX * TEXTURE_SIZE);
+    if ((side == 0 && rayX > 0.0f) || (side == 1 && rayY < 0.0f)) {
+        texX = TEXTURE_SIZE - 1 - texX;
+    }
+
+    // Texture rows per screen row, and the texture row at the first
+    // visible row of the slice
+    step = (float)TEXTURE_SIZE / lineHeight;
+    if (top < 0) {
+        colTexPos[column] = (int)(-top * step * 65536.0f);
+        top = 0;
+    } else {
+        colTexPos[column] = 0;
+    }
+    if (bottom > height) {
+        bottom = height;
+    }
+
+    // Walls fade with distance, and walls facing north or south are
+    // darker, which makes the corners easier to see
+    shade = (int)(256.0f / (1.0f + distance * 0.15f));
+    if (side == 1) {
+        shade = shade * 3 / 4;
+    }
+
+    colTop[column] = top;
+    colBottom[column] = bottom;
+    colStep[column] = (int)(step * 65536.0f);
+    colShade[column] = shade;
+    colTexel[column] = texture + (texX & (TEXTURE_SIZE - 1)) * TEXTURE_SIZE;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       shadePixels
+//
+//  Arguments:      pixels:   Four pixels
+//                  shade:    Brightness of each pixel (0 - 256)
+//
+//  Returns:        The pixels with every color channel scaled by its shade.
+//
+//  Description:    The red and blue channels are scaled together and the
+//                  green (and alpha) channels together, so no channel can
+//                  overflow into its neighbour.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) u32x4 shadePixels(u32x4 pixels,
+                                                               u32x4 shade)
+{
+    u32x4 redBlue = ((pixels & 0x00FF00FF) * shade >> 8) & 0x00FF00FF;
+    u32x4 green = (((pixels >> 8) & 0x00FF00FF) * shade) & 0xFF00FF00;
+
+    return redBlue | green;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillBand
+//
+//  Arguments:      first:    The first column of the band (a multiple of 4)
+//                  last:     The last column + 1
+//
+//  Returns:        void
+//
+//  Description:    This function draws the columns of a band in row order.
+//                  For each group of four columns it works out which of the
+//                  four pixels are wall, looks up their texels, shades them
+//                  and selects them over the ceiling or floor color, and
+//                  stores the four pixels at once. Any columns left over
+//                  when the band is not a multiple of four wide are drawn
+//                  one at a time.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void fillBand(int first, int last)
+{
+    unsigned int *row;
+    u32x4 texels, background;
+    i32x4 y4, inWall, texY;
+    int x, y, height, vectorLast, texRow;
+
+
+    height = frameBufferHeight;
+
+    // The 16-byte stores need 16-byte aligned rows
+    vectorLast = first;
+    if ((((unsigned long)frameBuffer | frameBufferPitch) & 15) == 0) {
+        vectorLast = first + ((last - first) & ~3);
+    }
+
+    for (y = 0; y < height; y++) {
+        row = (unsigned int *)(frameBuffer + y * frameBufferPitch);
+        background = (u32x4){0, 0, 0, 0} + (y < height / 2 ? ceilingPixel : floorPixel);
+        y4 = (i32x4){y, y, y, y};
+
+        for (x = first; x < vectorLast; x += 4) {
+            inWall = (y4 >= *(i32x4 *)&colTop[x]) & (y4 < *(i32x4 *)&colBottom[x]);
+
+            // Texture row of each pixel, wrapped so that pixels outside the
+            // slice still index inside the texture
+            texY = ((*(i32x4 *)&colTexPos[x] +
+                     (y4 - *(i32x4 *)&colTop[x]) * *(i32x4 *)&colStep[x]) >> 16) &
+                   (TEXTURE_SIZE - 1);
+
+            // NEON has no gather load, so the texels are fetched one lane at
+            // a time
+            texels = (u32x4){colTexel[x][texY[0]], colTexel[x + 1][texY[1]],
+                             colTexel[x + 2][texY[2]], colTexel[x + 3][texY[3]]};
+            texels = shadePixels(texels, *(u32x4 *)&colShade[x]);
+
+            *(u32x4 *)&row[x] = (texels & (u32x4)inWall) | (background & ~(u32x4)inWall);
+        }
+
+        for (x = vectorLast; x < last; x++) {
+            if (y >= colTop[x] && y < colBottom[x]) {
+                texRow = ((colTexPos[x] + (y - colTop[x]) * colStep[x]) >> 16) &
+                         (TEXTURE_SIZE - 1);
+                texels = shadePixels((u32x4){colTexel[x][texRow], 0, 0, 0},
+                                     (u32x4){colShade[x], 0, 0, 0});
+                row[x] = texels[0];
+            } else {
+                row[x] = background[0];
+            }
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       renderBand
+//
+//  Arguments:      core:     The core running the job (1 - 3), which picks
+//                            the band
+//                  arg:      Unused
+//
+//  Returns:        void
+//
+//  Description:    This is the job run by smp_run_parallel(). The view is
+//                  split into three bands, each a multiple of four columns
+//                  wide except possibly the last. The core casts the rays
+//                  for its band and then fills it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void renderBand(int core, void *arg)
+{
+    int bandWidth, first, last, x;
+
+
+    TRACE_BEGIN(TRACE_RAYCAST);
+
+    bandWidth = ((viewWidth + 2) / 3 + 3) & ~3;
+    first = (core - 1) * bandWidth;
+    last = first + bandWidth;
+    if (last > viewWidth) {
+        last = viewWidth;
+    }
+
+    for (x = first; x < last; x++) {
+        castRay(x);
+    }
+    fillBand(first, last);
+
+    TRACE_END(TRACE_RAYCAST);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       raycast_render
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function draws the view from the current camera,
+//                  with the work split over cores 1 - 3. It returns once the
+//                  whole view has been drawn.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void raycast_render()
+{
+    if (viewWidth == 0) {
+        return;
+    }
+
+    TRACE_BEGIN(TRACE_RAYCAST);
+    smp_run_parallel(renderBand, 0);
+    TRACE_END(TRACE_RAYCAST);
+}
@@ -0,0 +1,24 @@
+// First-person view of the maze, drawn by casting one ray per screen column.
+// The view is only available in 32 bits per pixel.
+
+#ifndef RAYCAST_H
+#define RAYCAST_H
+
+// Widest frame buffer the per-column tables can hold
+#define RAYCAST_MAX_WIDTH  1024
+
+// Number of frames a move or a 90 degree turn is animated over
+#define RAYCAST_STEPS      8
+
+// Function prototypes
+int raycast_init();
+void raycast_set_pose(int x, int y, int dx, int dy);
+void raycast_move_to(int x, int y);
+void raycast_turn(int direction);
+void raycast_facing(int *dx, int *dy);
+unsigned int raycast_hash(unsigned int hash);
+int raycast_busy();
+int raycast_update();
+void raycast_render();
+
+#endif
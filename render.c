@@ -0,0 +1,104 @@
+// The functions in this file draw the whole maze in scanline order. Drawing
+// one square at a time jumps a square's height in rows of pitch between
+// squares, which defeats the write-combining of frame buffer stores.
+// Instead, for each row of squares we build a list of color spans once,
+// merging neighbouring squares of the same color, and then emit those spans
+// on all tileSize pixel rows of the band, top to bottom. A row of identical
+// squares becomes one long run of contiguous stores, so a full repaint is
+// limited by memory bandwidth rather than by loop overhead. When the square
+// size does not divide the frame buffer, the right and bottom edges beyond
+// the maze are left alone; layoutMaze() clears them once.
+//
+// Without the fog of war every square is drawn in its own color, so the
+// runs are the ones tools/genlevel.py worked out from the level, and only
+// need scaling to the square size.
+
+#include "framebuffer.h"
+#include "game.h"
+#include "render.h"
+#include "trace.h"
+
+
+// The span list for one row of squares. There can be no more spans than
+// squares in the row.
+static struct fb_span renderSpans[MAZE_WIDTH];
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       buildSpans
+//
+//  Arguments:      y:     The row of squares
+//
+//  Returns:        The number of spans in renderSpans.
+//
+//  Description:    This function run-length encodes one row of squares into
+//                  color spans, in pixels.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int buildSpans(int y)
+{
+    const struct maze_run *run;
+    unsigned int color;
+    int x, count = 0;
+
+
+    if (!fogOfWar) {
+        for (run = &mazeRuns[mazeRowRuns[y]]; run < &mazeRuns[mazeRowRuns[y + 1]]; run++) {
+            renderSpans[count].x = run->x * tileSize;
+            renderSpans[count].width = run->width * tileSize;
+            renderSpans[count].color = squarePixel[run->square];
+            count++;
+        }
+        return count;
+    }
+
+    for (x = 0; x < MAZE_WIDTH; x++) {
+        color = cellPixel(x, y);
+
+        if (count > 0 && renderSpans[count - 1].color == color) {
+            // Same color as the square to the left, so extend its span
+            renderSpans[count - 1].width += tileSize;
+        } else {
+            renderSpans[count].x = x * tileSize;
+            renderSpans[count].width = tileSize;
+            renderSpans[count].color = color;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       render_maze
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function repaints every square of the maze, walking
+//                  the frame buffer from the top down one band of squares at
+//                  a time.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void render_maze()
+{
+    int y, count;
+
+
+    TRACE_BEGIN(TRACE_RENDER_MAZE);
+
+    for (y = 0; y < MAZE_HEIGHT; y++) {
+        count = buildSpans(y);
+        fb_fill_spans(y * tileSize, tileSize, renderSpans, count);
+    }
+
+    TRACE_END(TRACE_RENDER_MAZE);
+}
@@ -0,0 +1,2 @@
+// Function prototypes for the scanline-ordered maze renderer
+void render_maze();
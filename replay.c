@@ -0,0 +1,568 @@
+// The functions in this file implement the input recorder described in
+// replay.h. Each change of a controller's state is encoded as two
+// variable-length integers (7 bits per byte, low bits first):
+//
+//     (frames since the previous change) * 4 + controller number
+//     old state XOR new state
+//
+// A button press or release usually changes one bit on a frame close to
+// the previous change, so most changes take two or three bytes. Frames
+// are counted from the start of the recording by replay_end_frame(), which
+// the game calls once per frame after updating its state.
+//
+// The export format is, with all integers little-endian:
+//
+//     "RPLY"                          magic
+//     u32 version (1)
+//     u32 number of frames recorded
+//     u32 game state hash after the last frame
+//     u32 length of the encoded changes, then the changes
+
+#include "uart.h"
+#include "clock.h"
+#include "task.h"
+#include "replay.h"
+
+
+// Recorder modes
+#define REPLAY_IDLE       0
+#define REPLAY_RECORDING  1
+#define REPLAY_PLAYING    2
+
+// Most bytes one change can take (two 32-bit variable-length integers)
+#define REPLAY_MAX_CHANGE 10
+
+// Longest wait for an import to start before it is abandoned, and the
+// interval at which the UART is checked in the meantime. Once it has
+// started, the bytes are polled for without sleeping, since the Mini UART
+// receive FIFO holds less than a millisecond of data, and the import is
+// abandoned if they stop for REPLAY_IMPORT_GAP_US.
+#define REPLAY_IMPORT_TIMEOUT_US  10000000
+#define REPLAY_IMPORT_POLL_US     1000
+#define REPLAY_IMPORT_GAP_US      100000
+
+// The recording
+static unsigned char replayBuffer[REPLAY_BUFFER_SIZE];
+static unsigned int replayLength;     // Bytes of replayBuffer in use
+static unsigned int replayFrames;     // Frames recorded
+static int replayImporting;           // TRUE once an import's bytes arrive
+static unsigned int replayHash;       // Game state hash after the last frame
+
+// The recording or replay in progress
+static int replayMode = REPLAY_IDLE;
+static unsigned int replayFrame;      // Frames since the start
+static unsigned int replayLastFrame;  // Frame of the previous change
+static unsigned int replayPosition;   // Next byte to decode
+static unsigned int replayRunningHash;
+static unsigned short replayState[REPLAY_PADS];
+
+// The next change to replay, decoded ahead of time
+static int replayPending;
+static unsigned int replayPendingFrame, replayPendingPad, replayPendingXor;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       putVarint / getVarint
+//
+//  Description:    These functions append a variable-length integer to the
+//                  recording, and decode the one at replayPosition.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void putVarint(unsigned int value)
+{
+    while (value >= 0x80) {
+        replayBuffer[replayLength++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    replayBuffer[replayLength++] = value;
+}
+
+static unsigned int getVarint()
+{
+    unsigned int value = 0, shift = 0, byte;
+
+    do {
+        byte = replayBuffer[replayPosition++];
+        value |= (byte & 0x7F) << shift;
+        shift += 7;
+    } while ((byte & 0x80) && replayPosition < replayLength);
+
+    return value;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       decodeNext
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function decodes the next change of the recording
+//                  into replayPending*, if there is one.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void decodeNext()
+{
+    unsigned int first;
+
+
+    if (replayPosition >= replayLength) {
+        replayPending = 0;
+        return;
+    }
+
+    first = getVarint();
+    replayPendingFrame = replayLastFrame + (first >> 2);
+    replayPendingPad = first & 0x3;
+    replayPendingXor = getVarint();
+    replayLastFrame = replayPendingFrame;
+    replayPending = 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       startSession
+//
+//  Arguments:      mode:     REPLAY_RECORDING or REPLAY_PLAYING
+//
+//  Returns:        void
+//
+//  Description:    Recording and replay both start with every button
+//                  released, on frame 0.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void startSession(int mode)
+{
+    int p;
+
+
+    for (p = 0; p < REPLAY_PADS; p++) {
+        replayState[p] = 0;
+    }
+    replayFrame = 0;
+    replayLastFrame = 0;
+    replayPosition = 0;
+    replayRunningHash = 2166136261u;
+    replayMode = mode;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       replay_record_start
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function discards the previous recording and starts
+//                  a new one. The caller resets the game state first.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void replay_record_start()
+{
+    replayLength = 0;
+    replayFrames = 0;
+    replayHash = 0;
+    startSession(REPLAY_RECORDING);
+
+    uart_puts("Recording input\n");
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       replay_record_stop
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void replay_record_stop()
+{
+    if (replayMode != REPLAY_RECORDING) {
+        return;
+    }
+
+    replayFrames = replayFrame;
+    replayHash = replayRunningHash;
+    replayMode = REPLAY_IDLE;
+
+    uart_puts("Recorded ");
+    uart_putdec(replayFrames);
+    uart_puts(" frames in ");
+    uart_putdec(replayLength);
+    uart_puts(" bytes\n");
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       replay_play_start
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE (non-zero) if the replay started, or FALSE if there
+//                  is nothing to replay.
+//
+//  Description:    This function starts replaying the recording. The caller
+//                  resets the game state first, the same way it did when the
+//                  recording started.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int replay_play_start()
+{
+    if (replayFrames == 0) {
+        uart_puts("Nothing to replay\n");
+        return 0;
+    }
+
+    startSession(REPLAY_PLAYING);
+    decodeNext();
+
+    uart_puts("Replaying ");
+    uart_putdec(replayFrames);
+    uart_puts(" frames\n");
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       replay_play_stop
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void replay_play_stop()
+{
+    if (replayMode == REPLAY_PLAYING) {
+        replayMode = REPLAY_IDLE;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       replay_recording / replay_playing
+//
+//  Returns:        TRUE (non-zero) while recording, or while replaying.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int replay_recording()
+{
+    return replayMode == REPLAY_RECORDING;
+}
+
+int replay_playing()
+{
+    return replayMode == REPLAY_PLAYING;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       replay_input
+//
+//  Arguments:      data:     The button state of every controller
+//                  pads:     Number of controllers
+//
+//  Returns:        void
+//
+//  Description:    This function is called with every frame's controller
+//                  state, straight after sampling. While recording, the
+//                  changes are stored; recording stops if the buffer is
+//                  full. While replaying, the sampled state is replaced with
+//                  the recorded one.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void replay_input(unsigned short *data, int pads)
+{
+    int p;
+
+
+    if (pads > REPLAY_PADS) {
+        pads = REPLAY_PADS;
+    }
+
+    if (replayMode == REPLAY_RECORDING) {
+        for (p = 0; p < pads; p++) {
+            if (data[p] == replayState[p]) {
+                continue;
+            }
+            if (replayLength + REPLAY_MAX_CHANGE > REPLAY_BUFFER_SIZE) {
+                uart_puts("Replay buffer full\n");
+                replay_record_stop();
+                return;
+            }
+
+            putVarint(((replayFrame - replayLastFrame) << 2) | p);
+            putVarint(data[p] ^ replayState[p]);
+            replayLastFrame = replayFrame;
+            replayState[p] = data[p];
+        }
+    } else if (replayMode == REPLAY_PLAYING) {
+        while (replayPending && replayPendingFrame == replayFrame) {
+            replayState[replayPendingPad] ^= replayPendingXor;
+            decodeNext();
+        }
+        for (p = 0; p < pads; p++) {
+            data[p] = replayState[p];
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       replay_end_frame
+//
+//  Arguments:      stateHash:   A hash of the game state after this frame
+//
+//  Returns:        void
+//
+//  Description:    This function is called once per frame after the game
+//                  state has been updated. The frame's hash is folded into
+//                  a running FNV-1a hash. When a replay reaches the end of
+//                  the recording, the two hashes are compared.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void replay_end_frame(unsigned int stateHash)
+{
+    int i;
+
+
+    if (replayMode == REPLAY_IDLE) {
+        return;
+    }
+
+    for (i = 0; i < 4; i++) {
+        replayRunningHash = (replayRunningHash ^ ((stateHash >> (i * 8)) & 0xFF)) *
+                            16777619u;
+    }
+    replayFrame++;
+
+    if (replayMode == REPLAY_PLAYING && replayFrame >= replayFrames) {
+        replayMode = REPLAY_IDLE;
+        uart_puts(replayRunningHash == replayHash ? "Replay matched\n" :
+                                                    "Replay diverged\n");
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       putWord
+//
+//  Arguments:      value:    The integer to write
+//
+//  Returns:        void
+//
+//  Description:    This function writes a 32-bit little-endian integer on
+//                  the UART.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void putWord(unsigned int value)
+{
+    unsigned char bytes[4];
+
+    bytes[0] = value;
+    bytes[1] = value >> 8;
+    bytes[2] = value >> 16;
+    bytes[3] = value >> 24;
+    uart_write(bytes, 4);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       readBytes
+//
+//  Arguments:      buffer:   Where to store the bytes
+//                  length:   Number of bytes to read
+//
+//  Returns:        TRUE (non-zero) if all the bytes arrived, or FALSE if the
+//                  import did not start within REPLAY_IMPORT_TIMEOUT_US, or
+//                  stopped for REPLAY_IMPORT_GAP_US.
+//
+//  Description:    This function reads bytes of an import from the UART.
+//                  Until the first byte arrives it sleeps between checks,
+//                  so the other tasks keep running while the user starts
+//                  the upload. After that it polls without sleeping, so
+//                  the receive FIFO cannot overflow.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int readBytes(unsigned char *buffer, unsigned int length)
+{
+    unsigned long deadline;
+    unsigned int i, count;
+
+
+    deadline = clock_now() + clock_from_us(replayImporting ?
+                                           REPLAY_IMPORT_GAP_US :
+                                           REPLAY_IMPORT_TIMEOUT_US);
+    i = 0;
+    while (i < length) {
+        // The recording is binary, so it is read raw: uart_getc() would
+        // turn any carriage return byte into a newline
+        count = uart_read(buffer + i, length - i);
+        if (count > 0) {
+            i += count;
+            replayImporting = 1;
+            deadline = clock_now() + clock_from_us(REPLAY_IMPORT_GAP_US);
+        } else if (clock_now() >= deadline) {
+            return 0;
+        } else if (!replayImporting) {
+            task_sleep_until(clock_now() + clock_from_us(REPLAY_IMPORT_POLL_US));
+        }
+    }
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       getWord
+//
+//  Arguments:      value:    Where to store the integer
+//
+//  Returns:        TRUE (non-zero) if the integer arrived, or FALSE if the
+//                  read timed out (see readBytes()).
+//
+//  Description:    This function reads a 32-bit little-endian integer from
+//                  the UART.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int getWord(unsigned int *value)
+{
+    unsigned char bytes[4];
+
+    if (!readBytes(bytes, 4)) {
+        return 0;
+    }
+    *value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) |
+             ((unsigned int)bytes[3] << 24);
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       replay_export
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the recording to the UART in the
+//                  format described at the top of this file.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void replay_export()
+{
+    uart_write((unsigned char *)"RPLY", 4);
+    putWord(1);
+    putWord(replayFrames);
+    putWord(replayHash);
+    putWord(replayLength);
+    uart_write(replayBuffer, replayLength);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       replay_import
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function reads a recording written by
+//                  replay_export() from the UART, replacing the current one.
+//                  Frames are still drawn while it waits for the upload to
+//                  start, and it gives up if the upload does not start or
+//                  stops part way (see readBytes()).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void replay_import()
+{
+    unsigned char magic[4];
+    unsigned int version, frames, hash, length;
+
+
+    replayMode = REPLAY_IDLE;
+    replayImporting = 0;
+    uart_puts("Send the recording\n");
+
+    if (!readBytes(magic, 4) || !getWord(&version)) {
+        uart_puts("No recording received\n");
+        return;
+    }
+    if (magic[0] != 'R' || magic[1] != 'P' || magic[2] != 'L' || magic[3] != 'Y' ||
+        version != 1) {
+        uart_puts("Not a recording\n");
+        return;
+    }
+
+    if (!getWord(&frames) || !getWord(&hash) || !getWord(&length)) {
+        uart_puts("Recording cut short\n");
+        return;
+    }
+    if (length > REPLAY_BUFFER_SIZE) {
+        uart_puts("Recording too long\n");
+        return;
+    }
+
+    // The buffer is overwritten from here on, so the old recording is gone
+    // even if the upload stops
+    replayFrames = 0;
+    replayLength = 0;
+    if (!readBytes(replayBuffer, length)) {
+        uart_puts("Recording cut short\n");
+        return;
+    }
+    replayFrames = frames;
+    replayHash = hash;
+    replayLength = length;
+
+    uart_puts("Loaded ");
+    uart_putdec(frames);
+    uart_puts(" frames\n");
+}
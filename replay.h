@@ -0,0 +1,29 @@
+// Deterministic input recording and replay. While recording, every change
+// of controller state is stored with the frame it happened on. A replay
+// feeds the recorded states back in place of the controllers, starting
+// from the same game state, so the game goes through the same frames
+// again. A hash of the game state after every frame is kept, so a replay
+// can tell whether it reproduced the recording exactly.
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+// Size of the buffer holding the encoded input changes
+#define REPLAY_BUFFER_SIZE  8192
+
+// Number of controllers that can be recorded
+#define REPLAY_PADS         4
+
+// Function prototypes
+void replay_record_start();
+void replay_record_stop();
+int replay_play_start();
+void replay_play_stop();
+int replay_recording();
+int replay_playing();
+void replay_input(unsigned short *data, int pads);
+void replay_end_frame(unsigned int stateHash);
+void replay_export();
+void replay_import();
+
+#endif
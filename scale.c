@@ -0,0 +1,189 @@
+// The functions in this file decide the render resolution, as described in
+// scale.h. Only the decision is made here; the game asks for the new
+// resolution with fb_set_size() and redraws at it.
+//
+// The controller looks at the slowest frame of each window of SCALE_WINDOW
+// frames rather than the average, since the frames that matter are the
+// ones that draw a lot (an animated first-person view, a full repaint), and
+// most map frames draw almost nothing. Dropping is immediate; raising
+// waits for SCALE_RAISE_AFTER windows with headroom, and the window after
+// a change is ignored since it holds the full redraw at the new size.
+
+#include "clock.h"
+#include "framebuffer.h"
+#include "scale.h"
+
+
+// The current level (0 is full resolution), and whether scaling is on
+static int scaleLevel;
+static int scaleEnabled = 1;
+
+// The slowest frame in the window so far, and the window's frame count
+static unsigned long scaleWorst;
+static unsigned int scaleFrames;
+
+// Windows with headroom in a row, and windows left to ignore
+static int scaleHeadroom, scaleSettle;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       levelArea
+//
+//  Arguments:      level:   A resolution level
+//
+//  Returns:        The level's area relative to level 0, in 16ths.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned long levelArea(int level)
+{
+    return (4 - level) * (4 - level);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       changeLevel
+//
+//  Arguments:      level:   The new level
+//
+//  Returns:        TRUE (non-zero), so callers can return it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int changeLevel(int level)
+{
+    scaleLevel = level;
+    scaleHeadroom = 0;
+    scaleSettle = 1;
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       scale_frame
+//
+//  Arguments:      ticks:   How long the frame took, in clock ticks, from
+//                           sampling the input to presenting it
+//
+//  Returns:        TRUE (non-zero) if the resolution should change. The
+//                  caller then gets the new size from scale_size().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int scale_frame(unsigned long ticks)
+{
+    unsigned long budget, worst;
+
+
+    if (!scaleEnabled) {
+        return 0;
+    }
+
+    if (ticks > scaleWorst) {
+        scaleWorst = ticks;
+    }
+    if (++scaleFrames < SCALE_WINDOW) {
+        return 0;
+    }
+
+    worst = scaleWorst;
+    scaleWorst = 0;
+    scaleFrames = 0;
+    if (scaleSettle > 0) {
+        scaleSettle--;
+        return 0;
+    }
+
+    budget = clock_from_us(SCALE_BUDGET_US);
+
+    if (worst > budget) {
+        scaleHeadroom = 0;
+        if (scaleLevel < SCALE_LEVELS - 1) {
+            return changeLevel(scaleLevel + 1);
+        }
+        return 0;
+    }
+
+    // Drawing time grows with the number of pixels, so predict the worst
+    // frame at the next level up from the ratio of the areas
+    if (scaleLevel > 0 &&
+        worst * levelArea(scaleLevel - 1) / levelArea(scaleLevel) <
+        budget * SCALE_HEADROOM / 100) {
+        if (++scaleHeadroom >= SCALE_RAISE_AFTER) {
+            return changeLevel(scaleLevel - 1);
+        }
+    } else {
+        scaleHeadroom = 0;
+    }
+
+    return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       scale_size
+//
+//  Arguments:      width, height:   Receive the current level's resolution
+//
+//  Returns:        void
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void scale_size(unsigned int *width, unsigned int *height)
+{
+    *width = FRAMEBUFFER_WIDTH * (4 - scaleLevel) / 4;
+    *height = FRAMEBUFFER_HEIGHT * (4 - scaleLevel) / 4;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       scale_set_enabled
+//
+//  Arguments:      enabled:  TRUE (non-zero) to scale the resolution with
+//                            the frame time, FALSE to keep it at full
+//                            resolution
+//
+//  Returns:        TRUE (non-zero) if the resolution should change, as for
+//                  scale_frame().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int scale_set_enabled(int enabled)
+{
+    scaleEnabled = enabled;
+    scaleWorst = 0;
+    scaleFrames = 0;
+
+    if (!enabled && scaleLevel != 0) {
+        return changeLevel(0);
+    }
+    return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       scale_enabled
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE (non-zero) while the resolution follows the frame
+//                  time.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int scale_enabled()
+{
+    return scaleEnabled;
+}
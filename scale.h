@@ -0,0 +1,34 @@
+// Dynamic resolution scaling. The render task reports how long each frame
+// took with scale_frame(). When a frame runs over the frame budget the
+// render resolution drops by one level, and when the slowest recent frame
+// would still fit the budget at the next level up, it is raised again. The
+// GPU scales the frame buffer to the display, so the picture always fills
+// the screen; only its sharpness changes.
+
+#ifndef SCALE_H
+#define SCALE_H
+
+// Number of resolution levels. Level 0 is FRAMEBUFFER_WIDTH x
+// FRAMEBUFFER_HEIGHT, and each level is a quarter narrower and shorter
+// than the one before, so the maze squares stay whole at every level.
+#define SCALE_LEVELS        3
+
+// The frame budget (60 frames per second)
+#define SCALE_BUDGET_US     16667
+
+// Frames per decision, and consecutive decisions with headroom before
+// raising the resolution
+#define SCALE_WINDOW        30
+#define SCALE_RAISE_AFTER   4
+
+// Raise the resolution only if the slowest frame of the window, scaled to
+// the higher resolution, would take less than this share of the budget
+#define SCALE_HEADROOM      75
+
+// Function prototypes
+int scale_frame(unsigned long ticks);
+void scale_size(unsigned int *width, unsigned int *height);
+int scale_set_enabled(int enabled);
+int scale_enabled();
+
+#endif
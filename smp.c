@@ -0,0 +1,213 @@
+// The functions in this file start cores 1 - 3 and hand them work. Each of
+// those cores runs secondary_main(), which sleeps with wfe until core 0
+// posts a job for it, runs the job, reports that it is done, and goes back
+// to sleep. Core 0 posts a job to every core with smp_run_parallel(), and
+// waits for all of them to finish.
+//
+// The MMU and data cache are off, so memory is not cached and every core
+// sees the others' stores directly. The job variables are volatile, and
+// data memory barriers order the stores that publish a job or its
+// completion. Only single writers are used, so no atomic instructions are
+// needed.
+
+#include "uart.h"
+#include "smp.h"
+
+// Defined in start.s
+extern volatile unsigned int smp_release;
+extern void secondary_start();
+
+// The firmware parks cores 1 - 3 in a loop that waits for an address to be
+// written into their slot of this spin table, then jumps to it
+#define SPIN_TABLE_BASE  0xD8
+
+// The job posted to each core. Core 0 writes jobFunction, jobArgument and
+// jobPosted; the core itself writes jobDone and coreOnline.
+static void (*volatile jobFunction[SMP_CORES])(int core, void *arg);
+static void *volatile jobArgument[SMP_CORES];
+static volatile unsigned int jobPosted[SMP_CORES];
+static volatile unsigned int jobDone[SMP_CORES];
+static volatile unsigned int coreOnline[SMP_CORES];
+
+void secondary_main(unsigned long core);
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       smp_core_id
+//
+//  Arguments:      none
+//
+//  Returns:        The number (0 - 3) of the core running the caller.
+//
+//  Description:    The core number is in the low 2 bits of the MP affinity
+//                  register.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int smp_core_id()
+{
+    unsigned long r;
+
+    asm volatile("mrs %0, mpidr_el1" : "=r"(r));
+    return r & 0x3;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       secondary_main
+//
+//  Arguments:      core:     The number of this core (1 - 3)
+//
+//  Returns:        Never
+//
+//  Description:    This is the main loop of cores 1 - 3. It is called from
+//                  start.s once core 0 has released the cores.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void secondary_main(unsigned long core)
+{
+    unsigned int seen = 0;
+
+
+    coreOnline[core] = 1;
+    asm volatile("dsb sy; sev" ::: "memory");
+
+    while (1) {
+        // Sleep until core 0 posts a new job
+        while (jobPosted[core] == seen) {
+            asm volatile("wfe");
+        }
+        seen = jobPosted[core];
+        asm volatile("dmb sy" ::: "memory");
+
+        jobFunction[core](core, jobArgument[core]);
+
+        // Make the job's stores visible before reporting completion
+        asm volatile("dmb sy" ::: "memory");
+        jobDone[core] = seen;
+        asm volatile("dsb sy; sev" ::: "memory");
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       smp_init
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function releases cores 1 - 3, both those waiting in
+//                  start.s and those parked by the firmware in its spin
+//                  table, and gives them a short time to come online. Cores
+//                  that do not come online are left alone, and their share
+//                  of any parallel job is run on core 0 instead.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void smp_init()
+{
+    unsigned int core, spins;
+
+
+    smp_release = 1;
+    asm volatile("dsb sy" ::: "memory");
+
+    for (core = 1; core < SMP_CORES; core++) {
+        *(volatile unsigned long *)(unsigned long)(SPIN_TABLE_BASE + core * 8) =
+            (unsigned long)secondary_start;
+    }
+    asm volatile("dsb sy; sev" ::: "memory");
+
+    // Wait for the cores to report in, giving up after a while
+    for (spins = 0; spins < 1000000 && smp_cores_online() < SMP_CORES; spins++) {
+        asm volatile("nop");
+    }
+
+    uart_puts("Cores online: ");
+    uart_putdec(smp_cores_online());
+    uart_puts("\n");
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       smp_cores_online
+//
+//  Arguments:      none
+//
+//  Returns:        The number of cores running, including core 0.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int smp_cores_online()
+{
+    unsigned int core;
+    int count = 1;
+
+    for (core = 1; core < SMP_CORES; core++) {
+        count += coreOnline[core];
+    }
+
+    return count;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       smp_run_parallel
+//
+//  Arguments:      job:     The function to run. It is called once for each
+//                           of cores 1 - 3, with that core number, so the
+//                           core number can be used to split the work.
+//                  arg:     Argument passed to every call
+//
+//  Returns:        void
+//
+//  Description:    This function runs the job on cores 1 - 3 at the same
+//                  time and waits for them all to finish. The share of a core
+//                  that is not online is run on core 0 while the others work.
+//                  It must only be called from core 0.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void smp_run_parallel(void (*job)(int core, void *arg), void *arg)
+{
+    unsigned int core;
+
+
+    // Post the job to every online core
+    for (core = 1; core < SMP_CORES; core++) {
+        if (coreOnline[core]) {
+            jobFunction[core] = job;
+            jobArgument[core] = arg;
+            asm volatile("dmb sy" ::: "memory");
+            jobPosted[core]++;
+        }
+    }
+    asm volatile("dsb sy; sev" ::: "memory");
+
+    // Do the shares of any missing cores here
+    for (core = 1; core < SMP_CORES; core++) {
+        if (!coreOnline[core]) {
+            job(core, arg);
+        }
+    }
+
+    // Wait for the other cores to finish
+    for (core = 1; core < SMP_CORES; core++) {
+        while (coreOnline[core] && jobDone[core] != jobPosted[core]) {
+            asm volatile("wfe");
+        }
+    }
+    asm volatile("dmb sy" ::: "memory");
+}
@@ -0,0 +1,9 @@
+// Multi-core support. Core 0 runs the game; cores 1 - 3 wait for jobs.
+
+#define SMP_CORES  4
+
+// Function prototypes
+void smp_init();
+int smp_cores_online();
+unsigned int smp_core_id();
+void smp_run_parallel(void (*job)(int core, void *arg), void *arg);
@@ -0,0 +1,567 @@
+// The functions in this file implement sprite overlays (see sprite.h). The
+// hardware cursor is set up with the TAG_SET_CURSOR_INFO mailbox tag, which
+// gives the firmware the cursor image, and moved with TAG_SET_CURSOR_STATE.
+// If the firmware refuses the cursor, the sprite falls back to software:
+// the pixels beneath it are saved with fb_read() before it is drawn, and put
+// back with fb_blit() before it moves.
+
+#include "mailbox.h"
+#include "framebuffer.h"
+#include "sprite.h"
+#include "trace.h"
+
+
+// The sprite that owns the hardware cursor, if any
+static struct sprite *cursorOwner;
+
+// The cursor image handed to the firmware. It is always 0xAARRGGBB, no
+// matter what format the frame buffer is in.
+static unsigned int __attribute__((aligned(16)))
+    cursorImage[SPRITE_MAX_SIZE * SPRITE_MAX_SIZE];
+
+// The software sprites, so that overlapping sprites can be repaired when
+// one of them moves, and the draw counter that orders them
+static struct sprite *spriteList[SPRITE_MAX];
+static int spriteCount;
+static unsigned int drawCounter;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       cursorSetInfo
+//
+//  Arguments:      s:     The sprite whose image to upload
+//
+//  Returns:        TRUE (non-zero) if the firmware accepted the cursor image,
+//                  FALSE (zero) otherwise.
+//
+//  Description:    This function copies the sprite's image into the cursor
+//                  image buffer, and asks the firmware to use it as the
+//                  hardware cursor. The image is passed as a bus address.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int cursorSetInfo(struct sprite *s)
+{
+    int i, n;
+
+
+    n = s->width * s->height;
+    for (i = 0; i < n; i++) {
+        cursorImage[i] = s->image ? s->image[i] : (0xFF000000 | s->rgb);
+    }
+
+    mailbox_buffer[0] = 12 * 4;
+    mailbox_buffer[1] = MAILBOX_REQUEST;
+
+    mailbox_buffer[2] = TAG_SET_CURSOR_INFO;
+    mailbox_buffer[3] = 24;
+    mailbox_buffer[4] = 24;
+    mailbox_buffer[5] = s->width;    // Response: 0 if the cursor is valid
+    mailbox_buffer[6] = s->height;
+    mailbox_buffer[7] = 0;
+    mailbox_buffer[8] = ((unsigned int)(unsigned long)cursorImage) | 0xC0000000;
+    mailbox_buffer[9] = 0;           // Hotspot x
+    mailbox_buffer[10] = 0;          // Hotspot y
+
+    mailbox_buffer[11] = TAG_LAST;
+
+    // The tag is only understood if the firmware sets the response bit in
+    // its request/response code, and the cursor only valid if it returns 0
+    return mailbox_query(CHANNEL_PROPERTY_TAGS_ARMTOVC) &&
+           (mailbox_buffer[4] & 0x80000000) && mailbox_buffer[5] == 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       cursorSetState
+//
+//  Arguments:      enable:  TRUE (non-zero) to show the cursor
+//                  x, y:    Frame buffer position of the cursor
+//
+//  Returns:        TRUE (non-zero) if the firmware accepted the request,
+//                  FALSE (zero) otherwise.
+//
+//  Description:    This function shows, hides or moves the hardware cursor.
+//                  Flag 1 means the position is in frame buffer coordinates
+//                  rather than display coordinates.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int cursorSetState(int enable, int x, int y)
+{
+    mailbox_buffer[0] = 10 * 4;
+    mailbox_buffer[1] = MAILBOX_REQUEST;
+
+    mailbox_buffer[2] = TAG_SET_CURSOR_STATE;
+    mailbox_buffer[3] = 16;
+    mailbox_buffer[4] = 16;
+    mailbox_buffer[5] = enable;      // Response: 0 if the state is valid
+    mailbox_buffer[6] = x;
+    mailbox_buffer[7] = y;
+    mailbox_buffer[8] = 1;
+
+    mailbox_buffer[9] = TAG_LAST;
+
+    return mailbox_query(CHANNEL_PROPERTY_TAGS_ARMTOVC) &&
+           mailbox_buffer[5] == 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       convertImage
+//
+//  Arguments:      s:     A software sprite
+//
+//  Returns:        void
+//
+//  Description:    This function converts the sprite's image into the frame
+//                  buffer's pixel format, once, so that drawing is a copy.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void convertImage(struct sprite *s)
+{
+    unsigned int i, n, value, bytes;
+    unsigned char *p;
+
+
+    if (!s->image) {
+        return;
+    }
+
+    bytes = frameBufferBytesPerPixel;
+    n = s->width * s->height;
+    p = s->pixels;
+
+    for (i = 0; i < n; i++) {
+        value = fb_color(s->image[i] & 0x00FFFFFF);
+        if (bytes == 4) {
+            *(unsigned int *)p = value;
+        } else if (bytes == 2) {
+            *(unsigned short *)p = value;
+        } else {
+            *p = value;
+        }
+        p += bytes;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       drawSoftware
+//
+//  Arguments:      s:     A software sprite
+//
+//  Returns:        void
+//
+//  Description:    This function draws a software sprite at its position. A
+//                  solid sprite is a single fill. An image sprite is copied
+//                  one row at a time in runs of opaque pixels, so pixels with
+//                  an alpha of 0 are left transparent.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void drawSoftware(struct sprite *s)
+{
+    int row, column, start;
+    unsigned int pitch;
+    unsigned int *source;
+
+
+    s->order = ++drawCounter;
+
+    if (!s->image) {
+        fb_fill_rect(s->y, s->x, s->width, s->height, s->pixel);
+        return;
+    }
+
+    pitch = s->width * frameBufferBytesPerPixel;
+
+    for (row = 0; row < s->height; row++) {
+        source = s->image + row * s->width;
+        column = 0;
+        while (column < s->width) {
+            // Skip transparent pixels, then find the end of the opaque run
+            while (column < s->width && (source[column] >> 24) == 0) {
+                column++;
+            }
+            start = column;
+            while (column < s->width && (source[column] >> 24) != 0) {
+                column++;
+            }
+            if (column > start) {
+                fb_blit(s->y + row, s->x + start, column - start, 1,
+                        s->pixels + row * pitch + start * frameBufferBytesPerPixel,
+                        pitch);
+            }
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       restoreSoftware
+//
+//  Arguments:      s:     A visible software sprite
+//
+//  Returns:        void
+//
+//  Description:    This function puts back the pixels that were beneath the
+//                  sprite. Any sprite drawn later that overlaps it saved some
+//                  of this sprite's pixels as its own background, so those
+//                  are replaced with what was really beneath, and the later
+//                  sprite is drawn again on top.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void restoreSoftware(struct sprite *s)
+{
+    struct sprite *o;
+    int i, row, left, right, top, bottom;
+    unsigned int bytes, length, k;
+    unsigned char *from, *to;
+
+
+    bytes = frameBufferBytesPerPixel;
+    fb_blit(s->y, s->x, s->width, s->height, s->background, s->width * bytes);
+
+    for (i = 0; i < spriteCount; i++) {
+        o = spriteList[i];
+        if (o == s || !o->visible || o->hardware || o->order < s->order) {
+            continue;
+        }
+
+        // Work out the overlap of the two sprites, if there is one
+        left = (o->x > s->x) ? o->x : s->x;
+        right = (o->x + o->width < s->x + s->width) ? o->x + o->width : s->x + s->width;
+        top = (o->y > s->y) ? o->y : s->y;
+        bottom = (o->y + o->height < s->y + s->height) ? o->y + o->height : s->y + s->height;
+        if (left >= right || top >= bottom) {
+            continue;
+        }
+
+        length = (right - left) * bytes;
+        for (row = top; row < bottom; row++) {
+            from = s->background + ((row - s->y) * s->width + (left - s->x)) * bytes;
+            to = o->background + ((row - o->y) * o->width + (left - o->x)) * bytes;
+            for (k = 0; k < length; k++) {
+                to[k] = from[k];
+            }
+        }
+
+        drawSoftware(o);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       sprite_init
+//
+//  Arguments:      s:             The sprite to set up
+//                  width, height: Size in pixels (at most SPRITE_MAX_SIZE)
+//                  image:         width x height pixels in 0xAARRGGBB form.
+//                                 It must stay valid while the sprite exists.
+//                  wantHardware:  TRUE (non-zero) to try the hardware cursor
+//
+//  Returns:        void
+//
+//  Description:    This function sets up a hidden sprite with an image. If
+//                  the hardware cursor is wanted, is not already taken, and
+//                  the firmware accepts the image, the sprite uses it.
+//                  Otherwise it is a software sprite.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void sprite_init(struct sprite *s, int width, int height, unsigned int *image,
+                 int wantHardware)
+{
+    int i;
+
+
+    s->width = (width > SPRITE_MAX_SIZE) ? SPRITE_MAX_SIZE : width;
+    s->height = (height > SPRITE_MAX_SIZE) ? SPRITE_MAX_SIZE : height;
+    s->image = image;
+    s->visible = 0;
+    s->hardware = 0;
+    s->order = 0;
+
+    // A sprite set up again (for example at a new size) gives up the
+    // cursor, and can take it again below
+    if (cursorOwner == s) {
+        cursorOwner = 0;
+    }
+
+    if (wantHardware && !cursorOwner && cursorSetInfo(s)) {
+        s->hardware = 1;
+        cursorOwner = s;
+        return;
+    }
+
+    convertImage(s);
+
+    // Remember the software sprite so that overlaps can be repaired
+    for (i = 0; i < spriteCount; i++) {
+        if (spriteList[i] == s) {
+            return;
+        }
+    }
+    if (spriteCount < SPRITE_MAX) {
+        spriteList[spriteCount++] = s;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       sprite_init_solid
+//
+//  Arguments:      s:             The sprite to set up
+//                  width, height: Size in pixels (at most SPRITE_MAX_SIZE)
+//                  rgb:           The sprite's 0x00RRGGBB color
+//                  pixel:         The same color in the frame buffer's format,
+//                                 for example from fb_alloc_color()
+//                  wantHardware:  TRUE (non-zero) to try the hardware cursor
+//
+//  Returns:        void
+//
+//  Description:    This function sets up a hidden sprite that is a solid
+//                  rectangle of one color. A software solid sprite is drawn
+//                  with the given pixel value, so a palette entry of its own
+//                  can be used to recolor it without drawing.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void sprite_init_solid(struct sprite *s, int width, int height,
+                       unsigned int rgb, unsigned int pixel, int wantHardware)
+{
+    s->rgb = rgb;
+    s->pixel = pixel;
+    sprite_init(s, width, height, 0, wantHardware);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       sprite_move
+//
+//  Arguments:      s:     The sprite
+//                  x, y:  New top left pixel position. The whole sprite must
+//                         be inside the frame buffer.
+//
+//  Returns:        void
+//
+//  Description:    This function moves the sprite, showing it if it was
+//                  hidden. A hardware sprite costs one mailbox request. A
+//                  software sprite restores its old background, then saves
+//                  the new one and draws itself.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void sprite_move(struct sprite *s, int x, int y)
+{
+    TRACE_BEGIN(TRACE_SPRITE_MOVE);
+
+    if (s->hardware) {
+        cursorSetState(1, x, y);
+        s->x = x;
+        s->y = y;
+        s->visible = 1;
+        TRACE_END(TRACE_SPRITE_MOVE);
+        return;
+    }
+
+    if (s->visible) {
+        restoreSoftware(s);
+    }
+
+    s->x = x;
+    s->y = y;
+    s->visible = 1;
+    fb_read(y, x, s->width, s->height, s->background,
+            s->width * frameBufferBytesPerPixel);
+    drawSoftware(s);
+
+    TRACE_END(TRACE_SPRITE_MOVE);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       sprite_hide
+//
+//  Arguments:      s:     The sprite
+//
+//  Returns:        void
+//
+//  Description:    This function removes the sprite from the screen.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void sprite_hide(struct sprite *s)
+{
+    if (!s->visible) {
+        return;
+    }
+
+    if (s->hardware) {
+        cursorSetState(0, s->x, s->y);
+    } else {
+        restoreSoftware(s);
+    }
+
+    s->visible = 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       sprite_set_solid
+//
+//  Arguments:      s:     A solid sprite
+//                  rgb:   The new 0x00RRGGBB color
+//                  pixel: The same color in the frame buffer's format
+//
+//  Returns:        void
+//
+//  Description:    This function recolors a solid sprite. A hardware sprite
+//                  uploads a new cursor image; a visible software sprite is
+//                  drawn again over its saved background.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void sprite_set_solid(struct sprite *s, unsigned int rgb, unsigned int pixel)
+{
+    s->rgb = rgb;
+    s->pixel = pixel;
+
+    if (s->hardware) {
+        cursorSetInfo(s);
+    } else if (s->visible) {
+        drawSoftware(s);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       sprite_refresh
+//
+//  Arguments:      s:     The sprite
+//
+//  Returns:        void
+//
+//  Description:    This function must be called when the picture beneath a
+//                  visible software sprite has been redrawn. The new picture
+//                  is saved as the sprite's background, and the sprite is
+//                  drawn on top again. Hardware sprites need nothing.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void sprite_refresh(struct sprite *s)
+{
+    if (s->hardware || !s->visible) {
+        return;
+    }
+
+    fb_read(s->y, s->x, s->width, s->height, s->background,
+            s->width * frameBufferBytesPerPixel);
+    drawSoftware(s);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       sprite_refresh_all
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function refreshes every software sprite, for use
+//                  after the whole screen has been redrawn. Sprites are
+//                  refreshed in the order they were drawn, so overlapping
+//                  sprites keep their stacking order.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void sprite_refresh_all()
+{
+    struct sprite *sorted[SPRITE_MAX], *t;
+    int i, j;
+
+
+    for (i = 0; i < spriteCount; i++) {
+        t = spriteList[i];
+        for (j = i; j > 0 && sorted[j - 1]->order > t->order; j--) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = t;
+    }
+
+    for (i = 0; i < spriteCount; i++) {
+        sprite_refresh(sorted[i]);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       sprite_is_hardware
+//
+//  Arguments:      s:     The sprite
+//
+//  Returns:        TRUE (non-zero) if the sprite is the hardware cursor.
+//
+//  Description:    Palette color effects do not reach the hardware cursor,
+//                  so callers use this to decide how to recolor a sprite.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int sprite_is_hardware(struct sprite *s)
+{
+    return s->hardware;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       sprite_cursor
+//
+//  Arguments:      none
+//
+//  Returns:        The sprite shown with the hardware cursor, or 0 if no
+//                  sprite is.
+//
+//  Description:    The hardware cursor is never in the frame buffer, so
+//                  code that reads the frame buffer back, such as the screen
+//                  capture, uses this to draw it in.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+struct sprite *sprite_cursor()
+{
+    if (cursorOwner && cursorOwner->visible) {
+        return cursorOwner;
+    }
+    return 0;
+}
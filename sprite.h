@@ -0,0 +1,46 @@
+// Sprite overlays. A sprite is drawn on top of the frame buffer and can be
+// moved without the caller redrawing what is underneath it. One sprite can
+// be shown with the firmware's hardware cursor, which costs only a mailbox
+// request per move. All other sprites (and every sprite when the cursor is
+// unavailable, for example under Qemu) are software sprites that save the
+// pixels beneath them and restore them when they move.
+
+#ifndef SPRITE_H
+#define SPRITE_H
+
+// Largest sprite width and height in pixels (the hardware cursor limit)
+#define SPRITE_MAX_SIZE  64
+
+// Maximum number of software sprites that can overlap each other
+#define SPRITE_MAX       8
+
+struct sprite {
+    int x, y;                 // Top left pixel position
+    int width, height;        // Size in pixels
+    int visible;              // TRUE (non-zero) when on the screen
+    int hardware;             // TRUE when shown with the hardware cursor
+    unsigned int *image;      // 0xAARRGGBB pixels, or 0 for a solid sprite
+    unsigned int rgb;         // Color of a solid sprite
+    unsigned int pixel;       // rgb in the frame buffer's pixel format
+    unsigned int order;       // When the sprite was last drawn
+
+    // Software sprites only: the image converted to the frame buffer's
+    // format, and the frame buffer pixels beneath the sprite
+    unsigned char pixels[SPRITE_MAX_SIZE * SPRITE_MAX_SIZE * 4];
+    unsigned char background[SPRITE_MAX_SIZE * SPRITE_MAX_SIZE * 4];
+};
+
+// Function prototypes
+void sprite_init(struct sprite *s, int width, int height, unsigned int *image,
+                 int wantHardware);
+void sprite_init_solid(struct sprite *s, int width, int height,
+                       unsigned int rgb, unsigned int pixel, int wantHardware);
+void sprite_move(struct sprite *s, int x, int y);
+void sprite_hide(struct sprite *s);
+void sprite_set_solid(struct sprite *s, unsigned int rgb, unsigned int pixel);
+void sprite_refresh(struct sprite *s);
+void sprite_refresh_all();
+int sprite_is_hardware(struct sprite *s);
+struct sprite *sprite_cursor();
+
+#endif
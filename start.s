@@ -1,11 +1,14 @@
 // This routine is used to establish an environment in which
-// a C program can run. We create this environment only on
-// CPU Core 0. The other cores simply run an infinite loop.
+// a C program can run. We create this environment on CPU Core 0,
+// which zeroes the .bss section and branches to main(). The
+// other cores are held back until main() releases them by
+// calling smp_init() (see smp.c).
 //
 // The stack pointer register is initialized to point
 // just below the text section of the program. It grows
 // backwards (toward 0), so it uses memory addresses
-// below that of the _start routine.
+// below that of the _start routine. Each of the other
+// cores gets its own 64 KB stack below the one for Core 0.
 //
 // We also zero out all bytes in the .bss section, and
 // then branch to the main() routine. The main() routine
@@ -25,18 +28,25 @@ _start:
 	// into the x1 register. The rightmost 2 bits gives us the
 	// CPU Core number that this code is running on. We will
 	// only continue running the rest of the program if we
-	// are on CPU Core 0. We will put all other cores in
-	// an infinite loop.
+	// are on CPU Core 0. The other cores wait until they
+	// are released by Core 0.
 	mrs     x1, mpidr_el1	// Read the MP affinity system register
 	tst	x1, 0x3		// Bitwise AND rightmost 2 bits
 	b.eq	core_zero	// Skip forward if both bits are 0
 
-	//  If here, the CPU Core number is not 0, so loop forever
+	//  If here, the CPU Core number is not 0 (this happens when
+	//  all cores start at _start, as under some versions of Qemu)
+	b	secondary_start
+
+	//  Cores that have nothing left to do loop forever
 loop:  	wfe			// Wait for event
 	b	loop		// Infinite loop
 
   	// If here, the CPU Core is 0, and we run the rest of the program
 core_zero:
+	// Allow floating point and NEON instructions, and
+	// turn on the instruction cache
+	bl	cpu_setup
 
 	// Set the stack pointer to point to where the _start routine
 	// begins. The stack grows backwards (towards 0), so it uses memory
@@ -70,3 +80,111 @@ endloop:
 	// We should never arrive here, but if we do
 	// we branch to the infinite loop above
 	b       loop
+
+
+
+	// Cores 1 - 3 start here, either from _start or from the
+	// firmware's spin table once smp_init() has written this
+	// address into it. The core sets up its own stack, then
+	// sleeps until Core 0 has cleared the .bss section and set
+	// smp_release, and finally calls secondary_main() in smp.c.
+	.global secondary_start
+secondary_start:
+	bl	cpu_setup
+
+	// Put the core number into x19, and point the stack
+	// 64 KB * core number below the _start routine
+	mrs	x19, mpidr_el1
+	and	x19, x19, 0x3
+	adrp	x1, _start
+	add	x1, x1, :lo12:_start
+	lsl	x2, x19, 16
+	sub	x1, x1, x2
+	mov	sp, x1
+
+	// Wait until smp_release is non-zero
+	adrp	x1, smp_release
+	add	x1, x1, :lo12:smp_release
+release:
+	ldr	w2, [x1]
+	cbnz	w2, released
+	wfe
+	b	release
+
+released:
+	mov	x0, x19			// The core number is the argument
+	bl	secondary_main
+	b	loop
+
+
+
+	// This subroutine enables floating point and NEON (Advanced
+	// SIMD) instructions at every exception level up to the
+	// current one, turns on the instruction cache, and installs
+	// the exception vectors. IRQs stay masked until a core
+	// unmasks them (see irq_enable() in irq.c). It uses
+	// only x0 and x1, and no stack, so it can run before the
+	// stack pointer is set.
+cpu_setup:
+	mrs	x0, CurrentEL		// The exception level is in bits 3:2
+	lsr	x0, x0, 2
+	and	x0, x0, 0x3
+
+	cmp	x0, 3			// At EL3, stop EL3 trapping FP/SIMD
+	b.ne	1f
+	msr	cptr_el3, xzr
+1:	cmp	x0, 2			// At EL2 or above, stop EL2 trapping
+	b.lt	2f
+	mov	x1, 0x33ff
+	msr	cptr_el2, x1
+2:	mov	x1, (3 << 20)		// CPACR_EL1.FPEN = 11: no trapping
+	msr	cpacr_el1, x1
+
+	// Set the I bit (bit 12) of the system control register
+	// for the current exception level, point its vector base
+	// address register at the exception vector table (see
+	// vectors.s), and have IRQs taken at this exception level.
+	// The core stays at the exception level it was started in.
+	cmp	x0, 3
+	b.ne	3f
+	mrs	x1, sctlr_el3
+	orr	x1, x1, (1 << 12)
+	msr	sctlr_el3, x1
+	adrp	x1, exception_vectors
+	add	x1, x1, :lo12:exception_vectors
+	msr	vbar_el3, x1
+	mrs	x1, scr_el3		// SCR_EL3.IRQ = 1
+	orr	x1, x1, (1 << 1)
+	msr	scr_el3, x1
+	b	5f
+3:	cmp	x0, 2
+	b.ne	4f
+	mrs	x1, sctlr_el2
+	orr	x1, x1, (1 << 12)
+	msr	sctlr_el2, x1
+	adrp	x1, exception_vectors
+	add	x1, x1, :lo12:exception_vectors
+	msr	vbar_el2, x1
+	mrs	x1, hcr_el2		// HCR_EL2.IMO = 1
+	orr	x1, x1, (1 << 4)
+	msr	hcr_el2, x1
+	b	5f
+4:	mrs	x1, sctlr_el1
+	orr	x1, x1, (1 << 12)
+	msr	sctlr_el1, x1
+	adrp	x1, exception_vectors
+	add	x1, x1, :lo12:exception_vectors
+	msr	vbar_el1, x1
+5:	isb
+	ret
+
+
+
+	// smp_release is in the .data section rather than .bss, so that
+	// it is already 0 when the image is loaded, before Core 0 has
+	// had a chance to clear the .bss section.
+	.section ".data"
+	.global smp_release
+	.balign 8
+smp_release:
+	.word	0
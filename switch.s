@@ -0,0 +1,59 @@
+// The context switch for the cooperative tasks in task.c.
+//
+// A task only gives up the core by calling a function (task_yield() and
+// the other task.c primitives), so only the registers that the procedure
+// call standard says a function must preserve need saving: x19 - x28, the
+// frame pointer (x29), the link register (x30), the stack pointer, and the
+// low halves of v8 - v15 (d8 - d15). Everything else is already assumed
+// to be changed by the call. A context is 21 doublewords (see struct
+// task_context in task.h).
+
+
+	.section ".text"
+
+	// void task_switch(struct task_context *from, struct task_context *to)
+	//
+	// Saves the caller's registers into 'from' and loads the ones in
+	// 'to'. The ret then continues in the other context, at the point
+	// where it last called task_switch(), or in task_start for a new
+	// task.
+	.global task_switch
+task_switch:
+	mov	x9, sp
+	stp	x19, x20, [x0, 0]
+	stp	x21, x22, [x0, 16]
+	stp	x23, x24, [x0, 32]
+	stp	x25, x26, [x0, 48]
+	stp	x27, x28, [x0, 64]
+	stp	x29, x30, [x0, 80]
+	str	x9, [x0, 96]
+	stp	d8, d9, [x0, 104]
+	stp	d10, d11, [x0, 120]
+	stp	d12, d13, [x0, 136]
+	stp	d14, d15, [x0, 152]
+
+	ldp	x19, x20, [x1, 0]
+	ldp	x21, x22, [x1, 16]
+	ldp	x23, x24, [x1, 32]
+	ldp	x25, x26, [x1, 48]
+	ldp	x27, x28, [x1, 64]
+	ldp	x29, x30, [x1, 80]
+	ldr	x9, [x1, 96]
+	ldp	d8, d9, [x1, 104]
+	ldp	d10, d11, [x1, 120]
+	ldp	d12, d13, [x1, 136]
+	ldp	d14, d15, [x1, 152]
+	mov	sp, x9
+	ret
+
+
+
+	// The first switch to a new task returns here. task_create() puts
+	// the task's function in x19 and its argument in x20. If the
+	// function returns, the task is ended by task_exit().
+	.global task_start
+task_start:
+	mov	x0, x20
+	blr	x19
+	bl	task_exit
+1:	b	1b
@@ -8,13 +8,13 @@
 
 #include "gpio.h"
 
-#define SYSTEM_TIMER_CS	    ((volatile unsigned int *)(MMIO_BASE + 0x00003000))
-#define SYSTEM_TIMER_CLO    ((volatile unsigned int *)(MMIO_BASE + 0x00003004))
-#define SYSTEM_TIMER_CHI    ((volatile unsigned int *)(MMIO_BASE + 0x00003008))
-#define SYSTEM_TIMER_C0     ((volatile unsigned int *)(MMIO_BASE + 0x0000300C))
-#define SYSTEM_TIMER_C1     ((volatile unsigned int *)(MMIO_BASE + 0x00003010))
-#define SYSTEM_TIMER_C2     ((volatile unsigned int *)(MMIO_BASE + 0x00003014))
-#define SYSTEM_TIMER_C3     ((volatile unsigned int *)(MMIO_BASE + 0x00003018))
+#define SYSTEM_TIMER_CS	    MMIO_REG(MMIO_BASE + 0x00003000)
+#define SYSTEM_TIMER_CLO    MMIO_REG(MMIO_BASE + 0x00003004)
+#define SYSTEM_TIMER_CHI    MMIO_REG(MMIO_BASE + 0x00003008)
+#define SYSTEM_TIMER_C0     MMIO_REG(MMIO_BASE + 0x0000300C)
+#define SYSTEM_TIMER_C1     MMIO_REG(MMIO_BASE + 0x00003010)
+#define SYSTEM_TIMER_C2     MMIO_REG(MMIO_BASE + 0x00003014)
+#define SYSTEM_TIMER_C3     MMIO_REG(MMIO_BASE + 0x00003018)
 
 
 
@@ -37,14 +37,14 @@ unsigned long get_timer_counter()
     unsigned int high, low;
     
     // Read the system timer counter, by reading its higher and lower 32 bits
-    high = *SYSTEM_TIMER_CHI;
-    low = *SYSTEM_TIMER_CLO;
+    high = mmio_read(SYSTEM_TIMER_CHI);
+    low = mmio_read(SYSTEM_TIMER_CLO);
     
     // We repeat the read if the high 32 bits changed when reading the low
     // 32 bits. This may happen when the low order bits roll over.
-    if (high != *SYSTEM_TIMER_CHI) {
-        high = *SYSTEM_TIMER_CHI;
-        low = *SYSTEM_TIMER_CLO;
+    if (high != mmio_read(SYSTEM_TIMER_CHI)) {
+        high = mmio_read(SYSTEM_TIMER_CHI);
+        low = mmio_read(SYSTEM_TIMER_CLO);
     }
     
     // Form the complete 64-bit value, and return it to calling code
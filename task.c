@@ -0,0 +1,309 @@
+// The functions in this file implement the cooperative task scheduler
+// declared in task.h. Tasks are switched by task_switch() in switch.s, and
+// every switch goes through the scheduler loop in task_run(), which runs on
+// the stack main() was started with. Stacks come from a fixed pool, one per
+// task slot, so creating a task never allocates.
+//
+// The scheduler is round-robin: it starts looking after the task that ran
+// last, so every ready task gets a turn. Sleeping tasks are woken by the
+// clock (see clock.h), and the core waits in wfi while nothing is ready.
+
+#include "clock.h"
+#include "task.h"
+
+
+// Task states
+#define TASK_FREE      0
+#define TASK_READY     1
+#define TASK_SLEEPING  2
+#define TASK_WAITING   3
+
+struct task {
+    struct task_context context;
+    int state;
+    char *name;
+    unsigned long wakeTime;          // TASK_SLEEPING: when to wake
+    struct task_event *event;        // TASK_WAITING: the event, and its
+    unsigned int eventCount;         // count when the wait started
+};
+
+static struct task tasks[TASK_MAX];
+static unsigned char taskStacks[TASK_MAX][TASK_STACK_SIZE] __attribute__((aligned(16)));
+
+// The scheduler's own context, and the task that is running (-1 for none)
+static struct task_context schedulerContext;
+static int taskCurrent = -1;
+
+// Total clock ticks the scheduler has spent with no task ready
+static unsigned long taskIdleTicks;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       task_create
+//
+//  Arguments:      name:       Name of the task, for debugging
+//                  function:   The function the task runs
+//                  arg:        Argument passed to the function
+//
+//  Returns:        The task number, or -1 if every slot is in use.
+//
+//  Description:    This function sets up a task so that the first switch to
+//                  it starts task_start (in switch.s) on the top of its
+//                  stack, which then calls the function.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int task_create(char *name, void (*function)(void *arg), void *arg)
+{
+    struct task *t;
+    int i, n;
+
+
+    for (n = 0; n < TASK_MAX && tasks[n].state != TASK_FREE; n++)
+        ;
+    if (n == TASK_MAX) {
+        return -1;
+    }
+
+    t = &tasks[n];
+    for (i = 0; i < 12; i++) {
+        t->context.x[i] = 0;
+    }
+    for (i = 0; i < 8; i++) {
+        t->context.d[i] = 0;
+    }
+    t->context.x[0] = (unsigned long)function;       // x19
+    t->context.x[1] = (unsigned long)arg;            // x20
+    t->context.x[11] = (unsigned long)task_start;    // x30
+    t->context.sp = (unsigned long)&taskStacks[n][TASK_STACK_SIZE];
+
+    t->name = name;
+    t->state = TASK_READY;
+
+    return n;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       taskReady
+//
+//  Arguments:      t:       A task
+//                  now:     The current time
+//
+//  Returns:        TRUE (non-zero) if the task can run.
+//
+//  Description:    A sleeping or waiting task whose condition has been met
+//                  is made ready here.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int taskReady(struct task *t, unsigned long now)
+{
+    if (t->state == TASK_SLEEPING && now >= t->wakeTime) {
+        t->state = TASK_READY;
+    } else if (t->state == TASK_WAITING && t->event->count != t->eventCount) {
+        t->state = TASK_READY;
+    }
+
+    return t->state == TASK_READY;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       task_run
+//
+//  Arguments:      none
+//
+//  Returns:        Never
+//
+//  Description:    This is the scheduler loop, called once from main() after
+//                  the tasks have been created. It switches to the next
+//                  ready task, and gets control back whenever that task
+//                  yields, sleeps, waits or ends. When no task is ready, the
+//                  core sleeps until the earliest sleeping task is due or
+//                  an interrupt comes in.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void task_run()
+{
+    unsigned long now, wake;
+    int i, n, sleeping;
+
+
+    while (1) {
+        now = clock_now();
+
+        for (i = 1; i <= TASK_MAX; i++) {
+            n = (taskCurrent + i + TASK_MAX) % TASK_MAX;
+            if (taskReady(&tasks[n], now)) {
+                break;
+            }
+        }
+
+        if (i <= TASK_MAX) {
+            taskCurrent = n;
+            task_switch(&schedulerContext, &tasks[n].context);
+            continue;
+        }
+
+        // Nothing is ready, so sleep until the first sleeper is due, or
+        // until an interrupt handler (such as startPressed()) may have
+        // signalled an event; either way the tasks are checked again.
+        sleeping = 0;
+        wake = 0;
+        for (n = 0; n < TASK_MAX; n++) {
+            if (tasks[n].state == TASK_SLEEPING && (!sleeping || tasks[n].wakeTime < wake)) {
+                wake = tasks[n].wakeTime;
+                sleeping = 1;
+            }
+        }
+
+        if (sleeping) {
+            clock_sleep_until(wake);
+        } else {
+            asm volatile("wfi");
+        }
+        taskIdleTicks += clock_now() - now;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       task_yield
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function lets the other ready tasks run, and returns
+//                  when it is this task's turn again.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void task_yield()
+{
+    task_switch(&tasks[taskCurrent].context, &schedulerContext);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       task_sleep_until
+//
+//  Arguments:      time:     The clock time (see clock_now()) to wake at
+//
+//  Returns:        void
+//
+//  Description:    This function suspends the calling task until the given
+//                  time. The other tasks run in the meantime.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void task_sleep_until(unsigned long time)
+{
+    struct task *t = &tasks[taskCurrent];
+
+
+    t->wakeTime = time;
+    t->state = TASK_SLEEPING;
+    task_switch(&t->context, &schedulerContext);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       task_wait_event
+//
+//  Arguments:      event:    The event to wait for
+//
+//  Returns:        void
+//
+//  Description:    This function suspends the calling task until the event
+//                  is next signalled.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void task_wait_event(struct task_event *event)
+{
+    struct task *t = &tasks[taskCurrent];
+
+
+    t->event = event;
+    t->eventCount = event->count;
+    t->state = TASK_WAITING;
+    task_switch(&t->context, &schedulerContext);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       task_signal
+//
+//  Arguments:      event:    The event
+//
+//  Returns:        void
+//
+//  Description:    This function wakes every task waiting for the event. The
+//                  caller keeps running; the woken tasks run when it next
+//                  gives up the core.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void task_signal(struct task_event *event)
+{
+    event->count++;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       task_exit
+//
+//  Arguments:      none
+//
+//  Returns:        Never
+//
+//  Description:    This function ends the calling task and frees its slot.
+//                  It is called by task_start when a task's function returns.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void task_exit()
+{
+    struct task *t = &tasks[taskCurrent];
+
+
+    t->state = TASK_FREE;
+    task_switch(&t->context, &schedulerContext);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       task_idle_ticks
+//
+//  Arguments:      none
+//
+//  Returns:        The total time, in clock ticks, that core 0 has spent
+//                  with no task ready to run.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned long task_idle_ticks()
+{
+    return taskIdleTicks;
+}
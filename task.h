@@ -0,0 +1,41 @@
+// Cooperative tasks on core 0. Each task has its own stack and runs until it
+// yields, sleeps or waits for an event; the scheduler then switches to the
+// next task that is ready to run. When no task is ready the core sleeps
+// until the earliest wake-up time.
+
+#ifndef TASK_H
+#define TASK_H
+
+// Maximum number of tasks, and the stack size of each
+#define TASK_MAX         8
+#define TASK_STACK_SIZE  16384
+
+// The registers saved by task_switch() in switch.s: x19 - x30, sp and
+// d8 - d15
+struct task_context {
+    unsigned long x[12];
+    unsigned long sp;
+    unsigned long d[8];
+};
+
+// An event that tasks can wait for. Every task_signal() wakes the tasks
+// that were waiting at the time; a signal with no waiters is not kept.
+struct task_event {
+    volatile unsigned int count;
+};
+
+// Function prototypes
+int task_create(char *name, void (*function)(void *arg), void *arg);
+void task_run();
+void task_yield();
+void task_sleep_until(unsigned long time);
+void task_wait_event(struct task_event *event);
+void task_signal(struct task_event *event);
+void task_exit();
+unsigned long task_idle_ticks();
+
+// Defined in switch.s
+void task_switch(struct task_context *from, struct task_context *to);
+void task_start();
+
+#endif
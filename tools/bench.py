@@ -0,0 +1,178 @@
+#!/usr/bin/env python3
+"""Run the kernel's benchmark scenario under Qemu and check for regressions.
+
+For example:
+
+    tools/bench.py kernel8.img tools/bench_baseline.json
+
+The kernel is booted with instruction counting (-icount), so the counts are
+the same from one run to the next. Once the kernel is up, 'b' is typed on
+its console, and the "BENCH <phase> key=value ..." lines it prints are
+collected until "BENCH done". Each phase's counts are compared with the
+baseline file, and the script exits with status 1 if any count grew by more
+than the tolerance.
+
+A run fails if the baseline file is missing or has no count for a phase the
+kernel reported, so a regression cannot pass unnoticed. Use --update to
+record the baseline, or to replace it after an intended change.
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import time
+
+# Printed by the kernel once the other cores are up, just before the tasks
+# start; the console is polled from then on
+READY = b"Cores online"
+
+# The counts compared with the baseline. Time in microseconds is reported
+# but not compared, since it depends on the host.
+METRICS = ("instructions", "cycles")
+
+
+# Qemu's serial arguments for each console UART: the first serial port is
+# UART0 (the PL011), the second the Mini UART
+SERIAL = {
+    "mini": ["-serial", "null", "-serial", "stdio"],
+    "pl011": ["-serial", "stdio"],
+}
+
+
+def run_qemu(kernel, qemu, uart, timeout):
+    """Boot the kernel, run the scenario, and return the BENCH lines."""
+    command = [qemu, "-M", "raspi3", "-kernel", kernel] + SERIAL[uart] + [
+        "-display", "none", "-icount", "shift=0",
+    ]
+    process = subprocess.Popen(command, stdin=subprocess.PIPE,
+                               stdout=subprocess.PIPE)
+    deadline = time.time() + timeout
+    lines = []
+    buffer = b""
+    started = False
+
+    try:
+        os.set_blocking(process.stdout.fileno(), False)
+        while time.time() < deadline:
+            chunk = process.stdout.read()
+            if chunk:
+                buffer += chunk
+            elif process.poll() is not None:
+                break
+            else:
+                time.sleep(0.05)
+                continue
+
+            if not started and READY in buffer:
+                process.stdin.write(b"b")
+                process.stdin.flush()
+                started = True
+
+            while b"\n" in buffer:
+                line, buffer = buffer.split(b"\n", 1)
+                line = line.decode("ascii", "replace").strip()
+                if line.startswith("BENCH"):
+                    lines.append(line)
+                    if line == "BENCH done":
+                        return lines
+    finally:
+        process.kill()
+        process.wait()
+
+    sys.exit("bench: no 'BENCH done' from the kernel within %d s" % timeout)
+
+
+def parse(lines):
+    """Turn "BENCH <phase> key=value ..." lines into {phase: {key: value}}."""
+    results = {}
+    for line in lines:
+        fields = line.split()
+        if len(fields) < 3:
+            continue
+        results[fields[1]] = {
+            key: int(value)
+            for key, value in (field.split("=", 1) for field in fields[2:])
+        }
+    return results
+
+
+def compare(results, baseline, tolerance):
+    """Print a table of the results, and return the lists of regressions and
+    of counts with no baseline."""
+    regressions = []
+    missing = []
+    print("%-10s %-14s %14s %14s %8s" % ("phase", "metric", "baseline",
+                                         "current", "change"))
+    for phase, counts in sorted(results.items()):
+        for metric in METRICS:
+            if metric not in counts:
+                continue
+            current = counts[metric]
+            old = baseline.get(phase, {}).get(metric)
+            if old is None:
+                print("%-10s %-14s %14s %14d %8s" % (phase, metric, "-",
+                                                     current, "new"))
+                missing.append("%s %s" % (phase, metric))
+                continue
+            change = (current - old) / old if old else 0.0
+            print("%-10s %-14s %14d %14d %+7.2f%%" % (phase, metric, old,
+                                                      current, change * 100))
+            if change > tolerance:
+                regressions.append("%s %s" % (phase, metric))
+    return regressions, missing
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("kernel", help="kernel8.img to boot")
+    parser.add_argument("baseline", help="baseline JSON file")
+    parser.add_argument("--qemu", default="qemu-system-aarch64")
+    parser.add_argument("--uart", choices=sorted(SERIAL), default="mini",
+                        help="the kernel's console UART (default mini)")
+    parser.add_argument("--tolerance", type=float, default=0.02,
+                        help="allowed growth as a fraction (default 0.02)")
+    parser.add_argument("--timeout", type=int, default=300,
+                        help="seconds to wait for the scenario")
+    parser.add_argument("--update", action="store_true",
+                        help="write the results as the new baseline")
+    parser.add_argument("--output", help="also write the results here")
+    args = parser.parse_args()
+
+    results = parse(run_qemu(args.kernel, args.qemu, args.uart, args.timeout))
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+
+    if args.update:
+        with open(args.baseline, "w") as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+        print("bench: baseline written to %s" % args.baseline)
+        compare(results, {}, args.tolerance)
+        return 0
+
+    if not os.path.exists(args.baseline):
+        compare(results, {}, args.tolerance)
+        print("bench: no baseline in %s; record one with --update"
+              % args.baseline)
+        return 1
+
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+
+    regressions, missing = compare(results, baseline, args.tolerance)
+    if regressions:
+        print("bench: regression in " + ", ".join(regressions))
+        return 1
+    if missing:
+        print("bench: no baseline for " + ", ".join(missing)
+              + "; record one with --update")
+        return 1
+    print("bench: no regressions")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,194 @@
+#!/usr/bin/env python3
+"""Turn a screen capture streamed from the serial port into images or video.
+
+Type 'c' at the kernel's console to start capturing and 'c' again to stop,
+capture the serial output to a file, then run:
+
+    tools/capture2png.py capture.bin frames/
+
+to write frames/frame_00000.png, frames/frame_00001.png, ... or
+
+    tools/capture2png.py capture.bin --video capture.mp4
+
+to encode a video with ffmpeg at the captured frame times. The capture may
+contain other console text; each "CAPF" message in it is decoded in order.
+A frame is sent as one message per changed tile, and an image is written
+once its last message has been read. Tiles before the first keyframe are
+ignored.
+"""
+
+import argparse
+import os
+import struct
+import subprocess
+import sys
+import zlib
+
+MAGIC = b"CAPF"
+HEADER = struct.Struct("<IIHHBBBB")
+
+
+def to_rgb(value, depth, order, palette):
+    """Convert one pixel value to an (r, g, b) tuple."""
+    if depth == 32:
+        r, g, b = (value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF
+    elif depth == 16:
+        r = ((value >> 11) & 0x1F) * 255 // 31
+        g = ((value >> 5) & 0x3F) * 255 // 63
+        b = (value & 0x1F) * 255 // 31
+    else:
+        color = palette[value] if value < len(palette) else 0
+        return (color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF
+    # The kernel asks for BGR order, in which a 0x00RRGGBB value shows as
+    # written; in RGB order red and blue are swapped
+    if order == 1:
+        r, b = b, r
+    return r, g, b
+
+
+def decode_tile(data, count, size):
+    """Expand an RLE-compressed tile into a list of count pixel values."""
+    pixels = []
+    pos = 0
+    while len(pixels) < count:
+        header = data[pos]
+        pos += 1
+        if header & 0x80:
+            value = int.from_bytes(data[pos:pos + size], "little")
+            pos += size
+            pixels.extend([value] * ((header & 0x7F) + 1))
+        else:
+            for _ in range(header + 1):
+                pixels.append(int.from_bytes(data[pos:pos + size], "little"))
+                pos += size
+    return pixels[:count]
+
+
+def frames(data):
+    """Yield (microseconds, width, height, rgb bytes) for every frame."""
+    canvas = None
+    palette = ()
+    offset = data.find(MAGIC)
+    while offset >= 0:
+        pos = offset + len(MAGIC)
+        try:
+            (number, micros, width, height, depth, order, flags,
+             tile) = HEADER.unpack_from(data, pos)
+            keyframe, more = flags & 1, flags & 2
+            pos += HEADER.size
+            (palette_count,) = struct.unpack_from("<H", data, pos)
+            pos += 2
+            # Only a frame's first message carries the palette
+            if palette_count:
+                palette = struct.unpack_from("<%dI" % palette_count, data, pos)
+                pos += 4 * palette_count
+            (tiles,) = struct.unpack_from("<H", data, pos)
+            pos += 2
+            if depth not in (8, 16, 32):
+                raise ValueError("unsupported depth %d" % depth)
+
+            if keyframe:
+                canvas = bytearray(width * height * 3)
+            elif canvas is not None and len(canvas) != width * height * 3:
+                canvas = None
+
+            for _ in range(tiles):
+                tx, ty, length = struct.unpack_from("<HHI", data, pos)
+                pos += 8
+                encoded = data[pos:pos + length]
+                pos += length
+                if len(encoded) != length:
+                    raise ValueError("truncated tile")
+                if canvas is None:
+                    continue
+
+                x0, y0 = tx * tile, ty * tile
+                w, h = min(tile, width - x0), min(tile, height - y0)
+                pixels = decode_tile(encoded, w * h, depth // 8)
+                for row in range(h):
+                    line = bytearray()
+                    for value in pixels[row * w:(row + 1) * w]:
+                        line.extend(to_rgb(value, depth, order, palette))
+                    start = ((y0 + row) * width + x0) * 3
+                    canvas[start:start + w * 3] = line
+        except (struct.error, ValueError, IndexError) as error:
+            sys.stderr.write("skipping frame at %d: %s\n" % (offset, error))
+            pos = offset + len(MAGIC)
+        else:
+            if canvas is not None and not more:
+                yield micros, width, height, bytes(canvas)
+        offset = data.find(MAGIC, pos)
+
+
+def write_png(path, width, height, rgb):
+    """Write 8-bit RGB pixels as a PNG file."""
+    def chunk(kind, body):
+        return (struct.pack(">I", len(body)) + kind + body +
+                struct.pack(">I", zlib.crc32(kind + body) & 0xFFFFFFFF))
+
+    stride = width * 3
+    raw = b"".join(b"\0" + rgb[y * stride:(y + 1) * stride] for y in range(height))
+    with open(path, "wb") as f:
+        f.write(b"\x89PNG\r\n\x1a\n")
+        f.write(chunk(b"IHDR", struct.pack(">IIBBBBB", width, height, 8, 2, 0, 0, 0)))
+        f.write(chunk(b"IDAT", zlib.compress(raw, 6)))
+        f.write(chunk(b"IEND", b""))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", help="captured serial output")
+    parser.add_argument("directory", nargs="?", help="where to write PNGs")
+    parser.add_argument("--video", help="encode a video here with ffmpeg")
+    parser.add_argument("--fps", type=int, default=30,
+                        help="video frame rate (default 30)")
+    args = parser.parse_args()
+    if not args.directory and not args.video:
+        parser.error("give a directory for PNGs, or --video")
+
+    with open(args.capture, "rb") as f:
+        data = f.read()
+
+    if args.directory:
+        os.makedirs(args.directory, exist_ok=True)
+
+    encoder = None
+    size = None
+    count = 0
+    last = None
+    for micros, width, height, rgb in frames(data):
+        if args.directory:
+            write_png(os.path.join(args.directory, "frame_%05d.png" % count),
+                      width, height, rgb)
+
+        if args.video:
+            if encoder is None:
+                size = (width, height)
+                encoder = subprocess.Popen(
+                    ["ffmpeg", "-y", "-loglevel", "error", "-f", "rawvideo",
+                     "-pix_fmt", "rgb24", "-s", "%dx%d" % size,
+                     "-r", str(args.fps), "-i", "-", "-pix_fmt", "yuv420p",
+                     args.video], stdin=subprocess.PIPE)
+            if (width, height) == size:
+                # Repeat the previous frame to keep the captured timing
+                if last is not None:
+                    gap = round((micros - last[0]) * args.fps / 1e6)
+                    for _ in range(max(0, gap - 1)):
+                        encoder.stdin.write(last[1])
+                encoder.stdin.write(rgb)
+                last = (micros, rgb)
+        count += 1
+
+    if encoder is not None:
+        encoder.stdin.close()
+        encoder.wait()
+
+    if count == 0:
+        sys.stderr.write("no keyframe found in %s\n" % args.capture)
+        return 1
+    sys.stderr.write("%d frames\n" % count)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
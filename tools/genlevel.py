@@ -0,0 +1,245 @@
+#!/usr/bin/env python3
+"""Generate level.h from a text level file.
+
+The Makefile runs this before compiling anything:
+
+    tools/genlevel.py maze.lvl level.h --screen 1024x768 --max-tile 64
+
+Each line of the level is a row of squares: '#' is a wall, '.' a path, 'S'
+the entrance and 'E' the exit. 'P' marks where each player after the first
+starts, and 'C' where each chaser starts, both on a path. Lines starting
+with ';' are comments. The header holds everything the kernel would
+otherwise work out from the maze while it runs, as macros that main.c and
+render.c turn into const tables:
+
+    LEVEL_CELLS        the squares, for the maze[][] array
+    LEVEL_WALL_BITS    one bit per square, set for walls
+    LEVEL_RUNS         each row as runs of squares drawn in the same color
+    LEVEL_ROW_RUNS     the index of each row's first run
+    LEVEL_START_X/Y    the entrance
+    LEVEL_EXIT_X/Y     the exit
+    LEVEL_STARTS       each player's starting square: the entrance, then
+                       the 'P' squares in reading order
+    LEVEL_CHASERS      each chaser's starting square, in reading order
+    LEVEL_TILE_SIZES   the square size at each render resolution, for the
+                       unrolled drawSquare() kernels
+
+--screen and --max-tile must match FRAMEBUFFER_WIDTH/HEIGHT in
+framebuffer.h and SPRITE_MAX_SIZE in sprite.h. If they do not, the game
+still runs, with squares drawn by the generic kernel.
+
+A level the kernel cannot hold is rejected: one with more than 255 rows or
+columns, since main.c keeps starting squares in bytes, squares too small
+to draw at the lowest resolution, more squares or runs than the kernel's
+16-bit indices reach, or more chasers than ENTITY_MAX in entity.h.
+"""
+
+import argparse
+import sys
+
+SQUARES = {".": 0, "#": 1, "S": 2, "E": 3, "P": 0, "C": 0}
+
+# Limits of the kernel's tables: struct maze_square in main.c holds a
+# square's column and row in unsigned chars, flow.c and mazeRowRuns index
+# squares and runs with unsigned shorts, and entity.h holds ENTITY_MAX
+# entities
+MAX_SIDE = 255
+MAX_SQUARES = 65535
+MAX_RUNS = 65535
+MAX_CHASERS = 256
+
+# The square value each kind of square is drawn as. The entrance is drawn
+# as a path, so it joins the runs around it.
+DRAWN_AS = {0: 0, 1: 1, 2: 0, 3: 3}
+
+# The resolution levels of scale.h, as a fraction of full resolution in
+# quarters
+SCALE_QUARTERS = (4, 3, 2)
+
+
+def parse(path):
+    """Return the rows of a level file as strings of square characters."""
+    rows = []
+    with open(path) as f:
+        for number, line in enumerate(f, 1):
+            line = line.rstrip("\r\n")
+            if not line or line.startswith(";"):
+                continue
+            for c in line:
+                if c not in SQUARES:
+                    raise ValueError("%s:%d: unknown square %r"
+                                     % (path, number, c))
+            rows.append(line)
+
+    if not rows:
+        raise ValueError("%s: no rows" % path)
+    if any(len(row) != len(rows[0]) for row in rows):
+        raise ValueError("%s: rows differ in length" % path)
+    if len(rows[0]) > MAX_SIDE:
+        raise ValueError("%s: more than %d columns" % (path, MAX_SIDE))
+    if len(rows) > MAX_SIDE:
+        raise ValueError("%s: more than %d rows" % (path, MAX_SIDE))
+    return rows
+
+
+def markers(lines, marker):
+    """Return the (x, y) of every square with the given character."""
+    return [(x, y) for y, line in enumerate(lines)
+            for x, c in enumerate(line) if c == marker]
+
+
+def squares(name, found):
+    """Return a multi-line macro whose value is a list of {x, y} squares."""
+    return initializer(name, ["{%d, %d}" % square for square in found])
+
+
+def find(rows, value, name):
+    """Return the (x, y) of the only square with the given value."""
+    found = [(x, y) for y, row in enumerate(rows)
+             for x, square in enumerate(row) if square == value]
+    if len(found) != 1:
+        raise ValueError("the level needs exactly one %s, not %d"
+                         % (name, len(found)))
+    return found[0]
+
+
+def runs(row):
+    """Return a row as (x, width, square) runs of the same drawn color."""
+    result = []
+    for x, square in enumerate(row):
+        drawn = DRAWN_AS[square]
+        if result and result[-1][2] == drawn:
+            result[-1][1] += 1
+        else:
+            result.append([x, 1, drawn])
+    return result
+
+
+def tile_sizes(width, height, screen, max_tile):
+    """Return the square sizes layoutMaze() picks at each resolution."""
+    sizes = []
+    for quarters in SCALE_QUARTERS:
+        size = min(screen[0] * quarters // 4 // width,
+                   screen[1] * quarters // 4 // height, max_tile)
+        if size > 0 and size not in sizes:
+            sizes.append(size)
+    return sizes
+
+
+def initializer(name, lines):
+    """Return a multi-line macro whose value is a brace initializer."""
+    body = ", \\\n".join("    " + line for line in lines)
+    return "#define %s { \\\n%s \\\n}\n" % (name, body)
+
+
+def generate(lines, source, screen, max_tile):
+    rows = [[SQUARES[c] for c in line] for line in lines]
+    width, height = len(rows[0]), len(rows)
+    words = (width + 63) // 64
+    start = find(rows, 2, "entrance ('S')")
+    exit_ = find(rows, 3, "exit ('E')")
+    starts = [start] + markers(lines, "P")
+    chasers = markers(lines, "C")
+
+    if width * height > MAX_SQUARES:
+        raise ValueError("%d squares, more than %d"
+                         % (width * height, MAX_SQUARES))
+    if len(chasers) > MAX_CHASERS:
+        raise ValueError("%d chasers, more than %d"
+                         % (len(chasers), MAX_CHASERS))
+
+    cells = ["{%s}" % ", ".join(str(square) for square in row) for row in rows]
+
+    bits = []
+    for row in rows:
+        mask = sum(1 << x for x, square in enumerate(row) if square == 1)
+        bits.append("{%s}" % ", ".join(
+            "0x%xUL" % ((mask >> (64 * i)) & (2 ** 64 - 1))
+            for i in range(words)))
+
+    run_lines, row_runs = [], [0]
+    for row in rows:
+        row_run = runs(row)
+        run_lines.append(", ".join("{%d, %d, %d}" % tuple(run)
+                                   for run in row_run))
+        row_runs.append(row_runs[-1] + len(row_run))
+
+    if row_runs[-1] > MAX_RUNS:
+        raise ValueError("%d runs, more than %d" % (row_runs[-1], MAX_RUNS))
+
+    sizes = tile_sizes(width, height, screen, max_tile)
+    smallest = min(screen[0] * SCALE_QUARTERS[-1] // 4 // width,
+                   screen[1] * SCALE_QUARTERS[-1] // 4 // height)
+    if smallest == 0:
+        raise ValueError("%dx%d squares do not fit the lowest resolution, "
+                         "%dx%d" % (width, height,
+                                    screen[0] * SCALE_QUARTERS[-1] // 4,
+                                    screen[1] * SCALE_QUARTERS[-1] // 4))
+
+    out = []
+    out.append("// Generated by tools/genlevel.py from %s. Do not edit.\n\n"
+               % source)
+    out.append("#ifndef LEVEL_H\n#define LEVEL_H\n\n")
+    out.append("// Size in squares, and bitset words per row\n")
+    out.append("#define LEVEL_WIDTH       %d\n" % width)
+    out.append("#define LEVEL_HEIGHT      %d\n" % height)
+    out.append("#define LEVEL_WORDS       %d\n\n" % words)
+    out.append("// The entrance and the exit\n")
+    out.append("#define LEVEL_START_X     %d\n" % start[0])
+    out.append("#define LEVEL_START_Y     %d\n" % start[1])
+    out.append("#define LEVEL_EXIT_X      %d\n" % exit_[0])
+    out.append("#define LEVEL_EXIT_Y      %d\n\n" % exit_[1])
+    out.append("// Each player's starting square, {x, y}, and the number of "
+               "them\n")
+    out.append("#define LEVEL_START_COUNT %d\n" % len(starts))
+    out.append(squares("LEVEL_STARTS", starts))
+    out.append("\n// Each chaser's starting square, {x, y}, and the number of "
+               "them\n")
+    out.append("#define LEVEL_CHASER_COUNT %d\n" % len(chasers))
+    out.append(squares("LEVEL_CHASERS", chasers))
+    out.append("\n")
+    out.append("// The squares: 0 is a path, 1 a wall, 2 the entrance and "
+               "3 the exit\n")
+    out.append(initializer("LEVEL_CELLS", cells))
+    out.append("\n// Bit x % 64 of word x / 64 of each row is set for a wall\n")
+    out.append(initializer("LEVEL_WALL_BITS", bits))
+    out.append("\n// Each row as runs of squares drawn in the same color: "
+               "{x, width, square}\n")
+    out.append("#define LEVEL_RUN_COUNT   %d\n" % row_runs[-1])
+    out.append(initializer("LEVEL_RUNS", run_lines))
+    out.append("\n// The index of each row's first run, and of the end\n")
+    out.append("#define LEVEL_ROW_RUNS { %s }\n\n"
+               % ", ".join(str(i) for i in row_runs))
+    out.append("// The square size in pixels at each render resolution "
+               "(%dx%d and below)\n" % screen)
+    out.append("#define LEVEL_TILE_SIZES(X)  %s\n\n"
+               % " ".join("X(%d)" % size for size in sizes))
+    out.append("#endif\n")
+    return "".join(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("level", help="text level file")
+    parser.add_argument("header", help="header file to write")
+    parser.add_argument("--screen", default="1024x768",
+                        help="full frame buffer resolution (default 1024x768)")
+    parser.add_argument("--max-tile", type=int, default=64,
+                        help="largest square size in pixels (default 64)")
+    args = parser.parse_args()
+
+    try:
+        screen = tuple(int(n) for n in args.screen.split("x"))
+        lines = parse(args.level)
+        text = generate(lines, args.level, screen, args.max_tile)
+    except ValueError as e:
+        sys.stderr.write("genlevel: %s\n" % e)
+        return 1
+
+    with open(args.header, "w") as f:
+        f.write(text)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+"""Decode a binary log dump captured from the serial port into text.
+
+Type 'g' at the kernel's console to dump the log ring, or 'w' to stream
+it, capture the serial output to a file, then run:
+
+    tools/logdecode.py kernel8.elf capture.bin
+
+The format strings are read from the .logfmt section of kernel8.elf, which
+must be the build that produced the capture. The capture may contain other
+console text; every "LOGS" dump or streamed packet in it is decoded, in
+the order they were sent.
+"""
+
+import re
+import struct
+import sys
+
+MAGIC = b"LOGS"
+HEADER = struct.Struct("<III")
+RECORD = struct.Struct("<QIHBB4I")
+SECTION = ".logfmt"
+
+# The printf conversions LOG() formats may use (see log.h)
+CONVERSION = re.compile(r"%(%|[-+ #0]*\d*[diuxXc])")
+
+
+def read_formats(path):
+    """Return (address, bytes) of the .logfmt section of an ELF64 file."""
+    with open(path, "rb") as f:
+        elf = f.read()
+    if elf[:4] != b"\x7fELF" or elf[4] != 2:
+        raise ValueError("%s is not an ELF64 file" % path)
+
+    shoff, = struct.unpack_from("<Q", elf, 0x28)
+    shentsize, shnum, shstrndx = struct.unpack_from("<HHH", elf, 0x3A)
+
+    def header(index):
+        return struct.unpack_from("<IIQQQQ", elf, shoff + index * shentsize)
+
+    strings = header(shstrndx)[4]
+    for index in range(shnum):
+        name, _, _, address, offset, size = header(index)
+        end = elf.index(b"\0", strings + name)
+        if elf[strings + name:end].decode("ascii") == SECTION:
+            return address, elf[offset:offset + size]
+    raise ValueError("%s has no %s section" % (path, SECTION))
+
+
+def format_record(text, args):
+    """Apply a LOG() format to its argument words."""
+    args = list(args)
+
+    def convert(match):
+        spec = match.group(1)
+        if spec == "%":
+            return "%"
+        value = args.pop(0) if args else 0
+        if spec[-1] in "di" and value & 0x80000000:
+            value -= 1 << 32
+        if spec[-1] in "iu":
+            spec = spec[:-1] + "d"
+        return ("%" + spec) % value
+
+    return CONVERSION.sub(convert, text)
+
+
+def decode(data, base, formats):
+    """Yield (seconds, core, text) for every record of every dump."""
+    offset = data.find(MAGIC)
+    while offset >= 0:
+        pos = offset + len(MAGIC)
+        try:
+            version, ticks_per_second, count = HEADER.unpack_from(data, pos)
+            if version != 1:
+                raise ValueError("unsupported log version %d" % version)
+            pos += HEADER.size
+            for _ in range(count):
+                record = RECORD.unpack_from(data, pos)
+                pos += RECORD.size
+                timestamp, message, length, core = record[:4]
+                start = message - base
+                if not 0 <= start < len(formats):
+                    text = "<unknown message 0x%x>" % message
+                else:
+                    end = formats.index(b"\0", start)
+                    text = formats[start:end].decode("ascii", "replace")
+                    text = format_record(text, record[5:5 + length])
+                yield timestamp / ticks_per_second, core, text
+        except (struct.error, ValueError) as error:
+            sys.stderr.write("skipping dump at %d: %s\n" % (offset, error))
+            pos = offset + len(MAGIC)
+        offset = data.find(MAGIC, pos)
+
+
+def main(argv):
+    if len(argv) != 3:
+        sys.stderr.write(__doc__)
+        return 2
+
+    base, formats = read_formats(argv[1])
+    with open(argv[2], "rb") as f:
+        data = f.read()
+
+    for seconds, core, text in decode(data, base, formats):
+        print("[%12.6f] %d: %s" % (seconds, core, text))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
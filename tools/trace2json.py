@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""Convert a trace dump captured from the serial port into Chrome trace JSON.
+
+Type 't' at the kernel's console to dump the trace rings, capture the
+serial output to a file (for example with 'make run > capture.bin' or a
+terminal program's logging), then run:
+
+    tools/trace2json.py capture.bin > trace.json
+
+and open trace.json in chrome://tracing or https://ui.perfetto.dev. The
+capture may contain other console text; every "TRCE" dump in it is decoded,
+and the last one is used unless --all is given.
+"""
+
+import json
+import struct
+import sys
+
+MAGIC = b"TRCE"
+RECORD = struct.Struct("<QHBBI")
+
+
+def parse_dump(data, offset):
+    """Parse one dump starting at offset. Returns (events, next offset)."""
+    pos = offset + len(MAGIC)
+    version, ticks_per_second, name_count = struct.unpack_from("<III", data, pos)
+    pos += 12
+    if version != 1:
+        raise ValueError("unsupported trace version %d" % version)
+
+    names = {}
+    for _ in range(name_count):
+        event_id, length = struct.unpack_from("<HB", data, pos)
+        pos += 3
+        names[event_id] = data[pos:pos + length].decode("ascii", "replace")
+        pos += length
+
+    (count,) = struct.unpack_from("<I", data, pos)
+    pos += 4
+
+    events = []
+    for _ in range(count):
+        timestamp, event_id, core, phase, arg = RECORD.unpack_from(data, pos)
+        pos += RECORD.size
+        event = {
+            "name": names.get(event_id, "event%d" % event_id),
+            "ph": chr(phase),
+            "ts": timestamp * 1e6 / ticks_per_second,
+            "pid": 0,
+            "tid": core,
+        }
+        if event["ph"] == "i":
+            event["s"] = "t"
+            event["args"] = {"arg": "0x%08x" % arg}
+        events.append(event)
+
+    events.sort(key=lambda e: e["ts"])
+    return events, pos
+
+
+def main(argv):
+    args = [a for a in argv[1:] if not a.startswith("--")]
+    if len(args) != 1:
+        sys.stderr.write(__doc__)
+        return 2
+
+    with open(args[0], "rb") as f:
+        data = f.read()
+
+    dumps = []
+    offset = data.find(MAGIC)
+    while offset >= 0:
+        try:
+            events, end = parse_dump(data, offset)
+        except (struct.error, ValueError) as error:
+            sys.stderr.write("skipping dump at %d: %s\n" % (offset, error))
+            end = offset + len(MAGIC)
+        else:
+            dumps.append(events)
+        offset = data.find(MAGIC, end)
+
+    if not dumps:
+        sys.stderr.write("no trace dump found in %s\n" % args[0])
+        return 1
+
+    if "--all" in argv:
+        events = [e for dump in dumps for e in dump]
+    else:
+        events = dumps[-1]
+
+    json.dump({"traceEvents": events, "displayTimeUnit": "ms"}, sys.stdout)
+    sys.stdout.write("\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
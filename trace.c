@@ -0,0 +1,176 @@
+// The functions in this file implement the binary event tracer described in
+// trace.h. Each core writes only to its own ring, so there is exactly one
+// writer per ring and no locking is needed. Recording is paused while the
+// rings are dumped, so the dump is a consistent snapshot.
+//
+// The dump format is, with all integers little-endian:
+//
+//     "TRCE"                          magic
+//     u32 version (1)
+//     u32 clock ticks per second
+//     u32 name count, then for each:  u16 id, u8 length, name bytes
+//     u32 record count, then each record as a struct trace_record
+
+#include "uart.h"
+#include "clock.h"
+#include "trace.h"
+
+
+// Event names, indexed by event id
+static char *traceNames[TRACE_EVENTS] = {
+    "frame",
+    "get_SNES",
+    "drawSquare",
+    "mailbox_query",
+    "render_maze",
+    "sprite_move",
+    "input",
+    "raycast",
+    "flow_update",
+    "entity_update",
+    "capture",
+    "fov_update",
+    "minimap",
+    "composite",
+    "hud",
+};
+
+// One ring of records per core, with the index of the next record to write
+// and the number of valid records
+static struct trace_record __attribute__((aligned(16)))
+    traceRing[TRACE_CORES][TRACE_RING_SIZE];
+static unsigned int traceHead[TRACE_CORES];
+static unsigned int traceCount[TRACE_CORES];
+
+// Recording is paused (zero) while the rings are being dumped
+static volatile int traceRecording = 1;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       trace_record
+//
+//  Arguments:      event:   Event id (TRACE_FRAME, TRACE_GET_SNES, ...)
+//                  phase:   TRACE_PHASE_BEGIN, TRACE_PHASE_END or
+//                           TRACE_PHASE_INSTANT
+//                  arg:     Event-specific argument
+//
+//  Returns:        void
+//
+//  Description:    This function appends one record to the calling core's
+//                  ring. It costs a timer read and a 16-byte store.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void trace_record(unsigned int event, unsigned int phase, unsigned int arg)
+{
+    struct trace_record *r;
+    unsigned long core;
+
+
+    if (!traceRecording) {
+        return;
+    }
+
+    // The core number is in the low 2 bits of the MP affinity register
+    asm volatile("mrs %0, mpidr_el1" : "=r"(core));
+    core &= 0x3;
+
+    r = &traceRing[core][traceHead[core]];
+    r->timestamp = clock_now();
+    r->event = event;
+    r->core = core;
+    r->phase = phase;
+    r->arg = arg;
+
+    traceHead[core] = (traceHead[core] + 1) % TRACE_RING_SIZE;
+    if (traceCount[core] < TRACE_RING_SIZE) {
+        traceCount[core]++;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       putWord
+//
+//  Arguments:      value:   A 32-bit value
+//
+//  Returns:        void
+//
+//  Description:    This function writes a 32-bit value to the UART as four
+//                  raw bytes, least significant byte first.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void putWord(unsigned int value)
+{
+    unsigned char bytes[4];
+
+    bytes[0] = value;
+    bytes[1] = value >> 8;
+    bytes[2] = value >> 16;
+    bytes[3] = value >> 24;
+    uart_write(bytes, 4);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       trace_dump
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes every core's ring to the UART in the
+//                  binary format described at the top of this file, oldest
+//                  record first, and then empties the rings.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void trace_dump()
+{
+    unsigned int core, i, n, first, total, length;
+    char *name;
+
+
+    traceRecording = 0;
+
+    uart_write((unsigned char *)"TRCE", 4);
+    putWord(1);
+    putWord(clock_frequency());
+
+    putWord(TRACE_EVENTS);
+    for (i = 0; i < TRACE_EVENTS; i++) {
+        name = traceNames[i];
+        for (length = 0; name[length]; length++)
+            ;
+        uart_putc(i & 0xFF);
+        uart_putc(i >> 8);
+        uart_putc(length);
+        uart_write((unsigned char *)name, length);
+    }
+
+    total = 0;
+    for (core = 0; core < TRACE_CORES; core++) {
+        total += traceCount[core];
+    }
+    putWord(total);
+
+    for (core = 0; core < TRACE_CORES; core++) {
+        n = traceCount[core];
+        first = (traceHead[core] + TRACE_RING_SIZE - n) % TRACE_RING_SIZE;
+        for (i = 0; i < n; i++) {
+            uart_write((unsigned char *)&traceRing[core][(first + i) % TRACE_RING_SIZE],
+                       sizeof(struct trace_record));
+        }
+        traceHead[core] = 0;
+        traceCount[core] = 0;
+    }
+
+    traceRecording = 1;
+}
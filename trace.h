@@ -0,0 +1,66 @@
+// A low-overhead binary event tracer. Each event is a fixed-size record in a
+// ring belonging to the core that logged it, so logging takes no locks and
+// never touches the UART. The 't' console command dumps every ring as a
+// binary stream, which tools/trace2json.py turns into a Chrome/Perfetto
+// trace. Build with -DTRACE_ENABLE=0 to compile the trace points out.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE     1
+#endif
+
+// Number of records kept per core. Older records are overwritten.
+#define TRACE_RING_SIZE  1024
+#define TRACE_CORES      4
+
+// Event phases, matching the Chrome trace "ph" field
+#define TRACE_PHASE_BEGIN    'B'
+#define TRACE_PHASE_END      'E'
+#define TRACE_PHASE_INSTANT  'i'
+
+// Event ids. The names dumped with the trace come from traceNames[] in
+// trace.c, which must be kept in the same order.
+#define TRACE_FRAME          0
+#define TRACE_GET_SNES       1
+#define TRACE_DRAW_SQUARE    2
+#define TRACE_MAILBOX_QUERY  3
+#define TRACE_RENDER_MAZE    4
+#define TRACE_SPRITE_MOVE    5
+#define TRACE_INPUT          6
+#define TRACE_RAYCAST        7
+#define TRACE_FLOW           8
+#define TRACE_ENTITIES       9
+#define TRACE_CAPTURE        10
+#define TRACE_FOV            11
+#define TRACE_MINIMAP        12
+#define TRACE_COMPOSITE      13
+#define TRACE_HUD            14
+#define TRACE_EVENTS         15
+
+// One trace record (16 bytes)
+struct trace_record {
+    unsigned long timestamp;    // clock_now() when the event was logged
+    unsigned short event;       // Event id
+    unsigned char core;         // Core that logged the event
+    unsigned char phase;        // TRACE_PHASE_BEGIN, _END or _INSTANT
+    unsigned int arg;           // Event-specific argument
+};
+
+// Function prototypes
+void trace_record(unsigned int event, unsigned int phase, unsigned int arg);
+void trace_dump();
+
+// Trace points. These compile to nothing when TRACE_ENABLE is 0.
+#if TRACE_ENABLE
+#define TRACE_BEGIN(event)         trace_record((event), TRACE_PHASE_BEGIN, 0)
+#define TRACE_END(event)           trace_record((event), TRACE_PHASE_END, 0)
+#define TRACE_INSTANT(event, arg)  trace_record((event), TRACE_PHASE_INSTANT, (arg))
+#else
+#define TRACE_BEGIN(event)
+#define TRACE_END(event)
+#define TRACE_INSTANT(event, arg)
+#endif
+
+#endif
@@ -3,10 +3,16 @@
 // serial connection. Once uart_init() has been called, the Pi can transmit
 // and receive characters over the UART connection using the functions
 // uart_putc(), uart_puts(), uart_getc(), uart_puthex().
+//
+// The Mini UART is driven here. When the console is built to use the PL011
+// instead (see uart.h), the functions below pass through to pl011.c.
 
 // This file is needed since it defines the memory mapped I/O base address.
 // Note that MMIO_BASE = 0x3F000000 is the ARM physical address.
 #include "gpio.h"
+#include "mailbox.h"
+#include "pl011.h"
+#include "uart.h"
 
 // The addresses of the Auxilary Mini UART registers.
 //
@@ -15,19 +21,30 @@
 // which have the address range 0x3F000000 to 0x3FFFFFFF. These addresses are
 // mapped by the VideoCore Memory Management Unit (MMU) onto the bus addresses
 // in the range 0x7E000000 to 0x7EFFFFFF.
-#define AUX_IRQ         ((volatile unsigned int *)(MMIO_BASE + 0x00215000))
-#define AUX_ENABLE      ((volatile unsigned int *)(MMIO_BASE + 0x00215004))
-#define AUX_MU_IO       ((volatile unsigned int *)(MMIO_BASE + 0x00215040))
-#define AUX_MU_IER      ((volatile unsigned int *)(MMIO_BASE + 0x00215044))
-#define AUX_MU_IIR      ((volatile unsigned int *)(MMIO_BASE + 0x00215048))
-#define AUX_MU_LCR      ((volatile unsigned int *)(MMIO_BASE + 0x0021504C))
-#define AUX_MU_MCR      ((volatile unsigned int *)(MMIO_BASE + 0x00215050))
-#define AUX_MU_LSR      ((volatile unsigned int *)(MMIO_BASE + 0x00215054))
-#define AUX_MU_MSR      ((volatile unsigned int *)(MMIO_BASE + 0x00215058))
-#define AUX_MU_SCRATCH  ((volatile unsigned int *)(MMIO_BASE + 0x0021505C))
-#define AUX_MU_CNTL     ((volatile unsigned int *)(MMIO_BASE + 0x00215060))
-#define AUX_MU_STAT     ((volatile unsigned int *)(MMIO_BASE + 0x00215064))
-#define AUX_MU_BAUD     ((volatile unsigned int *)(MMIO_BASE + 0x00215068))
+#define AUX_IRQ         MMIO_REG(MMIO_BASE + 0x00215000)
+#define AUX_ENABLE      MMIO_REG(MMIO_BASE + 0x00215004)
+#define AUX_MU_IO       MMIO_REG(MMIO_BASE + 0x00215040)
+#define AUX_MU_IER      MMIO_REG(MMIO_BASE + 0x00215044)
+#define AUX_MU_IIR      MMIO_REG(MMIO_BASE + 0x00215048)
+#define AUX_MU_LCR      MMIO_REG(MMIO_BASE + 0x0021504C)
+#define AUX_MU_MCR      MMIO_REG(MMIO_BASE + 0x00215050)
+#define AUX_MU_LSR      MMIO_REG(MMIO_BASE + 0x00215054)
+#define AUX_MU_MSR      MMIO_REG(MMIO_BASE + 0x00215058)
+#define AUX_MU_SCRATCH  MMIO_REG(MMIO_BASE + 0x0021505C)
+#define AUX_MU_CNTL     MMIO_REG(MMIO_BASE + 0x00215060)
+#define AUX_MU_STAT     MMIO_REG(MMIO_BASE + 0x00215064)
+#define AUX_MU_BAUD     MMIO_REG(MMIO_BASE + 0x00215068)
+
+// The core clock rate the firmware sets up by default, used if the mailbox
+// query fails
+#define CORE_CLOCK_DEFAULT  250000000
+
+// The transmit queue (see uart.h): a ring of bytes, with the index of the
+// oldest byte and the number of bytes queued
+static unsigned char uartTxQueue[UART_TX_QUEUE_SIZE];
+static unsigned int uartTxFirst, uartTxCount;
+
+static void txDrain();
 
 
 
@@ -42,107 +59,74 @@
 //  Description:    This function initializes the Mini UART peripheral (UART1)
 //                  on the Raspberry Pi 3. First, the GPIO pins are set up so
 //                  that they map to UART1. Then the UART peripheral is
-//                  initialized to 8-bit mode with a Baud rate of 115200.
+//                  initialized to 8-bit mode with a Baud rate of UART_BAUD.
 //                  Finally, the UART transmitter and receiver are enabled.
+//                  With the PL011 backend, pl011_init() is called instead.
 //
 ////////////////////////////////////////////////////////////////////////////////
 
 void uart_init()
 {
-    register unsigned int r;
+    static const struct gpio_pin_config uartPins[] = {
+        {14, GPIO_ALT5, GPIO_PULL_NONE},
+        {15, GPIO_ALT5, GPIO_PULL_NONE},
+    };
+    unsigned int clock;
     
 
-    // Map the Mini UART (UART1) to GPIO pins 14 and 15. The GPIO pins must
-    // be set up before initializing the Mini UART.
-
-    // Get the current contents of the GPIO Function Select Register 1
-    r = *GPFSEL1;
-
-    // Clear bits 12-14 and 15-17. These are the fields FSEL14 and FSEL15,
-    // which map to GPIO pins 14 and 15. We clear the bits by ANDing with a 
-    // 000 bit pattern in the two fields.
-    r &= ~( (0x7 << 12) | (0x7 << 15) );
-
-    // Set the fields FSEL14 and FSEL15 to alternate function 5, which
-    // maps the Mini UART peripheral to GPIO pins 14 and 15.
-    // We do so by ORing the bit pattern 010 into the fields.
-    // This function treats pin 14 as a UART TXD pin, and pin 15
-    // as a UART RXD pin.
-    r |= (0x2 << 12) | (0x2 << 15);
-
-    // Write the modified bit pattern back to the
-    // GPIO Function Select Register 1
-    *GPFSEL1 = r;
-
-    // Disable the pull-up/pull-down control line for GPIO
-    // pins 14 and 15. We follow the procedure outlined on 
-    // page 101 of the BCM2837 ARM Peripherals manual.
-
-    // Disable pull-up/pull-down by setting bits 0:1
-    // to 00 in the GPIO Pull-Up/Down Register 
-    *GPPUD = 0x0;
-
-    // Wait 150 cycles to provide the required set-up time 
-    // for the control signal
-    r = 150;
-    while (r--) {
-      asm volatile("nop");
-    }
-
-    // Write to the GPIO Pull-Up/Down Clock Register 0,
-    // using a 1 on bits 14 and 15 to clock in the control
-    // signal for GPIO pins 14 and 15. Note that all other
-    // pins will retain their previous state.
-    *GPPUDCLK0 = (0x1 << 14) | (0x1 << 15);
-
-    // Wait 150 cycles to provide the required hold time
-    // for the control signal
-    r = 150;
-    while (r--) {
-      asm volatile("nop");
-    }
+#if UART_BACKEND == UART_PL011
+    pl011_init(UART_BAUD);
+    return;
+#endif
 
-    // Clear all bits in the GPIO Pull-Up/Down Clock Register 0
-    // in order to remove the clock
-    *GPPUDCLK0 = 0;
+    // Map the Mini UART (UART1) to GPIO pins 14 and 15. The GPIO pins must
+    // be set up before initializing the Mini UART. Alternate function 5
+    // makes pin 14 the UART TXD pin and pin 15 the RXD pin, and their
+    // pull-up/pull-down resistors are disabled.
+    gpio_configure(uartPins, 2);
     
     
     // Initialize the Mini UART peripheral
     
     // Enable the Mini UART by setting bit 0 in the
     // Auxiliary Enable register to a 1 value
-    *AUX_ENABLE |= 0x1;
+    mmio_write(AUX_ENABLE, mmio_read(AUX_ENABLE) | 0x1);
     
     // Disable all Mini UART interrupts by setting all fields
     // in the Mini UART Interrupt Enable Register to zero
-    *AUX_MU_IER = 0;
+    mmio_write(AUX_MU_IER, 0);
     
     // Turn off flow control features by setting all fields
     // in the Mini UART Control Register to zero
-    *AUX_MU_CNTL = 0;
+    mmio_write(AUX_MU_CNTL, 0);
     
     // Set the UART to work in 8-bit mode by setting bits 1:0
     // in the Mini UART Line Control Register to 11
-    *AUX_MU_LCR = 0x3;
+    mmio_write(AUX_MU_LCR, 0x3);
     
     // Set the RTS line to high by setting bit 1 (and all other fields)
     // in the Mini UART Modem Control Register to zero
-    *AUX_MU_MCR = 0;
+    mmio_write(AUX_MU_MCR, 0);
     
     // Enable both the receive and transmit FIFO buffers and clear their
     // contents by setting bits 7:6 and 2:1 in the Mini UART Interrupt
     // Status Register to 1 values (bit mask is:  1100 0110)
-    *AUX_MU_IIR = 0xc6;
+    mmio_write(AUX_MU_IIR, 0xc6);
     
-    // Set the Baud rate to 115200. We do this by putting the value 270
-    // into bits 15:0 of the Mini UART Baud Register. This value is calculated
-    // with the formula:  rint((systemClockRate / (8 * 115200)) - 1)
-    // where the systemClockRate is 250 MHz.
-    *AUX_MU_BAUD = 270;
+    // Set the Baud rate. We do this by putting a divisor into bits 15:0 of
+    // the Mini UART Baud Register. The divisor is calculated with the
+    // formula:  rint((systemClockRate / (8 * baudRate)) - 1)
+    // where the systemClockRate is the core clock, as reported by the
+    // firmware (270 for 115200 baud at 250 MHz).
+    clock = mailbox_get_clock_rate(CLOCK_CORE);
+    if (clock == 0) {
+        clock = CORE_CLOCK_DEFAULT;
+    }
+    mmio_write(AUX_MU_BAUD, (clock + 4 * UART_BAUD) / (8 * UART_BAUD) - 1);
 
     // Enable the Mini UART's transmitter and receiver by setting bits 1:0
     // in the Mini UART Control Register to the bit pattern 11
-    *AUX_MU_CNTL = 0x3;
+    mmio_write(AUX_MU_CNTL, 0x3);
 }
 
 
@@ -164,16 +148,23 @@ void uart_init()
 
 void uart_putc(unsigned int c)
 {
+    txDrain();
+
+#if UART_BACKEND == UART_PL011
+    pl011_putc(c);
+    return;
+#endif
+
     // Loop until the transmit FIFO buffer is able to accept a character for
     // transmission. This will be true when the Transmitter Empty bit
     // (bit 5) in the Mini UART Line Status Register is a 1 value.
     do {
     	// Use the NOP assembly language instruction in the loop body
       	asm volatile("nop");
-    } while ( !(*AUX_MU_LSR & 0x20) );
+    } while ( !(mmio_read(AUX_MU_LSR) & 0x20) );
     
     // Write the character to the mini UART I/O register
-    *AUX_MU_IO = c;
+    mmio_write(AUX_MU_IO, c);
 }
 
 
@@ -197,16 +188,21 @@ char uart_getc()
 {
     char r;
     
+#if UART_BACKEND == UART_PL011
+    r = (char)pl011_getc();
+    return r == '\r' ? '\n' : r;
+#endif
+
     // Loop until an input character is available in the receive FIFO buffer.
     // At least one character is available when the Data Ready bit (bit 0)
     // in the Mini UART Line Status Register is a 1 value.
     do {
     	// Use the NOP assembly language instruction in the loop body
         asm volatile("nop");
-    } while ( !(*AUX_MU_LSR & 0x1) );
+    } while ( !(mmio_read(AUX_MU_LSR) & 0x1) );
 
     // Read the character from the Mini UART I/O register
-    r = (char)(*AUX_MU_IO);
+    r = (char)(mmio_read(AUX_MU_IO));
     
     // Convert the carrige return character to a newline
     // character, otherwise return the character unchanged
@@ -215,6 +211,34 @@ char uart_getc()
 
 
  
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       uart_rx_ready
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE (non-zero) if a received character is waiting in the
+//                  receive FIFO buffer, FALSE (zero) otherwise.
+//
+//  Description:    This function lets calling code poll for console input
+//                  without blocking, so that uart_getc() is only called
+//                  when it will return immediately.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int uart_rx_ready()
+{
+#if UART_BACKEND == UART_PL011
+    return pl011_rx_ready();
+#endif
+
+    // The Data Ready bit (bit 0) in the Mini UART Line Status Register
+    // is a 1 value when the receive FIFO holds at least one character
+    return (mmio_read(AUX_MU_LSR) & 0x1);
+}
+
+
+ 
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  Function:       uart_puts
@@ -230,6 +254,13 @@ char uart_getc()
 
 void uart_puts(char *s)
 {
+    txDrain();
+
+#if UART_BACKEND == UART_PL011
+    pl011_puts(s);
+    return;
+#endif
+
     // Keep processing characters in the string until we reach a null
     // terminating character
     while (*s) {
@@ -284,3 +315,217 @@ void uart_puthex(unsigned int value) {
         uart_putc(digit);
     }
 }
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       uart_putdec
+//
+//  Arguments:      value:    The integer value to write to the console
+//
+//  Returns:        void
+//
+//  Description:    This function writes the specified unsigned integer value
+//                  to the console terminal as a decimal number, without any
+//                  leading zeros.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void uart_putdec(unsigned long value) {
+    char digits[20];
+    register int i = 0;
+
+    // Generate the digits from the rightmost one, storing them in reverse
+    do {
+        digits[i++] = '0' + (value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    // Write the digits to the console terminal, leftmost digit first
+    while (i > 0) {
+        uart_putc(digits[--i]);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       uart_write
+//
+//  Arguments:      buffer:   The bytes to write
+//                  length:   The number of bytes
+//
+//  Returns:        void
+//
+//  Description:    This function writes raw binary data to the console
+//                  terminal. Unlike uart_puts(), no bytes are translated,
+//                  so newline bytes are not expanded.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void uart_write(unsigned char *buffer, unsigned int length)
+{
+    txDrain();
+
+#if UART_BACKEND == UART_PL011
+    pl011_write(buffer, length);
+    return;
+#endif
+
+    while (length--) {
+        uart_putc(*buffer++);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       uart_read
+//
+//  Arguments:      buffer:   Where to store the bytes
+//                  length:   The most bytes to read
+//
+//  Returns:        The number of bytes read, which is 0 if none have
+//                  arrived.
+//
+//  Description:    This function reads raw binary data from the console
+//                  terminal, taking only the bytes already in the receive
+//                  FIFO buffer, so it never waits. Unlike uart_getc(), no
+//                  bytes are translated, so a binary stream can contain
+//                  carriage returns.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int uart_read(unsigned char *buffer, unsigned int length)
+{
+    unsigned int count = 0;
+
+#if UART_BACKEND == UART_PL011
+    while (count < length && pl011_rx_ready()) {
+        buffer[count++] = pl011_getc();
+    }
+    return count;
+#endif
+
+    while (count < length && (mmio_read(AUX_MU_LSR) & 0x1)) {
+        buffer[count++] = mmio_read(AUX_MU_IO);
+    }
+    return count;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       uart_tx_space
+//
+//  Arguments:      none
+//
+//  Returns:        The number of bytes uart_queue() can take now.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int uart_tx_space()
+{
+    return UART_TX_QUEUE_SIZE - uartTxCount;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       uart_queue
+//
+//  Arguments:      buffer:   The bytes to send
+//                  length:   The number of bytes
+//
+//  Returns:        TRUE (non-zero) if the bytes were queued, FALSE (zero)
+//                  if there was not room for all of them, in which case
+//                  none were.
+//
+//  Description:    This function adds raw bytes to the transmit queue
+//                  without waiting for the UART. A block of bytes is queued
+//                  whole or not at all, so a binary record is never cut off
+//                  by other output.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int uart_queue(unsigned char *buffer, unsigned int length)
+{
+    unsigned int last;
+
+
+    if (length > uart_tx_space()) {
+        return 0;
+    }
+
+    while (length--) {
+        last = (uartTxFirst + uartTxCount) % UART_TX_QUEUE_SIZE;
+        uartTxQueue[last] = *buffer++;
+        uartTxCount++;
+    }
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       uart_tx_poll
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function moves queued bytes into the UART's transmit
+//                  FIFO until the FIFO is full or the queue is empty. It
+//                  never waits, so it can be called between frames.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void uart_tx_poll()
+{
+    while (uartTxCount > 0) {
+#if UART_BACKEND == UART_PL011
+        if (!pl011_tx_ready()) {
+            return;
+        }
+        pl011_putc(uartTxQueue[uartTxFirst]);
+#else
+        // The Transmitter Empty bit (bit 5) in the Mini UART Line Status
+        // Register is a 1 value when the FIFO can accept a character
+        if (!(mmio_read(AUX_MU_LSR) & 0x20)) {
+            return;
+        }
+        mmio_write(AUX_MU_IO, uartTxQueue[uartTxFirst]);
+#endif
+        uartTxFirst = (uartTxFirst + 1) % UART_TX_QUEUE_SIZE;
+        uartTxCount--;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       txDrain
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function sends the whole transmit queue, waiting for
+//                  the UART as needed. The writes that wait anyway call it
+//                  first, so their output follows the queued bytes.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void txDrain()
+{
+    while (uartTxCount > 0) {
+        uart_tx_poll();
+    }
+}
@@ -1,7 +1,41 @@
-// These are the function prototypes for reading/writing the Mini UART
+// These are the function prototypes for reading/writing the console UART.
+//
+// The console can be the Mini UART (UART1, the default) or the PL011
+// (UART0, see pl011.h). The backend and baud rate are chosen when building,
+// e.g. 'make UART_BACKEND=UART_PL011 UART_BAUD=3000000'. The Mini UART's
+// baud rate follows the core clock, so it is only set correctly for the
+// core clock at the time uart_init() is called.
+
+// Console UART backends
+#define UART_MINI       0
+#define UART_PL011      1
+
+#ifndef UART_BACKEND
+#define UART_BACKEND    UART_MINI
+#endif
+
+#ifndef UART_BAUD
+#define UART_BAUD       115200
+#endif
+
+// Size of the transmit queue. uart_queue() adds bytes to it without
+// waiting, and uart_tx_poll() moves them to the UART as its FIFO empties.
+// Every other write sends the whole queue first, so queued bytes are never
+// interleaved with other output. Only core 0 may use the UART. The queue
+// holds a whole screen capture tile (see capture.h) with its header.
+#define UART_TX_QUEUE_SIZE  32768
+
+// Function prototypes
 
 void uart_init();
 void uart_putc(unsigned int c);
 char uart_getc();
+int uart_rx_ready();
 void uart_puts(char *s);
 void uart_puthex(unsigned int value);
+void uart_putdec(unsigned long value);
+void uart_write(unsigned char *buffer, unsigned int length);
+unsigned int uart_read(unsigned char *buffer, unsigned int length);
+unsigned int uart_tx_space();
+int uart_queue(unsigned char *buffer, unsigned int length);
+void uart_tx_poll();
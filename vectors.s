@@ -0,0 +1,143 @@
+// The exception vector table. start.s points the vector base address
+// register of the current exception level at this table on every core.
+//
+// The table has 16 entries of 128 bytes each: synchronous exceptions,
+// IRQs, FIQs and SErrors, taken from the current exception level with
+// SP_EL0, from the current exception level with SP_ELx, from a lower
+// exception level in AArch64 and from a lower exception level in AArch32.
+// Only IRQs taken at the current exception level are expected. They are
+// passed to irq_handler() in irq.c, after saving every register that a C
+// function may change. Anything else is reported by exception_unexpected()
+// in irq.c.
+
+
+	// The table must be aligned to 2 KB
+	.section ".text"
+	.balign	2048
+	.global exception_vectors
+exception_vectors:
+	// Current exception level, SP_EL0
+	.balign	0x80
+	mov	x0, 0
+	b	unexpected
+	.balign	0x80
+	b	irq_entry
+	.balign	0x80
+	mov	x0, 2
+	b	unexpected
+	.balign	0x80
+	mov	x0, 3
+	b	unexpected
+
+	// Current exception level, SP_ELx
+	.balign	0x80
+	mov	x0, 4
+	b	unexpected
+	.balign	0x80
+	b	irq_entry
+	.balign	0x80
+	mov	x0, 6
+	b	unexpected
+	.balign	0x80
+	mov	x0, 7
+	b	unexpected
+
+	// Lower exception level, AArch64
+	.balign	0x80
+	mov	x0, 8
+	b	unexpected
+	.balign	0x80
+	mov	x0, 9
+	b	unexpected
+	.balign	0x80
+	mov	x0, 10
+	b	unexpected
+	.balign	0x80
+	mov	x0, 11
+	b	unexpected
+
+	// Lower exception level, AArch32
+	.balign	0x80
+	mov	x0, 12
+	b	unexpected
+	.balign	0x80
+	mov	x0, 13
+	b	unexpected
+	.balign	0x80
+	mov	x0, 14
+	b	unexpected
+	.balign	0x80
+	mov	x0, 15
+	b	unexpected
+
+
+
+	// An unexpected exception. The entry number is in x0. The
+	// report never returns, so no registers are saved.
+unexpected:
+	bl	exception_unexpected
+1:	wfe
+	b	1b
+
+
+
+	// An IRQ. The registers that the procedure call standard lets a
+	// C function change are saved on the stack: x0 - x18, the frame
+	// pointer and link register (x29, x30), and the SIMD registers
+	// q0 - q7 and q16 - q31, which the compiler may use for copies
+	// and for floating point. 21 general registers (plus one for
+	// alignment) and 24 SIMD registers take 560 bytes, which is
+	// rounded up to keep the stack 16-byte aligned.
+irq_entry:
+	sub	sp, sp, 576
+	stp	x0, x1, [sp, 0]
+	stp	x2, x3, [sp, 16]
+	stp	x4, x5, [sp, 32]
+	stp	x6, x7, [sp, 48]
+	stp	x8, x9, [sp, 64]
+	stp	x10, x11, [sp, 80]
+	stp	x12, x13, [sp, 96]
+	stp	x14, x15, [sp, 112]
+	stp	x16, x17, [sp, 128]
+	stp	x18, x29, [sp, 144]
+	str	x30, [sp, 160]
+	stp	q0, q1, [sp, 176]
+	stp	q2, q3, [sp, 208]
+	stp	q4, q5, [sp, 240]
+	stp	q6, q7, [sp, 272]
+	stp	q16, q17, [sp, 304]
+	stp	q18, q19, [sp, 336]
+	stp	q20, q21, [sp, 368]
+	stp	q22, q23, [sp, 400]
+	stp	q24, q25, [sp, 432]
+	stp	q26, q27, [sp, 464]
+	stp	q28, q29, [sp, 496]
+	stp	q30, q31, [sp, 528]
+
+	bl	irq_handler
+
+	ldp	q30, q31, [sp, 528]
+	ldp	q28, q29, [sp, 496]
+	ldp	q26, q27, [sp, 464]
+	ldp	q24, q25, [sp, 432]
+	ldp	q22, q23, [sp, 400]
+	ldp	q20, q21, [sp, 368]
+	ldp	q18, q19, [sp, 336]
+	ldp	q16, q17, [sp, 304]
+	ldp	q6, q7, [sp, 272]
+	ldp	q4, q5, [sp, 240]
+	ldp	q2, q3, [sp, 208]
+	ldp	q0, q1, [sp, 176]
+	ldr	x30, [sp, 160]
+	ldp	x18, x29, [sp, 144]
+	ldp	x16, x17, [sp, 128]
+	ldp	x14, x15, [sp, 112]
+	ldp	x12, x13, [sp, 96]
+	ldp	x10, x11, [sp, 80]
+	ldp	x8, x9, [sp, 64]
+	ldp	x6, x7, [sp, 48]
+	ldp	x4, x5, [sp, 32]
+	ldp	x2, x3, [sp, 16]
+	ldp	x0, x1, [sp, 0]
+	add	sp, sp, 576
+	eret